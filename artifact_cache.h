@@ -0,0 +1,319 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "json.hpp"
+#include "project_exceptions.h"
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+//Content-addressed store of build outputs, shared by every workspace and every project_builder
+//process on the host. An entry is the output folder of one project build, filed under a key that
+//identifies everything the build depended on. Restoring an entry replaces the output folder of the
+//project with the stored files, without building it.
+//Layout of the cache folder:
+    //objects/<first two characters of the key>/<key>/      the output files
+    //objects/<first two characters of the key>/<key>.meta  size and hash of the outputs; its
+    //                                                      modification time is the last use
+    //tmp/                                                  entries being written
+    //lock                                                  see below
+//Entries are written under tmp and renamed into place, and an entry only counts once its .meta
+//file exists, so a reader never sees a partial entry. Processes coordinate through flock() on the
+//lock file: restoring takes it shared, publishing and evicting take it exclusive, so an entry can't
+//be evicted while it's being restored. When the cache grows over its size cap, the least recently
+//used entries are evicted.
+class ArtifactCache
+{
+private:
+    std::filesystem::path m_folder;
+    uint64_t m_MaxBytes;
+
+    //Held for the lifetime of the object. Every instance opens the lock file on its own, so it
+    //excludes other threads of the same process as well as other processes.
+    class FileLock
+    {
+    private:
+        int m_fd {-1};
+
+    public:
+        FileLock(const std::filesystem::path &lock_file, bool exclusive)
+        {
+#if defined(__linux__) || defined(__APPLE__)
+            m_fd = open(lock_file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            ThrowIfFalse<BaseException>(m_fd >= 0, "ArtifactCache::FileLock", "Unable to open " + lock_file.string());
+            while(flock(m_fd, exclusive ? LOCK_EX : LOCK_SH) != 0 && errno == EINTR)
+            {
+
+            }
+#endif
+        }
+
+        FileLock(const FileLock &) = delete;
+        FileLock &operator=(const FileLock &) = delete;
+
+        ~FileLock()
+        {
+#if defined(__linux__) || defined(__APPLE__)
+            if(m_fd >= 0)
+            {
+                close(m_fd);    //releases the lock
+            }
+#endif
+        }
+    };
+
+    [[nodiscard]] std::filesystem::path EntryFolder(const std::string &key) const
+    {
+        return (m_folder / "objects" / key.substr(0, 2) / key);
+    }
+
+    [[nodiscard]] std::filesystem::path MetaFile(const std::string &key) const
+    {
+        auto meta_file = EntryFolder(key);
+        meta_file += ".meta";
+        return (meta_file);
+    }
+
+    [[nodiscard]] std::filesystem::path LockFile() const {return (m_folder / "lock");}
+
+    //Copy-on-write clone of the file, which shares the data blocks with the original until either
+    //one is written to. Only some filesystems (btrfs, xfs, ...) support it.
+    static bool TryReflink(const std::filesystem::path &from, const std::filesystem::path &to)
+    {
+#if defined(__linux__) && defined(FICLONE)
+        auto source = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+        if(source < 0)
+        {
+            return (false);
+        }
+
+        auto target = open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        auto cloned = (target >= 0 && ioctl(target, FICLONE, source) == 0);
+        if(target >= 0)
+        {
+            close(target);
+            if(!cloned)
+            {
+                unlink(to.c_str());
+            }
+        }
+        close(source);
+        return (cloned);
+#else
+        return (false);
+#endif
+    }
+
+    //Recreates the tree under from at to, file by file: a reflink if the filesystem can, otherwise
+    //a hard link if allowed, otherwise a copy. Hard links are only used to restore: the stored
+    //files are read-only, so they can't be modified through the link.
+    static void Materialize(const std::filesystem::path &from, const std::filesystem::path &to, bool allow_hard_link)
+    {
+        std::filesystem::create_directories(to);
+        for(auto it = std::filesystem::recursive_directory_iterator(from);
+            it != std::filesystem::recursive_directory_iterator(); ++it)
+        {
+            auto target = to / std::filesystem::relative(it->path(), from);
+            if(it->is_symlink())
+            {
+                std::filesystem::copy_symlink(it->path(), target);
+            }
+            else if(it->is_directory())
+            {
+                std::filesystem::create_directories(target);
+            }
+            else if(it->is_regular_file())
+            {
+                auto error = std::error_code();
+                if(!TryReflink(it->path(), target) &&
+                   !(allow_hard_link && (std::filesystem::create_hard_link(it->path(), target, error), !error)))
+                {
+                    std::filesystem::copy_file(it->path(), target);
+                }
+            }
+        }
+    }
+
+    static uint64_t FolderSize(const std::filesystem::path &folder)
+    {
+        auto size = uint64_t {0};
+        for(auto &entry : std::filesystem::recursive_directory_iterator(folder))
+        {
+            if(entry.is_regular_file() && !entry.is_symlink())
+            {
+                size += entry.file_size();
+            }
+        }
+        return (size);
+    }
+
+    static void MakeReadOnly(const std::filesystem::path &folder)
+    {
+        for(auto &entry : std::filesystem::recursive_directory_iterator(folder))
+        {
+            if(entry.is_regular_file() && !entry.is_symlink())
+            {
+                std::filesystem::permissions(entry.path(),
+                                             std::filesystem::perms::owner_write |
+                                             std::filesystem::perms::group_write |
+                                             std::filesystem::perms::others_write,
+                                             std::filesystem::perm_options::remove);
+            }
+        }
+    }
+
+    static void RemoveEntry(const std::filesystem::path &entry_folder)
+    {
+        //The files are read-only, but only the permissions of the folders matter for removing them.
+        auto error = std::error_code();
+        std::filesystem::remove_all(entry_folder, error);
+    }
+
+    //Must be called with the lock held exclusively.
+    void Evict()
+    {
+        struct Entry
+        {
+            std::filesystem::file_time_type m_LastUsed;
+            uint64_t m_size;
+            std::filesystem::path m_MetaFile;
+        };
+
+        auto entries = std::vector<Entry>();
+        auto total = uint64_t {0};
+        for(auto &shard : std::filesystem::directory_iterator(m_folder / "objects"))
+        {
+            for(auto &file : std::filesystem::directory_iterator(shard.path()))
+            {
+                if(file.path().extension() != ".meta")
+                {
+                    continue;
+                }
+
+                auto s = std::ifstream(file.path());
+                auto meta_json = nlohmann::json::parse(s, nullptr, false);
+                auto size = (meta_json.is_discarded() ? uint64_t {0} : meta_json.value("Size", uint64_t {0}));
+                entries.emplace_back(Entry {file.last_write_time(), size, file.path()});
+                total += size;
+            }
+        }
+
+        if(total <= m_MaxBytes)
+        {
+            return;
+        }
+
+        std::sort(entries.begin(), entries.end(), [](auto &a, auto &b) {return (a.m_LastUsed < b.m_LastUsed);});
+        for(auto &entry : entries)
+        {
+            if(total <= m_MaxBytes)
+            {
+                break;
+            }
+
+            //The .meta file goes first: without it, the entry doesn't exist anymore.
+            std::filesystem::remove(entry.m_MetaFile);
+            auto entry_folder = entry.m_MetaFile;
+            RemoveEntry(entry_folder.replace_extension());
+            total -= entry.m_size;
+        }
+    }
+
+public:
+    ArtifactCache(const std::filesystem::path &folder, uint64_t max_bytes) : m_folder(folder),
+                                                                             m_MaxBytes(max_bytes)
+    {
+        std::filesystem::create_directories(m_folder / "objects");
+        std::filesystem::create_directories(m_folder / "tmp");
+    }
+
+    ~ArtifactCache() = default;
+
+    //Replaces output_folder with the stored outputs. Returns the hash of the outputs, or nothing if
+    //there is no entry for the key.
+    std::optional<std::string> Restore(const std::string &key, const std::filesystem::path &output_folder)
+    {
+        auto lock = FileLock(LockFile(), false);
+        auto meta_file = MetaFile(key);
+        auto s = std::ifstream(meta_file);
+        if(!s)
+        {
+            return (std::nullopt);
+        }
+
+        auto meta_json = nlohmann::json::parse(s, nullptr, false);
+        if(meta_json.is_discarded())
+        {
+            return (std::nullopt);
+        }
+
+        std::filesystem::remove_all(output_folder);
+        Materialize(EntryFolder(key), output_folder, true);
+
+        //Marks the entry as the most recently used one.
+        auto error = std::error_code();
+        std::filesystem::last_write_time(meta_file, std::filesystem::file_time_type::clock::now(), error);
+        return (meta_json.value("Output Hash", ""));
+    }
+
+    //Stores a copy of output_folder under the key, unless there already is an entry for it, and
+    //evicts the least recently used entries if the cache is over its size cap.
+    void Store(const std::string &key, const std::filesystem::path &output_folder, const std::string &output_hash)
+    {
+        if(std::filesystem::exists(MetaFile(key)))
+        {
+            return;
+        }
+
+        //Unique among processes and among the threads of this one.
+        auto temp_name = key + "." + std::to_string(getpid()) + "." +
+                         std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+        auto temp_folder = m_folder / "tmp" / temp_name;
+        RemoveEntry(temp_folder);
+        Materialize(output_folder, temp_folder, false);
+        MakeReadOnly(temp_folder);
+
+        auto meta_json = nlohmann::ordered_json();
+        meta_json["Size"] = FolderSize(temp_folder);
+        meta_json["Output Hash"] = output_hash;
+        auto temp_meta = temp_folder;
+        temp_meta += ".meta";
+        {
+            auto out_file = std::ofstream(temp_meta, std::ios::out | std::ios::trunc);
+            out_file << meta_json.dump(4);
+        }
+
+        auto lock = FileLock(LockFile(), true);
+        auto entry_folder = EntryFolder(key);
+        if(std::filesystem::exists(MetaFile(key)))
+        {
+            RemoveEntry(temp_folder);       //another process stored it in the meantime
+            std::filesystem::remove(temp_meta);
+            return;
+        }
+
+        RemoveEntry(entry_folder);          //left behind by a process that died before its .meta
+        std::filesystem::create_directories(entry_folder.parent_path());
+        std::filesystem::rename(temp_folder, entry_folder);
+        std::filesystem::rename(temp_meta, MetaFile(key));
+        Evict();
+    }
+
+    [[nodiscard]] const std::filesystem::path &GetFolder() const {return (m_folder);}
+    [[nodiscard]] uint64_t GetMaxBytes() const {return (m_MaxBytes);}
+};
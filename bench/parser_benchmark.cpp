@@ -0,0 +1,165 @@
+//Compares ProjectFileParser with the json document parsing ProjectMapper::Load used before it. Both
+//read the same synthetic project files, with a few references, commands and the comments found in
+//the sample projects, and resolve the references against the root folder. Besides the time, the
+//number of heap allocations per file is reported, counted by replacing the global operator new.
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include "json.hpp"
+#include "project_parser.h"
+#include "ExecutionMeter.h"
+
+using namespace Hats::Tools;
+
+static std::atomic<size_t> g_allocations {0};
+
+void *operator new(size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if(auto p = std::malloc(size == 0 ? 1 : size))
+    {
+        return (p);
+    }
+    throw(std::bad_alloc());
+}
+
+void *operator new[](size_t size)
+{
+    return (operator new(size));
+}
+
+//Not inlined, so that gcc doesn't see free() called on what it takes for a pointer from operator new.
+[[gnu::noinline]] static void Release(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p) noexcept {Release(p);}
+void operator delete(void *p, size_t) noexcept {Release(p);}
+void operator delete[](void *p) noexcept {Release(p);}
+void operator delete[](void *p, size_t) noexcept {Release(p);}
+
+//What the old Load produced for a project file.
+struct DomProjectData
+{
+    std::vector<std::string> m_dependencies;
+    std::string m_BuildCommand;
+    std::string m_ConvertCommand;
+};
+
+//The loader ProjectMapper used before ProjectFileParser, kept here only for comparison.
+DomProjectData DomLoad(const std::string &proj_file, const std::filesystem::path &root_folder)
+{
+    auto project_data = DomProjectData();
+
+    auto s = std::ifstream(proj_file);
+    auto project_config = nlohmann::json::parse(s);
+    for(auto &reference : project_config["References"])
+    {
+        auto absolute_path = root_folder / reference["Relative Path"];
+        project_data.m_dependencies.emplace_back(absolute_path);
+    }
+
+    project_data.m_BuildCommand = project_config.value("Build Command", "");
+    project_data.m_ConvertCommand = project_config.value("Convert Command", "");
+    return (project_data);
+}
+
+std::vector<std::string> GenerateFiles(const std::filesystem::path &folder, size_t count, size_t references)
+{
+    std::filesystem::remove_all(folder);
+    std::filesystem::create_directories(folder);
+
+    auto files = std::vector<std::string>();
+    for(size_t i = 0; i < count; ++i)
+    {
+        auto project_json = nlohmann::ordered_json();
+        project_json["Comment 1"] = "References are dependencies within the same root folder of the project.";
+        project_json["Comment 2"] = "External references are dependencies outside the root folder of the project.";
+        project_json["Project Name"] = "p" + std::to_string(i) + ".proj";
+        project_json["Path"] = "group" + std::to_string(i / 100) + "/p" + std::to_string(i) + ".proj";
+        project_json["References"] = nlohmann::ordered_json::array();
+        for(size_t r = 1; r <= references; ++r)
+        {
+            auto target = "p" + std::to_string((i + r) % count);
+            project_json["References"].push_back({{"Project Name", target},
+                                                  {"Relative Path", "group" + std::to_string(((i + r) % count) / 100) +
+                                                                    "/" + target + "/" + target + ".proj"}});
+        }
+        project_json["External References"] = nlohmann::ordered_json::array({nlohmann::ordered_json::object()});
+        project_json["Build Command"] = "make -C \"$PROJECT_DIR\" all";
+        project_json["Convert Command"] = "convert --in \"$PROJECT_FILE\" --out \"$BUILD_DIR\"";
+
+        auto file = folder / ("p" + std::to_string(i) + ".proj");
+        auto out_file = std::ofstream(file, std::ios::out | std::ios::trunc);
+        out_file << project_json.dump(4);
+        files.emplace_back(file.string());
+    }
+    return (files);
+}
+
+int main(int argc, char *argv[])
+{
+    auto count = (argc > 1 ? std::max<size_t>(std::stoul(argv[1]), 1) : size_t {10000});
+    auto references = (argc > 2 ? std::stoul(argv[2]) : size_t {4});
+    auto folder = std::filesystem::temp_directory_path() / "project_builder_parser_bench";
+    auto files = GenerateFiles(folder, count, references);
+    auto root_folder = std::filesystem::path("/work/projects");
+
+    //Both parsers must agree before their times mean anything.
+    auto parser = ProjectFileParser();
+    for(auto &file : files)
+    {
+        auto dom = DomLoad(file, root_folder);
+        auto &data = parser.Parse(file, root_folder.string());
+        auto same = (dom.m_BuildCommand == data.m_BuildCommand &&
+                     dom.m_ConvertCommand == data.m_ConvertCommand &&
+                     dom.m_dependencies.size() == data.m_dependencies.size());
+        for(size_t i = 0; same && i < dom.m_dependencies.size(); ++i)
+        {
+            same = (dom.m_dependencies[i] == data.m_dependencies[i]);
+        }
+        if(!same)
+        {
+            std::cout << "The parsers disagree on " << file << std::endl;
+            return (-1);
+        }
+    }
+
+    auto dependency_count = size_t {0};     //keeps the compiler from dropping the work
+
+    auto allocations = g_allocations.load();
+    auto meter = Meter<std::milli>();
+    for(auto &file : files)
+    {
+        dependency_count += DomLoad(file, root_folder).m_dependencies.size();
+    }
+    auto dom_time = meter.ElapsedTime();
+    auto dom_allocations = g_allocations.load() - allocations;
+
+    auto root_string = root_folder.string();
+    allocations = g_allocations.load();
+    meter = Meter<std::milli>();
+    for(auto &file : files)
+    {
+        dependency_count += parser.Parse(file, root_string).m_dependencies.size();
+    }
+    auto parser_time = meter.ElapsedTime();
+    auto parser_allocations = g_allocations.load() - allocations;
+
+    std::filesystem::remove_all(folder);
+
+    auto per_file = [count](double value) {return (value / static_cast<double>(count));};
+    std::cout << count << " project files, " << references << " references each (" << dependency_count << ")" << std::endl;
+    std::cout << std::left << std::setw(10) << "parser" << std::right << std::setw(12) << "total ms"
+              << std::setw(14) << "us per file" << std::setw(18) << "allocs per file" << std::endl;
+    std::cout << std::fixed << std::setprecision(2)
+              << std::left << std::setw(10) << "dom" << std::right << std::setw(12) << dom_time
+              << std::setw(14) << per_file(dom_time * 1000.0)
+              << std::setw(18) << per_file(static_cast<double>(dom_allocations)) << std::endl
+              << std::left << std::setw(10) << "pull" << std::right << std::setw(12) << parser_time
+              << std::setw(14) << per_file(parser_time * 1000.0)
+              << std::setw(18) << per_file(static_cast<double>(parser_allocations)) << std::endl;
+    return (0);
+}
@@ -0,0 +1,446 @@
+//Times every phase of the tool on synthetic project trees: mapping (crawl, parse, graph and
+//validation, i.e. constructing a ProjectMapper), validation on its own, conversion and build. The
+//trees are written as real .proj files, one per folder, under a scratch folder. Conversions and
+//builds are simulated with a zero duration, so what's measured is the overhead of the tool itself:
+//scheduling, book-keeping and synchronization.
+//
+//Shapes:
+//  wide     the root depends on every other project
+//  deep     a single chain of projects
+//  diamond  layers of four projects, each depending on all four projects of the next layer
+//  random   every project depends on up to four random projects created after it
+//
+//The root project always depends on every project nothing else depends on, so the whole tree is
+//built.
+//
+//Memory: for every scenario, the heap held by the mapped graph, i.e. what the mapper still has
+//allocated once it's constructed; at the end, the peak resident set size of the process. Run one
+//scenario per process to compare peak RSS between scenarios.
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include "json.hpp"
+#include "builder.h"
+#include "converter.h"
+#include "graph_validator.h"
+#include "mapper.h"
+#include "ExecutionMeter.h"
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+using namespace Hats::Tools;
+
+struct BenchmarkOptions
+{
+    std::vector<std::string> m_shapes {"wide", "deep", "diamond", "random"};
+    std::vector<size_t> m_sizes {1000, 10000};
+    size_t m_warmup {1};
+    size_t m_repetitions {5};
+    size_t m_jobs {std::max<size_t>(std::thread::hardware_concurrency(), 1)};
+    std::string m_ScratchFolder {std::filesystem::temp_directory_path() / "project_builder_bench"};
+    std::optional<std::string> m_JsonFile;
+    bool m_keep {false};
+};
+
+//Project i lives in <root>/g<i / 1000>/p<i>/p<i>.proj, so that no folder has more than a thousand
+//entries. Project 0 is the root and lives in the root folder itself.
+std::string RelativePath(size_t project)
+{
+    if(project == 0)
+    {
+        return ("root.proj");
+    }
+    auto name = "p" + std::to_string(project);
+    return ("g" + std::to_string(project / 1000) + "/" + name + "/" + name + ".proj");
+}
+
+std::vector<std::vector<size_t>> GenerateEdges(const std::string &shape, size_t size)
+{
+    auto edges = std::vector<std::vector<size_t>>(size);
+    if(shape == "deep")
+    {
+        for(size_t i = 0; i + 1 < size; ++i)
+        {
+            edges[i].emplace_back(i + 1);
+        }
+    }
+    else if(shape == "diamond")
+    {
+        constexpr size_t width {4};
+        for(size_t i = 1; i < size; ++i)
+        {
+            auto next_layer = ((i - 1) / width + 1) * width + 1;
+            for(auto j = next_layer; j < std::min(next_layer + width, size); ++j)
+            {
+                edges[i].emplace_back(j);
+            }
+        }
+    }
+    else if(shape == "random")
+    {
+        auto generator = std::mt19937_64(size);     //same tree for the same size on every run
+        for(size_t i = 1; i + 1 < size; ++i)
+        {
+            auto distribution = std::uniform_int_distribution<size_t>(i + 1, size - 1);
+            auto count = std::uniform_int_distribution<size_t>(0, 4)(generator);
+            for(size_t k = 0; k < count; ++k)
+            {
+                edges[i].emplace_back(distribution(generator));
+            }
+            std::sort(edges[i].begin(), edges[i].end());
+            edges[i].erase(std::unique(edges[i].begin(), edges[i].end()), edges[i].end());
+        }
+    }
+    else if(shape != "wide")
+    {
+        throw(std::invalid_argument("Unknown shape: " + shape));
+    }
+
+    //Everything that isn't referenced yet hangs off the root.
+    auto referenced = std::vector<uint8_t>(size, 0);
+    for(auto &targets : edges)
+    {
+        for(auto target : targets)
+        {
+            referenced[target] = 1;
+        }
+    }
+    for(size_t i = 1; i < size; ++i)
+    {
+        if(!referenced[i])
+        {
+            edges[0].emplace_back(i);
+        }
+    }
+    return (edges);
+}
+
+void GenerateTree(const std::filesystem::path &root_folder, const std::string &shape, size_t size)
+{
+    std::filesystem::remove_all(root_folder);
+    auto edges = GenerateEdges(shape, size);
+    for(size_t i = 0; i < size; ++i)
+    {
+        auto project_file = root_folder / RelativePath(i);
+        std::filesystem::create_directories(project_file.parent_path());
+
+        auto project_json = nlohmann::ordered_json();
+        project_json["Project Name"] = project_file.filename().string();
+        project_json["Path"] = RelativePath(i);
+        project_json["References"] = nlohmann::ordered_json::array();
+        for(auto target : edges[i])
+        {
+            project_json["References"].push_back({{"Project Name", "p" + std::to_string(target)},
+                                                  {"Relative Path", RelativePath(target)}});
+        }
+
+        auto out_file = std::ofstream(project_file, std::ios::out | std::ios::trunc);
+        out_file << project_json.dump(4);
+    }
+}
+
+//Milliseconds of every repetition of one phase.
+struct PhaseTimes
+{
+    std::string m_name;
+    std::vector<double> m_samples;
+
+    [[nodiscard]] double Percentile(double p) const
+    {
+        auto sorted = m_samples;
+        std::sort(sorted.begin(), sorted.end());
+        auto rank = static_cast<size_t>(p / 100.0 * static_cast<double>(sorted.size() - 1) + 0.5);
+        return (sorted[rank]);
+    }
+
+    [[nodiscard]] double Mean() const
+    {
+        auto total = 0.0;
+        for(auto sample : m_samples)
+        {
+            total += sample;
+        }
+        return (total / static_cast<double>(m_samples.size()));
+    }
+
+    [[nodiscard]] nlohmann::ordered_json ToJson() const
+    {
+        auto phase_json = nlohmann::ordered_json();
+        phase_json["Phase"] = m_name;
+        phase_json["Samples"] = m_samples;
+        phase_json["Min"] = Percentile(0);
+        phase_json["Mean"] = Mean();
+        phase_json["P50"] = Percentile(50);
+        phase_json["P90"] = Percentile(90);
+        phase_json["P99"] = Percentile(99);
+        phase_json["Max"] = Percentile(100);
+        return (phase_json);
+    }
+};
+
+//The tool reports every project on the console. That output isn't what's being measured, so it's
+//discarded while the phases run.
+class SilenceConsole
+{
+private:
+    struct NullBuffer : std::streambuf
+    {
+        int overflow(int c) override {return (traits_type::not_eof(c));}
+    };
+
+    NullBuffer m_sink;
+    std::streambuf *m_original;
+
+public:
+    SilenceConsole() : m_original(std::cout.rdbuf(&m_sink))
+    {
+
+    }
+
+    ~SilenceConsole()
+    {
+        std::cout.rdbuf(m_original);
+    }
+};
+
+//Bytes currently allocated from the heap, 0 where the C library can't tell.
+size_t HeapInUse()
+{
+#if defined(__GLIBC__)
+    return (mallinfo2().uordblks + mallinfo2().hblkhd);
+#else
+    return (0);
+#endif
+}
+
+size_t PeakResidentSize()
+{
+#if defined(__linux__)
+    auto usage = rusage();
+    getrusage(RUSAGE_SELF, &usage);
+    return (static_cast<size_t>(usage.ru_maxrss) * 1024);     //KB on Linux
+#elif defined(__APPLE__)
+    auto usage = rusage();
+    getrusage(RUSAGE_SELF, &usage);
+    return (static_cast<size_t>(usage.ru_maxrss));            //bytes on macOS
+#else
+    return (0);
+#endif
+}
+
+struct ScenarioResult
+{
+    std::vector<PhaseTimes> m_phases {{"map", {}}, {"validate", {}}, {"convert", {}}, {"build", {}}};
+    size_t m_MapHeap {0};   //bytes held by the mapper after mapping, in the last run
+};
+
+ScenarioResult RunScenario(const BenchmarkOptions &options, const std::filesystem::path &root_folder)
+{
+    auto result = ScenarioResult();
+    auto &phases = result.m_phases;
+    for(size_t run = 0; run < options.m_warmup + options.m_repetitions; ++run)
+    {
+        auto times = std::vector<double>();
+        {
+            auto silence = SilenceConsole();
+
+            auto heap_before = HeapInUse();
+            auto meter = Meter<std::milli>();
+            auto mapper = ProjectMapper(root_folder.string(), options.m_jobs);
+            times.emplace_back(meter.ElapsedTime());
+            auto heap_after = HeapInUse();
+            result.m_MapHeap = (heap_after > heap_before ? heap_after - heap_before : 0);
+
+            meter = Meter<std::milli>();
+            auto order = GraphValidator::SortTopologically(mapper.GetGraph());
+            times.emplace_back(meter.ElapsedTime());
+            if(order.size() != mapper.GetGraph().NodeCount())
+            {
+                throw(std::runtime_error("Incomplete topological order"));
+            }
+
+            auto converter = ProjectConverter(options.m_jobs);
+            converter.SetSimulatedDuration(std::chrono::milliseconds(0));
+            meter = Meter<std::milli>();
+            converter.Convert(mapper);
+            times.emplace_back(meter.ElapsedTime());
+
+            auto builder = ProjectBuilder(options.m_jobs);
+            builder.SetSimulatedDuration(std::chrono::milliseconds(0));
+            meter = Meter<std::milli>();
+            auto succeeded = builder.Build(mapper);
+            times.emplace_back(meter.ElapsedTime());
+            if(!succeeded)
+            {
+                throw(std::runtime_error("Build failed"));
+            }
+        }
+
+        if(run >= options.m_warmup)
+        {
+            for(size_t i = 0; i < phases.size(); ++i)
+            {
+                phases[i].m_samples.emplace_back(times[i]);
+            }
+        }
+    }
+    return (result);
+}
+
+std::vector<std::string> Split(const std::string &value)
+{
+    auto items = std::vector<std::string>();
+    auto s = std::istringstream(value);
+    auto item = std::string();
+    while(std::getline(s, item, ','))
+    {
+        items.emplace_back(item);
+    }
+    return (items);
+}
+
+void PrintUsage()
+{
+    std::cout << "Usage: pipeline_benchmark [options]" << std::endl
+              << "  --shapes LIST         comma-separated: wide,deep,diamond,random (default: all)" << std::endl
+              << "  --sizes LIST          comma-separated project counts (default: 1000,10000)" << std::endl
+              << "  --warmup N            untimed runs per scenario (default: 1)" << std::endl
+              << "  --repetitions N       timed runs per scenario (default: 5)" << std::endl
+              << "  --jobs N              threads for every phase (default: hardware threads)" << std::endl
+              << "  --scratch FOLDER      where the trees are generated (default: temp folder)" << std::endl
+              << "  --json FILE           also write the results as json" << std::endl
+              << "  --keep                don't delete the generated trees" << std::endl;
+}
+
+std::optional<BenchmarkOptions> ParseArguments(int argc, char *argv[])
+{
+    auto options = BenchmarkOptions();
+    for(int i = 1; i < argc; ++i)
+    {
+        auto arg = std::string(argv[i]);
+        auto has_value = (i + 1 < argc);
+        if(arg == "--shapes" && has_value)
+        {
+            options.m_shapes = Split(argv[++i]);
+        }
+        else if(arg == "--sizes" && has_value)
+        {
+            options.m_sizes.clear();
+            for(auto &size : Split(argv[++i]))
+            {
+                options.m_sizes.emplace_back(std::max<size_t>(std::stoul(size), 1));
+            }
+        }
+        else if(arg == "--warmup" && has_value)
+        {
+            options.m_warmup = std::stoul(argv[++i]);
+        }
+        else if(arg == "--repetitions" && has_value)
+        {
+            options.m_repetitions = std::max<size_t>(std::stoul(argv[++i]), 1);
+        }
+        else if(arg == "--jobs" && has_value)
+        {
+            options.m_jobs = std::max<size_t>(std::stoul(argv[++i]), 1);
+        }
+        else if(arg == "--scratch" && has_value)
+        {
+            options.m_ScratchFolder = argv[++i];
+        }
+        else if(arg == "--json" && has_value)
+        {
+            options.m_JsonFile = argv[++i];
+        }
+        else if(arg == "--keep")
+        {
+            options.m_keep = true;
+        }
+        else
+        {
+            return (std::nullopt);
+        }
+    }
+    return (options);
+}
+
+int main(int argc, char *argv[])
+{
+    auto options = ParseArguments(argc, argv);
+    if(!options)
+    {
+        PrintUsage();
+        return (-1);
+    }
+
+    auto results_json = nlohmann::ordered_json();
+    results_json["Jobs"] = options->m_jobs;
+    results_json["Warmup"] = options->m_warmup;
+    results_json["Repetitions"] = options->m_repetitions;
+    results_json["Scenarios"] = nlohmann::ordered_json::array();
+
+    std::cout << std::left << std::setw(10) << "shape" << std::setw(10) << "projects"
+              << std::setw(10) << "phase" << std::right << std::setw(12) << "p50 ms"
+              << std::setw(12) << "p90 ms" << std::setw(12) << "max ms" << std::endl;
+
+    try
+    {
+        for(auto &shape : options->m_shapes)
+        {
+            for(auto size : options->m_sizes)
+            {
+                auto root_folder = std::filesystem::path(options->m_ScratchFolder) / (shape + "_" + std::to_string(size));
+                GenerateTree(root_folder, shape, size);
+                auto result = RunScenario(*options, root_folder);
+                if(!options->m_keep)
+                {
+                    std::filesystem::remove_all(root_folder);
+                }
+
+                auto scenario_json = nlohmann::ordered_json();
+                scenario_json["Shape"] = shape;
+                scenario_json["Projects"] = size;
+                scenario_json["Phases"] = nlohmann::ordered_json::array();
+                for(auto &phase : result.m_phases)
+                {
+                    std::cout << std::left << std::setw(10) << shape << std::setw(10) << size
+                              << std::setw(10) << phase.m_name << std::right << std::fixed << std::setprecision(3)
+                              << std::setw(12) << phase.Percentile(50) << std::setw(12) << phase.Percentile(90)
+                              << std::setw(12) << phase.Percentile(100) << std::endl;
+                    scenario_json["Phases"].push_back(phase.ToJson());
+                }
+
+                auto heap_mb = static_cast<double>(result.m_MapHeap) / (1024.0 * 1024.0);
+                std::cout << std::left << std::setw(10) << shape << std::setw(10) << size
+                          << std::setw(10) << "heap" << std::right << std::fixed << std::setprecision(3)
+                          << std::setw(12) << heap_mb << " MB held by the map, "
+                          << result.m_MapHeap / size << " bytes per project" << std::endl;
+                scenario_json["Map Heap Bytes"] = result.m_MapHeap;
+                results_json["Scenarios"].push_back(scenario_json);
+            }
+        }
+    }
+    catch(const std::exception &e)
+    {
+        std::cout << "Benchmark failed: " << e.what() << std::endl;
+        return (-1);
+    }
+
+    auto peak_resident = PeakResidentSize();
+    std::cout << "Peak RSS: " << std::fixed << std::setprecision(1)
+              << static_cast<double>(peak_resident) / (1024.0 * 1024.0) << " MB" << std::endl;
+    results_json["Peak RSS Bytes"] = peak_resident;
+
+    if(options->m_JsonFile)
+    {
+        auto out_file = std::ofstream(*options->m_JsonFile, std::ios::out | std::ios::trunc);
+        out_file << results_json.dump(4);
+    }
+    return (0);
+}
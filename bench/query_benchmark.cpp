@@ -0,0 +1,156 @@
+//Times GraphQuery on a synthetic graph held in memory: building the index, then every kind of
+//query between random projects. Project i depends on up to four random projects after it, and
+//project 0 on everything nothing else depends on, as in the random shape of the pipeline benchmark.
+//Half of the somepath queries are between connected projects. Every somepath answer is checked
+//against the dependencies of its source: the path has to exist exactly when the target is one of
+//them, and be made of dependency edges. Exits with 1 otherwise.
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include "graph_query.h"
+#include "graph_validator.h"
+#include "project_graph.h"
+#include "ExecutionMeter.h"
+
+using namespace Hats::Tools;
+
+//The paths are interned in paths, which has to outlive the graph.
+ProjectGraph CreateRandomGraph(PathTable &paths, size_t size)
+{
+    auto generator = std::mt19937_64(size);
+    auto edges = std::vector<std::vector<NodeId>>(size);
+    auto referenced = std::vector<uint8_t>(size, 0);
+    for(size_t i = 1; i + 1 < size; ++i)
+    {
+        auto distribution = std::uniform_int_distribution<size_t>(i + 1, size - 1);
+        auto count = std::uniform_int_distribution<size_t>(0, 4)(generator);
+        for(size_t k = 0; k < count; ++k)
+        {
+            auto target = static_cast<NodeId>(distribution(generator));
+            if(std::find(edges[i].begin(), edges[i].end(), target) == edges[i].end())
+            {
+                edges[i].emplace_back(target);
+                referenced[target] = 1;
+            }
+        }
+    }
+    for(size_t i = 1; i < size; ++i)
+    {
+        if(!referenced[i])
+        {
+            edges[0].emplace_back(static_cast<NodeId>(i));
+        }
+    }
+
+    auto graph = ProjectGraph(paths);
+    for(size_t i = 0; i < size; ++i)
+    {
+        auto path = "/bench/g" + std::to_string(i / 1000) + "/p" + std::to_string(i) + "/p" + std::to_string(i) + ".proj";
+        graph.AddNode(paths.Intern(path), nullptr, edges[i]);
+    }
+    graph.Finalize();
+    graph.SetTopologicalOrder(GraphValidator::SortTopologically(graph));
+    return (graph);
+}
+
+//Microseconds of every run of one kind of query.
+struct QueryTimes
+{
+    std::string m_name;
+    std::vector<double> m_samples;
+    size_t m_results {0};
+
+    [[nodiscard]] double Percentile(double p) const
+    {
+        auto sorted = m_samples;
+        std::sort(sorted.begin(), sorted.end());
+        return (sorted[static_cast<size_t>(p / 100.0 * static_cast<double>(sorted.size() - 1) + 0.5)]);
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    auto size = (argc > 1 ? std::max<size_t>(std::stoul(argv[1]), 2) : size_t {100000});
+    auto queries = (argc > 2 ? std::max<size_t>(std::stoul(argv[2]), 1) : size_t {1000});
+
+    auto paths = PathTable();
+    auto graph = CreateRandomGraph(paths, size);
+    auto meter = Meter<std::milli>();
+    auto graph_query = GraphQuery(graph);
+    auto index_time = meter.ElapsedTime();
+    meter = Meter<std::milli>();
+    graph_query.IndexFolders();
+    std::cout << graph.NodeCount() << " projects, " << graph.EdgeCount() << " dependencies, index built in "
+              << std::fixed << std::setprecision(1) << index_time << " ms, folders indexed in "
+              << meter.ElapsedTime() << " ms" << std::endl;
+
+    auto generator = std::mt19937_64(42);
+    auto any_node = std::uniform_int_distribution<NodeId>(0, static_cast<NodeId>(size - 1));
+    auto deps = QueryTimes {"deps", {}, 0};
+    auto rdeps = QueryTimes {"rdeps", {}, 0};
+    auto somepath = QueryTimes {"somepath", {}, 0};     //the results are the paths found
+    auto affected_by = QueryTimes {"affected-by 10", {}, 0};
+    auto errors = size_t {0};
+    for(size_t q = 0; q < queries; ++q)
+    {
+        auto from = any_node(generator);
+        auto to = any_node(generator);
+
+        auto query_meter = Meter<std::micro>();
+        auto dependencies = graph_query.Deps({from});
+        deps.m_samples.emplace_back(query_meter.ElapsedTime());
+        deps.m_results += dependencies.Count();
+
+        query_meter = Meter<std::micro>();
+        rdeps.m_results += graph_query.Rdeps({to}).Count();
+        rdeps.m_samples.emplace_back(query_meter.ElapsedTime());
+
+        //Half of the pairs are connected.
+        if(q % 2 == 0)
+        {
+            auto reachable = dependencies.Nodes();
+            to = reachable[std::uniform_int_distribution<size_t>(0, reachable.size() - 1)(generator)];
+        }
+        query_meter = Meter<std::micro>();
+        auto path = graph_query.SomePath(from, to);
+        somepath.m_samples.emplace_back(query_meter.ElapsedTime());
+        somepath.m_results += !path.empty();
+
+        errors += (path.empty() == dependencies.Contains(to));
+        for(size_t i = 0; i + 1 < path.size(); ++i)
+        {
+            auto edges = graph.Dependencies(path[i]);
+            errors += (std::find(edges.begin(), edges.end(), path[i + 1]) == edges.end());
+        }
+
+        auto changed_files = std::vector<std::string>();
+        auto unowned = std::vector<std::string>();
+        for(size_t i = 0; i < 10; ++i)
+        {
+            auto project_path = std::filesystem::path(graph.Path(any_node(generator)));
+            changed_files.emplace_back((project_path.parent_path() / "src" / "main.cpp").string());
+        }
+        query_meter = Meter<std::micro>();
+        affected_by.m_results += graph_query.AffectedBy(changed_files, unowned).Count();
+        affected_by.m_samples.emplace_back(query_meter.ElapsedTime());
+        errors += unowned.size();
+    }
+
+    std::cout << std::left << std::setw(16) << "query" << std::right << std::setw(12) << "p50 us"
+              << std::setw(12) << "p90 us" << std::setw(12) << "max us" << std::setw(16) << "mean results" << std::endl;
+    for(auto *times : {&deps, &rdeps, &somepath, &affected_by})
+    {
+        std::cout << std::left << std::setw(16) << times->m_name << std::right << std::setprecision(1)
+                  << std::setw(12) << times->Percentile(50) << std::setw(12) << times->Percentile(90)
+                  << std::setw(12) << times->Percentile(100) << std::setw(16)
+                  << static_cast<double>(times->m_results) / static_cast<double>(queries) << std::endl;
+    }
+
+    if(errors > 0)
+    {
+        std::cout << errors << " wrong answer(s)" << std::endl;
+        return (1);
+    }
+    return (0);
+}
@@ -0,0 +1,351 @@
+//Builds a synthetic tree on build workers that run as separate processes on localhost, standing in
+//for remote hosts, and checks what a coordinator is supposed to guarantee:
+//
+//  scaling   the makespan with 1, 2, 4... workers, against the ideal one
+//  lost      a worker is killed in the middle of the build; its projects must be rescheduled
+//  stalled   a worker is stopped (SIGSTOP), so it stops sending heartbeats without closing its
+//            connection; it must be dropped and its projects rescheduled
+//
+//Every project sleeps for --duration and writes an output file, which must come back to the
+//coordinator. The root depends on every project. A coordinator with the wrong worker token must be
+//turned away. Exits with 1 if any check fails.
+#include <csignal>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include "json.hpp"
+#include "builder.h"
+#include "converter.h"
+#include "mapper.h"
+#include "ExecutionMeter.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace Hats::Tools;
+
+static const std::string BenchmarkToken {"remote-benchmark-token"};
+
+struct BenchmarkOptions
+{
+    size_t m_projects {16};
+    std::chrono::milliseconds m_duration {250};
+    std::vector<size_t> m_workers {1, 2, 4};
+    size_t m_slots {1};             //per worker
+    std::string m_ScratchFolder {std::filesystem::temp_directory_path() / "project_builder_remote_bench"};
+    bool m_keep {false};
+};
+
+struct WorkerProcess
+{
+    pid_t m_pid {-1};
+    std::string m_endpoint;
+};
+
+struct BuildOutcome
+{
+    bool m_succeeded {false};
+    double m_makespan {0.0};
+    size_t m_rescheduled {0};
+    size_t m_missing {0};   //projects whose output didn't make it back
+};
+
+//Redirects std::cout to nowhere for as long as it lives.
+class SilenceConsole
+{
+private:
+    class NullBuffer : public std::streambuf
+    {
+    protected:
+        int overflow(int c) override {return (traits_type::not_eof(c));}
+    };
+
+    NullBuffer m_sink;
+    std::streambuf *m_original;
+
+public:
+    SilenceConsole() : m_original(std::cout.rdbuf(&m_sink))
+    {
+
+    }
+
+    ~SilenceConsole()
+    {
+        std::cout.rdbuf(m_original);
+    }
+};
+
+void GenerateTree(const std::filesystem::path &root_folder, const BenchmarkOptions &options)
+{
+    std::filesystem::remove_all(root_folder);
+    auto seconds = std::to_string(static_cast<double>(options.m_duration.count()) / 1000.0);
+    auto references = nlohmann::json::array();
+    for(size_t i = 0; i < options.m_projects; ++i)
+    {
+        auto name = "p" + std::to_string(i);
+        std::filesystem::create_directories(root_folder / name);
+        auto project_json = nlohmann::json();
+        project_json["Build Command"] = "sleep " + seconds + " && echo " + name + " > \"$OUTPUT_DIR/" + name + ".txt\"";
+        auto out_file = std::ofstream(root_folder / name / (name + ".proj"));
+        out_file << project_json.dump(4);
+        references.push_back({{"Relative Path", name + "/" + name + ".proj"}});
+    }
+
+    auto root_json = nlohmann::json();
+    root_json["References"] = references;
+    auto out_file = std::ofstream(root_folder / "root.proj");
+    out_file << root_json.dump(4);
+}
+
+//Forks the workers. Must be called while this process has no other thread.
+std::vector<WorkerProcess> StartWorkers(size_t count, const BenchmarkOptions &options)
+{
+    auto workers = std::vector<WorkerProcess>();
+    for(size_t i = 0; i < count; ++i)
+    {
+        auto scratch_folder = std::filesystem::path(options.m_ScratchFolder) / ("worker_" + std::to_string(i));
+        auto worker = BuildWorker(0, options.m_slots, scratch_folder, BenchmarkToken);
+        auto pid = ::fork();
+        if(pid == 0)
+        {
+            std::cout.rdbuf(nullptr);
+            worker.Run();
+            ::_exit(0);
+        }
+        workers.emplace_back(WorkerProcess {pid, "127.0.0.1:" + std::to_string(worker.GetPort())});
+    }
+    return (workers);
+}
+
+void StopWorkers(const std::vector<WorkerProcess> &workers)
+{
+    for(auto &worker : workers)
+    {
+        ::kill(worker.m_pid, SIGKILL);
+        ::waitpid(worker.m_pid, nullptr, 0);
+    }
+}
+
+//Builds the tree on the workers. If given, the fault is sent to the first worker a third into the
+//build.
+BuildOutcome Build(const std::filesystem::path &root_folder,
+                   const std::vector<WorkerProcess> &workers,
+                   const BenchmarkOptions &options,
+                   std::optional<int> fault = std::nullopt)
+{
+    auto build_folder = std::filesystem::path(options.m_ScratchFolder) / "build";
+    std::filesystem::remove_all(build_folder);
+    std::filesystem::create_directories(build_folder);
+
+    auto endpoints = std::vector<std::string>();
+    for(auto &worker : workers)
+    {
+        endpoints.emplace_back(worker.m_endpoint);
+    }
+
+    auto outcome = BuildOutcome();
+    {
+        auto silence = SilenceConsole();
+        auto mapper = ProjectMapper(root_folder.string());
+        auto remote_executor = std::make_shared<RemoteExecutor>(endpoints, BenchmarkToken, std::chrono::milliseconds(1000));
+        auto builder = ProjectBuilder(remote_executor->GetSlots(), build_folder.string(), nullptr);
+        builder.SetRemoteExecutor(remote_executor);
+        builder.SetResourceBudget(ResourceBudget {static_cast<uint32_t>(remote_executor->GetSlots()), 0});
+        builder.SetSimulatedDuration(std::chrono::milliseconds(0));
+
+        auto injector = std::thread();
+        if(fault)
+        {
+            auto total = options.m_duration * options.m_projects / remote_executor->GetSlots();
+            injector = std::thread([fault, total, pid = workers.front().m_pid]()
+            {
+                std::this_thread::sleep_for(total / 3);
+                ::kill(pid, *fault);
+            });
+        }
+
+        auto converter = ProjectConverter(remote_executor->GetSlots());
+        converter.SetSimulatedDuration(std::chrono::milliseconds(0));
+        converter.Convert(mapper);
+
+        auto meter = Meter<std::ratio<1, 1>>();
+        outcome.m_succeeded = builder.Build(mapper);
+        outcome.m_makespan = meter.ElapsedTime();
+        outcome.m_rescheduled = remote_executor->GetRescheduledCount();
+        if(injector.joinable())
+        {
+            injector.join();
+        }
+    }
+
+    auto outputs = std::filesystem::path(build_folder) / "outputs";
+    for(size_t i = 0; i < options.m_projects; ++i)
+    {
+        auto name = "p" + std::to_string(i);
+        auto found = false;
+        for(auto &entry : std::filesystem::directory_iterator(outputs))
+        {
+            found |= std::filesystem::exists(entry.path() / (name + ".txt"));
+        }
+        outcome.m_missing += (found ? 0 : 1);
+    }
+    return (outcome);
+}
+
+std::vector<std::string> Split(const std::string &value)
+{
+    auto items = std::vector<std::string>();
+    auto s = std::istringstream(value);
+    auto item = std::string();
+    while(std::getline(s, item, ','))
+    {
+        items.emplace_back(item);
+    }
+    return (items);
+}
+
+void PrintUsage()
+{
+    std::cout << "Usage: remote_benchmark [options]" << std::endl
+              << "  --projects N          independent projects to build (default: 16)" << std::endl
+              << "  --duration MS         how long every project takes to build (default: 250)" << std::endl
+              << "  --workers LIST        comma-separated worker counts to scale over (default: 1,2,4)" << std::endl
+              << "  --slots N             slots of every worker (default: 1)" << std::endl
+              << "  --scratch FOLDER      where the tree and the outputs go (default: temp folder)" << std::endl
+              << "  --keep                don't delete the scratch folder" << std::endl;
+}
+
+std::optional<BenchmarkOptions> ParseArguments(int argc, char *argv[])
+{
+    auto options = BenchmarkOptions();
+    for(int i = 1; i < argc; ++i)
+    {
+        auto arg = std::string(argv[i]);
+        auto has_value = (i + 1 < argc);
+        if(arg == "--projects" && has_value)
+        {
+            options.m_projects = std::max<size_t>(std::stoul(argv[++i]), 1);
+        }
+        else if(arg == "--duration" && has_value)
+        {
+            options.m_duration = std::chrono::milliseconds(std::stoul(argv[++i]));
+        }
+        else if(arg == "--workers" && has_value)
+        {
+            options.m_workers.clear();
+            for(auto &count : Split(argv[++i]))
+            {
+                options.m_workers.emplace_back(std::max<size_t>(std::stoul(count), 1));
+            }
+        }
+        else if(arg == "--slots" && has_value)
+        {
+            options.m_slots = std::max<size_t>(std::stoul(argv[++i]), 1);
+        }
+        else if(arg == "--scratch" && has_value)
+        {
+            options.m_ScratchFolder = argv[++i];
+        }
+        else if(arg == "--keep")
+        {
+            options.m_keep = true;
+        }
+        else
+        {
+            return (std::nullopt);
+        }
+    }
+    return (options);
+}
+
+int main(int argc, char *argv[])
+{
+    auto options = ParseArguments(argc, argv);
+    if(!options)
+    {
+        PrintUsage();
+        return (-1);
+    }
+
+    auto root_folder = std::filesystem::path(options->m_ScratchFolder) / "tree";
+    GenerateTree(root_folder, *options);
+    auto passed = true;
+    auto check = [&passed](bool condition, const std::string &what)
+    {
+        if(!condition)
+        {
+            std::cout << "FAILED: " << what << std::endl;
+            passed = false;
+        }
+    };
+
+    try
+    {
+        std::cout << std::left << std::setw(10) << "scenario" << std::setw(10) << "workers"
+                  << std::right << std::setw(12) << "makespan s" << std::setw(12) << "ideal s"
+                  << std::setw(10) << "speedup" << std::setw(13) << "rescheduled" << std::endl;
+
+        auto baseline = std::optional<double>();
+        for(auto count : options->m_workers)
+        {
+            auto workers = StartWorkers(count, *options);
+            auto outcome = Build(root_folder, workers, *options);
+            StopWorkers(workers);
+
+            auto slots = count * options->m_slots;
+            auto waves = (options->m_projects + slots - 1) / slots;
+            auto ideal = static_cast<double>(waves * options->m_duration.count()) / 1000.0;
+            baseline = baseline.value_or(outcome.m_makespan * static_cast<double>(count));
+            std::cout << std::left << std::setw(10) << "scaling" << std::setw(10) << count << std::right
+                      << std::fixed << std::setprecision(3) << std::setw(12) << outcome.m_makespan
+                      << std::setw(12) << ideal << std::setw(10) << *baseline / outcome.m_makespan
+                      << std::setw(13) << outcome.m_rescheduled << std::endl;
+
+            check(outcome.m_succeeded && outcome.m_missing == 0, "every output came back with " + std::to_string(count) + " worker(s)");
+            check(outcome.m_makespan < ideal * 1.5 + 0.5, "makespan with " + std::to_string(count) + " worker(s) is close to the ideal");
+        }
+
+        for(auto [scenario, fault] : {std::pair<std::string, int> {"lost", SIGKILL}, {"stalled", SIGSTOP}})
+        {
+            auto count = std::max<size_t>(options->m_workers.back(), 2);
+            auto workers = StartWorkers(count, *options);
+            auto outcome = Build(root_folder, workers, *options, fault);
+            StopWorkers(workers);
+
+            std::cout << std::left << std::setw(10) << scenario << std::setw(10) << count << std::right
+                      << std::fixed << std::setprecision(3) << std::setw(12) << outcome.m_makespan
+                      << std::setw(12) << "-" << std::setw(10) << "-"
+                      << std::setw(13) << outcome.m_rescheduled << std::endl;
+
+            check(outcome.m_succeeded && outcome.m_missing == 0, "every output came back with a " + scenario + " worker");
+            check(outcome.m_rescheduled > 0, "the projects of the " + scenario + " worker were rescheduled");
+        }
+
+        auto workers = StartWorkers(1, *options);
+        auto rejected = false;
+        try
+        {
+            auto silence = SilenceConsole();
+            RemoteExecutor({workers.front().m_endpoint}, "wrong-token");
+        }
+        catch(const std::exception &)
+        {
+            rejected = true;
+        }
+        StopWorkers(workers);
+        check(rejected, "a coordinator with the wrong token is rejected");
+    }
+    catch(const std::exception &e)
+    {
+        std::cout << "Benchmark failed: " << e.what() << std::endl;
+        passed = false;
+    }
+
+    if(!options->m_keep)
+    {
+        std::filesystem::remove_all(options->m_ScratchFolder);
+    }
+    std::cout << (passed ? "All checks passed" : "Some checks failed") << std::endl;
+    return (passed ? 0 : 1);
+}
@@ -0,0 +1,157 @@
+//Times ShardPlanner on a synthetic graph held in memory, shaped like a monorepo: projects come in
+//solutions of 200, and each one depends on up to four random projects after it, nine times out of
+//ten in its own solution. Build times are random, from a few seconds to a few minutes. For every
+//number of shards, the plan is compared with splitting the projects round robin by id, the usual
+//way of sharding a CI run, and with cutting the id order into pieces of equal weight. Every plan is
+//checked: computed twice, it has to come out the same, no shard may weigh more than MaxImbalance
+//above the average plus the heaviest project, and no project may depend on a project of a later
+//shard or of a shard in the same stage. Exits with 1 otherwise.
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include "graph_validator.h"
+#include "project_graph.h"
+#include "shard_planner.h"
+#include "ExecutionMeter.h"
+
+using namespace Hats::Tools;
+
+static constexpr size_t SolutionSize {200};
+
+//The paths are interned in paths, which has to outlive the graph.
+ProjectGraph CreateMonorepoGraph(PathTable &paths, size_t size)
+{
+    auto generator = std::mt19937_64(size);
+    auto edges = std::vector<std::vector<NodeId>>(size);
+    for(size_t i = 0; i + 1 < size; ++i)
+    {
+        auto solution_end = std::min(size, (i / SolutionSize + 1) * SolutionSize);
+        auto count = std::uniform_int_distribution<size_t>(0, 4)(generator);
+        for(size_t k = 0; k < count; ++k)
+        {
+            auto local = (std::uniform_int_distribution<int>(0, 9)(generator) != 0 && i + 1 < solution_end);
+            auto last = (local ? solution_end - 1 : size - 1);
+            auto target = static_cast<NodeId>(std::uniform_int_distribution<size_t>(i + 1, last)(generator));
+            if(std::find(edges[i].begin(), edges[i].end(), target) == edges[i].end())
+            {
+                edges[i].emplace_back(target);
+            }
+        }
+    }
+
+    auto graph = ProjectGraph(paths);
+    for(size_t i = 0; i < size; ++i)
+    {
+        auto path = "/bench/s" + std::to_string(i / SolutionSize) + "/p" + std::to_string(i) + "/p" + std::to_string(i) + ".proj";
+        graph.AddNode(paths.Intern(path), nullptr, edges[i]);
+    }
+    graph.Finalize();
+    graph.SetTopologicalOrder(GraphValidator::SortTopologically(graph));
+    return (graph);
+}
+
+//Cut edges and the heaviest shard of an assignment of the projects to shards.
+struct Split
+{
+    size_t m_cut {0};
+    double m_heaviest {0.0};
+};
+
+template<typename ShardOf>
+Split Measure(const ProjectGraph &graph, const std::vector<double> &weights, uint32_t count, ShardOf shard_of)
+{
+    auto split = Split();
+    auto shard_weights = std::vector<double>(count, 0.0);
+    for(NodeId node = 0; node < graph.NodeCount(); ++node)
+    {
+        shard_weights[shard_of(node)] += weights[node];
+        for(auto child_node : graph.Dependencies(node))
+        {
+            split.m_cut += (shard_of(child_node) != shard_of(node));
+        }
+    }
+    split.m_heaviest = *std::max_element(shard_weights.begin(), shard_weights.end());
+    return (split);
+}
+
+int main(int argc, char *argv[])
+{
+    auto size = (argc > 1 ? std::max<size_t>(std::stoul(argv[1]), 2) : size_t {20000});
+
+    auto paths = PathTable();
+    auto graph = CreateMonorepoGraph(paths, size);
+    auto generator = std::mt19937_64(42);
+    auto duration = std::lognormal_distribution<double>(3.0, 1.0);     //a median of 20 seconds
+    auto weights = std::vector<double>(size);
+    auto total_weight = 0.0;
+    for(auto &weight : weights)
+    {
+        weight = duration(generator);
+        total_weight += weight;
+    }
+    auto heaviest_project = *std::max_element(weights.begin(), weights.end());
+    std::cout << graph.NodeCount() << " projects, " << graph.EdgeCount() << " dependencies, "
+              << std::fixed << std::setprecision(0) << total_weight << " seconds of build time" << std::endl;
+
+    std::cout << std::left << std::setw(8) << "shards" << std::right << std::setw(12) << "plan ms"
+              << std::setw(10) << "moves" << std::setw(12) << "cut" << std::setw(12) << "imbalance" << std::setw(8) << "stages"
+              << std::setw(16) << "by weight cut" << std::setw(16) << "round robin cut" << std::endl;
+    auto errors = size_t {0};
+    for(uint32_t count : {2, 4, 8, 16, 32})
+    {
+        auto meter = Meter<std::milli>();
+        auto planner = ShardPlanner(graph, weights, count);
+        auto plan_time = meter.ElapsedTime();
+        auto again = ShardPlanner(graph, weights, count);
+
+        auto planned = Measure(graph, weights, count, [&planner](NodeId node) {return (planner.ShardOf(node));});
+        auto by_weight = std::vector<uint32_t>(size);
+        auto before = 0.0;
+        for(NodeId node = 0; node < size; ++node)
+        {
+            by_weight[node] = std::min(count - 1, static_cast<uint32_t>((before + weights[node] / 2.0) / total_weight * count));
+            before += weights[node];
+        }
+        auto contiguous = Measure(graph, weights, count, [&by_weight](NodeId node) {return (by_weight[node]);});
+        auto round_robin = Measure(graph, weights, count, [count](NodeId node) {return (node % count);});
+
+        auto average = total_weight / count;
+        std::cout << std::left << std::setw(8) << count << std::right << std::setprecision(1)
+                  << std::setw(12) << plan_time << std::setw(10) << planner.GetMoves() << std::setw(12) << planned.m_cut
+                  << std::setw(11) << (planned.m_heaviest / average - 1.0) * 100.0 << "%" << std::setw(8) << planner.StageCount()
+                  << std::setw(16) << contiguous.m_cut << std::setw(16) << round_robin.m_cut << std::endl;
+
+        if(again.GetHash() != planner.GetHash())
+        {
+            std::cout << "The plan for " << count << " shards isn't reproducible" << std::endl;
+            ++errors;
+        }
+        if(planned.m_heaviest > average * 1.05 + heaviest_project)
+        {
+            std::cout << "The plan for " << count << " shards is unbalanced" << std::endl;
+            ++errors;
+        }
+        auto backward = size_t {0};
+        for(NodeId node = 0; node < graph.NodeCount(); ++node)
+        {
+            for(auto child_node : graph.Dependencies(node))
+            {
+                auto shard = planner.ShardOf(node);
+                auto child_shard = planner.ShardOf(child_node);
+                backward += (child_shard > shard || (child_shard != shard && planner.Stage(child_shard) >= planner.Stage(shard)));
+            }
+        }
+        if(backward > 0)
+        {
+            std::cout << "The plan for " << count << " shards has " << backward << " dependencies on later shards or stages" << std::endl;
+            ++errors;
+        }
+    }
+
+    if(errors > 0)
+    {
+        return (1);
+    }
+    return (0);
+}
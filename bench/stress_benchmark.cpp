@@ -0,0 +1,361 @@
+//Hammers the state machine that the builder schedules from (node_state.h), and then the
+//builder itself, with many threads and random DAGs, and checks that the outcome is always right:
+//
+//  states    NodeStateTable alone, round after round: every ready project is started by two
+//            racing tasks, some projects fail, and what depends on them must be skipped
+//  build     converter and builder with --keep-going on a tree written to a scratch folder, some
+//            of whose projects fail
+//  stream    the same tree, mapped, converted and built overlapped by a StreamingPipeline
+//
+//Meant to be built with -DSANITIZE_THREAD=ON as well, where ThreadSanitizer reports any data race.
+//Exits with 1 if any check fails.
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include "json.hpp"
+#include "builder.h"
+#include "converter.h"
+#include "mapper.h"
+#include "node_state.h"
+#include "streaming.h"
+#include "thread_pool.h"
+#include "ExecutionMeter.h"
+
+using namespace Hats::Tools;
+
+struct BenchmarkOptions
+{
+    size_t m_nodes {2000};
+    size_t m_rounds {50};
+    size_t m_jobs {8};
+    std::string m_ScratchFolder {std::filesystem::temp_directory_path() / "project_builder_stress_bench"};
+    bool m_keep {false};
+};
+
+//Node i depends on up to four random nodes after it, so the graph is acyclic; node 0 depends on
+//everything nothing else does. About one node in fifty fails.
+struct RandomDag
+{
+    std::vector<std::vector<NodeId>> m_dependencies;
+    std::vector<std::vector<NodeId>> m_dependents;
+    std::vector<uint8_t> m_fails;
+
+    RandomDag(size_t size, uint64_t seed) : m_dependencies(size), m_dependents(size), m_fails(size, 0)
+    {
+        auto generator = std::mt19937_64(seed);
+        auto referenced = std::vector<uint8_t>(size, 0);
+        for(size_t i = 1; i + 1 < size; ++i)
+        {
+            auto distribution = std::uniform_int_distribution<size_t>(i + 1, size - 1);
+            auto count = std::uniform_int_distribution<size_t>(0, 4)(generator);
+            for(size_t k = 0; k < count; ++k)
+            {
+                auto target = static_cast<NodeId>(distribution(generator));
+                if(std::find(m_dependencies[i].begin(), m_dependencies[i].end(), target) == m_dependencies[i].end())
+                {
+                    m_dependencies[i].emplace_back(target);
+                    referenced[target] = 1;
+                }
+            }
+            m_fails[i] = (std::uniform_int_distribution<int>(0, 49)(generator) == 0);
+        }
+        for(size_t i = 1; i < size; ++i)
+        {
+            if(!referenced[i])
+            {
+                m_dependencies[0].emplace_back(static_cast<NodeId>(i));
+            }
+        }
+        for(size_t i = 0; i < size; ++i)
+        {
+            for(auto target : m_dependencies[i])
+            {
+                m_dependents[target].emplace_back(static_cast<NodeId>(i));
+            }
+        }
+    }
+
+    //Whether the node depends, directly or not, on a node that fails. Dependencies have higher ids.
+    [[nodiscard]] std::vector<uint8_t> Blocked() const
+    {
+        auto blocked = std::vector<uint8_t>(m_dependencies.size(), 0);
+        for(auto i = m_dependencies.size(); i-- > 0;)
+        {
+            for(auto target : m_dependencies[i])
+            {
+                blocked[i] |= (blocked[target] | m_fails[target]);
+            }
+        }
+        return (blocked);
+    }
+};
+
+//Redirects std::cout to nowhere for as long as it lives.
+class SilenceConsole
+{
+private:
+    class NullBuffer : public std::streambuf
+    {
+    protected:
+        int overflow(int c) override {return (traits_type::not_eof(c));}
+    };
+
+    NullBuffer m_sink;
+    std::streambuf *m_original;
+
+public:
+    SilenceConsole() : m_original(std::cout.rdbuf(&m_sink))
+    {
+
+    }
+
+    ~SilenceConsole()
+    {
+        std::cout.rdbuf(m_original);
+    }
+};
+
+//One round of the states scenario. Returns the number of violations: a node started more than
+//once, before one of its dependencies was done, or in the wrong final state.
+size_t RunStates(const RandomDag &dag, size_t jobs)
+{
+    auto size = dag.m_dependencies.size();
+    auto nodes = NodeStateTable(size);
+    auto starts = std::vector<std::atomic<uint32_t>>(size);
+    auto violations = std::atomic<size_t>(0);
+    for(NodeId node = 0; node < size; ++node)
+    {
+        starts[node].store(0, std::memory_order_relaxed);
+        nodes.Reset(node, static_cast<uint32_t>(dag.m_dependencies[node].size()));
+    }
+
+    {
+        std::function<void(NodeId)> run;
+        auto pool = ThreadPool(jobs);
+        run = [&](NodeId node)
+        {
+            if(!nodes.Start(node))
+            {
+                return;     //the other task got it
+            }
+            starts[node].fetch_add(1, std::memory_order_relaxed);
+            for(auto target : dag.m_dependencies[node])
+            {
+                violations += (nodes.Get(target) != NodeState::Done);
+            }
+
+            nodes.Finish(node, !dag.m_fails[node]);
+            if(dag.m_fails[node])
+            {
+                return;
+            }
+            for(auto parent : dag.m_dependents[node])
+            {
+                if(nodes.DependencyDone(parent))
+                {
+                    pool.Submit([&run, parent]() {run(parent);});
+                    pool.Submit([&run, parent]() {run(parent);});
+                }
+            }
+        };
+
+        for(NodeId node = 0; node < size; ++node)
+        {
+            if(nodes.Get(node) == NodeState::Ready)
+            {
+                pool.Submit([&run, node]() {run(node);});
+                pool.Submit([&run, node]() {run(node);});
+            }
+        }
+        pool.Wait();
+    }
+
+    auto blocked = dag.Blocked();
+    for(NodeId node = 0; node < size; ++node)
+    {
+        nodes.Skip(node);
+        auto expected = (blocked[node] ? NodeState::Skipped : (dag.m_fails[node] ? NodeState::Failed : NodeState::Done));
+        violations += (nodes.Get(node) != expected);
+        violations += (starts[node].load() != (blocked[node] ? 0U : 1U));
+    }
+    return (violations);
+}
+
+std::string RelativePath(size_t project)
+{
+    return (project == 0 ? std::string("root.proj") : "p" + std::to_string(project) + "/p" + std::to_string(project) + ".proj");
+}
+
+//The failing projects run "exit 1"; the others have no command, so their build is simulated.
+void GenerateTree(const std::filesystem::path &root_folder, const RandomDag &dag)
+{
+    std::filesystem::remove_all(root_folder);
+    for(size_t i = 0; i < dag.m_dependencies.size(); ++i)
+    {
+        auto project_file = root_folder / RelativePath(i);
+        std::filesystem::create_directories(project_file.parent_path());
+
+        auto project_json = nlohmann::ordered_json();
+        if(dag.m_fails[i])
+        {
+            project_json["Build Command"] = "exit 1";
+        }
+        project_json["References"] = nlohmann::ordered_json::array();
+        for(auto target : dag.m_dependencies[i])
+        {
+            project_json["References"].push_back({{"Relative Path", RelativePath(target)}});
+        }
+
+        auto out_file = std::ofstream(project_file, std::ios::out | std::ios::trunc);
+        out_file << project_json.dump(4);
+    }
+}
+
+//One round of the build or the stream scenario. Returns the number of projects converted or built
+//wrongly.
+size_t RunBuild(const std::filesystem::path &root_folder, const RandomDag &dag, const BenchmarkOptions &options, bool streaming)
+{
+    auto build_folder = std::filesystem::path(options.m_ScratchFolder) / "build";
+    auto silence = SilenceConsole();
+    auto executor = std::make_shared<ProcessExecutor>(options.m_jobs);
+    auto converter = ProjectConverter(options.m_jobs, build_folder.string(), executor);
+    converter.SetSimulatedDuration(std::chrono::milliseconds(0));
+
+    auto pipeline = StreamingPipeline(converter);
+    auto mapper = ProjectMapper(std::vector<std::string> {root_folder.string()},
+                                options.m_jobs,
+                                streaming ? pipeline.Start() : ProjectMapper::ProjectListener());
+    if(!streaming)
+    {
+        converter.Convert(mapper);
+    }
+
+    auto builder = ProjectBuilder(options.m_jobs, build_folder.string(), nullptr, executor);
+    builder.SetSimulatedDuration(std::chrono::milliseconds(0));
+    builder.SetResourceBudget(ResourceBudget {static_cast<uint32_t>(options.m_jobs), 0});
+    builder.SetKeepGoing(true);
+    if(streaming)
+    {
+        pipeline.Build(mapper, builder);
+    }
+    else
+    {
+        builder.Build(mapper);
+    }
+    auto conversion_report = converter.GetLastReport();
+
+    auto errors = size_t {0};
+    errors += (conversion_report["Completed"]["Count"] != dag.m_dependencies.size());
+
+    auto blocked = dag.Blocked();
+    auto build_report = builder.GetLastReport();
+    auto statuses = std::map<std::string, std::string>();
+    for(auto &project_json : build_report["Projects"])
+    {
+        statuses[std::filesystem::weakly_canonical(project_json["Project"].get<std::string>()).string()] = project_json["Status"].get<std::string>();
+    }
+    for(size_t i = 0; i < dag.m_dependencies.size(); ++i)
+    {
+        auto expected = (blocked[i] ? "Skipped" : (dag.m_fails[i] ? "Failed" : "Built"));
+        errors += (statuses[std::filesystem::weakly_canonical(root_folder / RelativePath(i)).string()] != expected);
+    }
+    return (errors);
+}
+
+void PrintUsage()
+{
+    std::cout << "Usage: stress_benchmark [options]" << std::endl
+              << "  --nodes N             projects of every random DAG (default: 2000)" << std::endl
+              << "  --rounds N            rounds of the states scenario (default: 50)" << std::endl
+              << "  --jobs N              threads (default: 8)" << std::endl
+              << "  --scratch FOLDER      where the tree of the build scenario goes (default: temp folder)" << std::endl
+              << "  --keep                don't delete the scratch folder" << std::endl;
+}
+
+std::optional<BenchmarkOptions> ParseArguments(int argc, char *argv[])
+{
+    auto options = BenchmarkOptions();
+    for(int i = 1; i < argc; ++i)
+    {
+        auto arg = std::string(argv[i]);
+        auto has_value = (i + 1 < argc);
+        if(arg == "--nodes" && has_value)
+        {
+            options.m_nodes = std::max<size_t>(std::stoul(argv[++i]), 2);
+        }
+        else if(arg == "--rounds" && has_value)
+        {
+            options.m_rounds = std::max<size_t>(std::stoul(argv[++i]), 1);
+        }
+        else if(arg == "--jobs" && has_value)
+        {
+            options.m_jobs = std::max<size_t>(std::stoul(argv[++i]), 1);
+        }
+        else if(arg == "--scratch" && has_value)
+        {
+            options.m_ScratchFolder = argv[++i];
+        }
+        else if(arg == "--keep")
+        {
+            options.m_keep = true;
+        }
+        else
+        {
+            return (std::nullopt);
+        }
+    }
+    return (options);
+}
+
+int main(int argc, char *argv[])
+{
+    auto options = ParseArguments(argc, argv);
+    if(!options)
+    {
+        PrintUsage();
+        return (-1);
+    }
+
+    auto passed = true;
+    try
+    {
+        auto meter = Meter<std::ratio<1, 1000>>();
+        auto violations = size_t {0};
+        for(size_t round = 0; round < options->m_rounds; ++round)
+        {
+            violations += RunStates(RandomDag(options->m_nodes, round), options->m_jobs);
+        }
+        std::cout << "states: " << options->m_rounds << " round(s) of " << options->m_nodes << " projects on "
+                  << options->m_jobs << " threads in " << std::fixed << std::setprecision(1) << meter.ElapsedTime()
+                  << " ms, " << violations << " violation(s)" << std::endl;
+        passed &= (violations == 0);
+
+        meter = Meter<std::ratio<1, 1000>>();
+        auto dag = RandomDag(options->m_nodes, options->m_rounds);
+        auto root_folder = std::filesystem::path(options->m_ScratchFolder) / "tree";
+        GenerateTree(root_folder, dag);
+        auto errors = RunBuild(root_folder, dag, *options, false);
+        std::cout << "build: " << options->m_nodes << " projects on " << options->m_jobs << " threads in "
+                  << meter.ElapsedTime() << " ms, " << errors << " wrong outcome(s)" << std::endl;
+        passed &= (errors == 0);
+
+        meter = Meter<std::ratio<1, 1000>>();
+        errors = RunBuild(root_folder, dag, *options, true);
+        std::cout << "stream: " << options->m_nodes << " projects on " << options->m_jobs << " threads in "
+                  << meter.ElapsedTime() << " ms, " << errors << " wrong outcome(s)" << std::endl;
+        passed &= (errors == 0);
+    }
+    catch(const std::exception &e)
+    {
+        std::cout << "Benchmark failed: " << e.what() << std::endl;
+        passed = false;
+    }
+
+    if(!options->m_keep)
+    {
+        std::filesystem::remove_all(options->m_ScratchFolder);
+    }
+    std::cout << (passed ? "All checks passed" : "Some checks failed") << std::endl;
+    return (passed ? 0 : 1);
+}
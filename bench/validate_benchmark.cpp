@@ -0,0 +1,121 @@
+//Compares the linear GraphValidator with the stack-and-parent-map validator it replaced, on
+//synthetic "deep diamond" graphs: layers of two projects in which each project depends on both
+//projects of the next layer. The number of paths doubles with every layer, and so does the work of
+//any validator that walks paths instead of nodes.
+#include <iostream>
+#include <map>
+#include <set>
+#include <stack>
+#include <unordered_map>
+#include "graph_validator.h"
+#include "project_graph.h"
+#include "ExecutionMeter.h"
+
+using namespace Hats::Tools;
+
+//The paths are interned in paths, which has to outlive the graph.
+ProjectGraph CreateDeepDiamond(PathTable &paths, size_t depth)
+{
+    auto graph = ProjectGraph(paths);
+    auto dependencies = std::vector<NodeId>();
+    for(size_t layer = 0; layer < depth; ++layer)
+    {
+        dependencies.clear();
+        if(layer + 1 < depth)
+        {
+            dependencies = {static_cast<NodeId>(2 * layer + 2), static_cast<NodeId>(2 * layer + 3)};
+        }
+
+        for(size_t i = 0; i < 2; ++i)
+        {
+            auto path = "/bench/layer" + std::to_string(layer) + "/p" + std::to_string(i) + ".proj";
+            graph.AddNode(paths.Intern(path), nullptr, dependencies);
+        }
+    }
+    graph.Finalize();
+    return (graph);
+}
+
+//The validator ProjectMapper used before GraphValidator, kept here only for comparison.
+void LegacyValidate(const ProjectGraph &graph, NodeId root_node)
+{
+    auto s = std::stack<NodeId>();
+    s.push(root_node);
+    auto parent_map = std::map<std::string, std::set<std::string>>();
+
+    while(!s.empty())
+    {
+        auto project = s.top();
+        s.pop();
+        auto proj_it = parent_map.find(graph.Path(project));
+        if(proj_it != parent_map.end())
+        {
+            parent_map.erase(proj_it);
+        }
+
+        for(auto child_node : graph.Dependencies(project))
+        {
+            s.push(child_node);
+
+            auto proj_path = graph.Path(child_node);
+            if(parent_map.find(proj_path) == parent_map.end())
+            {
+                parent_map[proj_path] = std::set<std::string>();
+                parent_map[proj_path].emplace(graph.Path(project));
+            }
+            else
+            {
+                auto parents = parent_map[proj_path];
+                if(parents.find(graph.Path(project)) != parents.end())
+                {
+                    throw(std::runtime_error("circular reference"));
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    //The legacy validator takes seconds from about 20 layers on; it's skipped beyond max_legacy_depth.
+    auto max_legacy_depth = size_t {20};
+    if(argc > 1)
+    {
+        max_legacy_depth = static_cast<size_t>(std::atoi(argv[1]));
+    }
+
+    std::cout << "depth\tnodes\tlinear (ms)\tlegacy (ms)" << std::endl;
+    for(size_t depth = 4; depth <= 1 << 16; depth *= 2)
+    {
+        for(auto d : {depth, depth + depth / 2})
+        {
+            auto paths = PathTable();
+            auto graph = CreateDeepDiamond(paths, d);
+
+            auto meter = Meter<std::milli>();
+            auto order = GraphValidator::SortTopologically(graph);
+            auto linear_time = meter.ElapsedTime();
+
+            std::cout << d << "\t" << graph.NodeCount() << "\t" << linear_time << "\t";
+            if(d <= max_legacy_depth)
+            {
+                auto legacy_meter = Meter<std::milli>();
+                LegacyValidate(graph, 0);
+                std::cout << legacy_meter.ElapsedTime();
+            }
+            else
+            {
+                std::cout << "skipped";
+            }
+            std::cout << std::endl;
+
+            if(order.size() != graph.NodeCount())
+            {
+                std::cout << "Invalid topological order" << std::endl;
+                return (-1);
+            }
+        }
+    }
+
+    return (0);
+}
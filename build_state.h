@@ -0,0 +1,244 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <vector>
+#include "json.hpp"
+
+//64-bit FNV-1a. It isn't a cryptographic hash, but it is fast, has no dependencies and is more
+//than enough to tell whether a project file changed since the last build.
+class ContentHash
+{
+private:
+    static constexpr uint64_t OffsetBasis {14695981039346656037ULL};
+    static constexpr uint64_t Prime {1099511628211ULL};
+
+    uint64_t m_value {OffsetBasis};
+
+public:
+    ContentHash() = default;
+    ~ContentHash() = default;
+
+    void Update(const char *data, size_t size)
+    {
+        for(size_t i = 0; i < size; ++i)
+        {
+            m_value ^= static_cast<unsigned char>(data[i]);
+            m_value *= Prime;
+        }
+    }
+
+    void Update(const std::string &data)
+    {
+        //Include the terminator so that {"ab", "c"} and {"a", "bc"} hash differently
+        Update(data.c_str(), data.size() + 1);
+    }
+
+    [[nodiscard]] std::string ToString() const
+    {
+        auto os = std::ostringstream();
+        os << std::hex << std::setw(16) << std::setfill('0') << m_value;
+        return (os.str());
+    }
+
+    [[nodiscard]] uint64_t Value() const {return (m_value);}
+
+    static std::string HashFile(const std::filesystem::path &file_path)
+    {
+        auto hash = ContentHash();
+        auto s = std::ifstream(file_path, std::ios::in | std::ios::binary);
+        char buffer[64 * 1024];
+        while(s)
+        {
+            s.read(buffer, sizeof(buffer));
+            hash.Update(buffer, static_cast<size_t>(s.gcount()));
+        }
+        return (hash.ToString());
+    }
+
+    //Hash of every file below the folder, and of where it is, independent of the order in which the
+    //filesystem lists them. A missing folder hashes like an empty one.
+    static std::string HashFolder(const std::filesystem::path &folder)
+    {
+        auto files = std::vector<std::filesystem::path>();
+        auto error = std::error_code();
+        for(auto it = std::filesystem::recursive_directory_iterator(folder, error);
+            it != std::filesystem::recursive_directory_iterator(); it.increment(error))
+        {
+            if(error)
+            {
+                break;
+            }
+            if(it->is_regular_file(error) || it->is_symlink(error))
+            {
+                files.emplace_back(it->path());
+            }
+        }
+        std::sort(files.begin(), files.end());
+
+        auto hash = ContentHash();
+        for(auto &file : files)
+        {
+            hash.Update(std::filesystem::relative(file, folder).generic_string());
+            hash.Update(std::filesystem::is_symlink(file) ? std::filesystem::read_symlink(file).string()
+                                                          : HashFile(file));
+        }
+        return (hash.ToString());
+    }
+};
+
+//What the last successful build of a project was based on.
+struct ProjectBuildState
+{
+    std::string m_FileHash;                                 //hash of the project file
+    std::map<std::string, std::string> m_DependencyHashes;  //dependency path --> its signature
+    std::string m_BuildPath;                                //output path of the build
+    int64_t m_BuildTime {0};                                //seconds since epoch
+    double m_duration {0.0};                                //how long the build took, in seconds
+    std::string m_OutputHash;                               //hash of the build output, with an artifact cache
+};
+
+//Persistent record of the last successful build of every project, kept as json next to the build
+//output. A project is up to date when its file and the signatures of all of its dependencies are
+//the same as the ones recorded at its last build. Since a signature covers the whole subtree below
+//a project, changing one leaf invalidates exactly the projects that depend on it, directly or not.
+class BuildStateStore
+{
+private:
+    std::filesystem::path m_StateFile;
+    std::map<std::string, ProjectBuildState> m_projects;
+    std::mutex m_lock;
+
+public:
+    explicit BuildStateStore(const std::filesystem::path &state_file) : m_StateFile(state_file)
+    {
+        Load();
+    }
+
+    ~BuildStateStore() = default;
+
+    //A missing or unreadable file simply means that nothing is up to date.
+    void Load()
+    {
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        m_projects.clear();
+        if(!std::filesystem::exists(m_StateFile))
+        {
+            return;
+        }
+
+        auto s = std::ifstream(m_StateFile);
+        auto state_json = nlohmann::json::parse(s, nullptr, false);
+        if(state_json.is_discarded() || !state_json.contains("Projects"))
+        {
+            return;
+        }
+
+        for(auto &[proj_path, proj_json] : state_json["Projects"].items())
+        {
+            auto state = ProjectBuildState();
+            state.m_FileHash = proj_json.value("File Hash", "");
+            state.m_BuildPath = proj_json.value("Build Path", "");
+            state.m_BuildTime = proj_json.value("Build Time", int64_t {0});
+            state.m_duration = proj_json.value("Duration", 0.0);
+            state.m_OutputHash = proj_json.value("Output Hash", "");
+            if(proj_json.contains("Dependency Hashes"))
+            {
+                state.m_DependencyHashes = proj_json["Dependency Hashes"].get<std::map<std::string, std::string>>();
+            }
+            m_projects[proj_path] = state;
+        }
+    }
+
+    void Save()
+    {
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        auto state_json = nlohmann::ordered_json();
+        state_json["Projects"] = nlohmann::ordered_json::object();
+        for(auto &[proj_path, state] : m_projects)
+        {
+            auto &proj_json = state_json["Projects"][proj_path];
+            proj_json["File Hash"] = state.m_FileHash;
+            proj_json["Dependency Hashes"] = state.m_DependencyHashes;
+            proj_json["Build Path"] = state.m_BuildPath;
+            proj_json["Build Time"] = state.m_BuildTime;
+            proj_json["Duration"] = state.m_duration;
+            if(!state.m_OutputHash.empty())
+            {
+                proj_json["Output Hash"] = state.m_OutputHash;
+            }
+        }
+
+        //Write to a temporary file first so that an interrupted save never leaves a truncated state.
+        auto temp_file = m_StateFile;
+        temp_file += ".tmp";
+        {
+            auto out_file = std::ofstream(temp_file, std::ios::out | std::ios::trunc);
+            out_file << state_json.dump(4);
+        }
+        std::filesystem::rename(temp_file, m_StateFile);
+    }
+
+    //Makes every project out of date. Build durations are kept, the scheduler still needs them.
+    void Clear()
+    {
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        for(auto &[proj_path, state] : m_projects)
+        {
+            auto duration = state.m_duration;
+            state = ProjectBuildState();
+            state.m_duration = duration;
+        }
+    }
+
+    void Record(const std::string &project_path, const ProjectBuildState &state)
+    {
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        m_projects[project_path] = state;
+    }
+
+    std::optional<ProjectBuildState> Find(const std::string &project_path)
+    {
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        auto it = m_projects.find(project_path);
+        if(it == m_projects.end())
+        {
+            return (std::nullopt);
+        }
+        return (it->second);
+    }
+
+    //How long the last successful build of the project took, whether or not it's still up to date.
+    std::optional<double> FindDuration(const std::string &project_path)
+    {
+        auto state = Find(project_path);
+        if(!state || state->m_duration <= 0.0)
+        {
+            return (std::nullopt);
+        }
+        return (state->m_duration);
+    }
+
+    //Returns the recorded state if it matches what the project would be built from today and its
+    //output is still there.
+    std::optional<ProjectBuildState> FindUpToDate(const std::string &project_path,
+                                                  const ProjectBuildState &current)
+    {
+        auto state = Find(project_path);
+        if(!state ||
+           state->m_FileHash != current.m_FileHash ||
+           state->m_DependencyHashes != current.m_DependencyHashes ||
+           !std::filesystem::exists(state->m_BuildPath))
+        {
+            return (std::nullopt);
+        }
+        return (state);
+    }
+
+    [[nodiscard]] const std::filesystem::path &GetStateFile() const {return (m_StateFile);}
+};
@@ -1,4 +1,24 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include "artifact_cache.h"
+#include "common_types.h"
+#include "build_state.h"
+#include "log_writer.h"
+#include "mapper.h"
+#include "metrics.h"
+#include "node_state.h"
+#include "process_executor.h"
+#include "project_graph.h"
+#include "remote_build.h"
+#include "resource_budget.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include "ExecutionMeter.h"
 
 class ProjectBuilder
 {
@@ -6,88 +26,1139 @@ private:
     //This class follows the same pattern as the converter: perform a straight build and
     //allow for a future deeper analysis.
 
-    //ConversionAnalyzer m_analyzer;    //for future use
-    std::optional<std::string> BuildOneProject(std::shared_ptr<ProjectInfo> project)
+    //What happened to a project in the last build, as the build report lists it. Projects that
+    //are still Pending when the build ends were skipped, because a dependency failed, or cancelled.
+    //Imported projects belong to another shard, see SetShard().
+    enum class BuildStatus : uint8_t {NotInBuild, Pending, UpToDate, Built, Restored, Failed, Skipped, Cancelled, Imported};
+
+    //Book-keeping for one call to Build(), indexed by node id. The state table counts, for every
+    //project, the dependencies that haven't been built yet. A project becomes ready the moment the
+    //worker that builds its last dependency drops its counter to zero.
+    struct BuildState
+    {
+        BuildState(const ProjectGraph &graph, const ResourceBudget &budget) : m_graph(graph),
+                                                                              m_nodes(graph.NodeCount()),
+                                                                              m_pending(graph.NodeCount(), 0),
+                                                                              m_converting(graph.NodeCount(), 0),
+                                                                              m_inputs(graph.NodeCount()),
+                                                                              m_priority(graph.NodeCount(), 0.0),
+                                                                              m_OutputHashes(graph.NodeCount()),
+                                                                              m_bypassed(graph.NodeCount(), 0),
+                                                                              m_free(budget),
+                                                                              m_status(graph.NodeCount(), BuildStatus::NotInBuild),
+                                                                              m_durations(graph.NodeCount(), 0.0),
+                                                                              m_waits(graph.NodeCount(), 0.0),
+                                                                              m_ReadySince(graph.NodeCount()),
+                                                                              m_errors(graph.NodeCount())
+        {
+
+        }
+
+        const ProjectGraph &m_graph;
+        std::mutex m_lock;
+        NodeStateTable m_nodes;
+        std::vector<uint8_t> m_pending;             //1 if the project is part of this build
+        std::vector<uint8_t> m_converting;          //1 while it waits for its conversion, protected by the gate's lock
+        std::vector<ProjectBuildState> m_inputs;    //what each project is built from
+        std::vector<double> m_priority;             //longest remaining path, in seconds, through the project
+        std::vector<std::string> m_OutputHashes;    //with an artifact cache, of the projects built or up to date
+        std::set<std::pair<double, NodeId>, std::greater<>> m_ready;    //highest priority first, protected by m_lock
+        std::vector<uint32_t> m_bypassed;           //times lower priority projects started ahead of it
+        ResourceBudget m_free;                      //what's left of the budget, protected by m_lock
+        std::condition_variable m_ResourcesFreed;
+        std::atomic<bool> m_failed {false};         //the build stops
+        std::optional<std::string> m_error;         //the first error, protected by m_lock
+
+        //Each one written by the worker that builds the project, read once the build is over.
+        std::vector<BuildStatus> m_status;
+        std::vector<double> m_durations;
+        std::vector<double> m_waits;                //from ready to started
+        std::vector<std::chrono::steady_clock::time_point> m_ReadySince;    //protected by m_lock
+        std::vector<std::string> m_errors;
+    };
+
+    //Published while builds run, see MetricsRegistry. Like the registry, they're the process's:
+    //every builder adds to the same ones.
+    struct BuildMetrics
+    {
+        MetricsRegistry &m_registry {MetricsRegistry::Instance()};
+        Gauge &m_QueueDepth {m_registry.AddGauge("project_builder_build_queue_depth", "Projects ready to build, waiting for a worker or for resources")};
+        Gauge &m_running {m_registry.AddGauge("project_builder_build_running", "Projects building")};
+        Gauge &m_workers {m_registry.AddGauge("project_builder_build_workers", "Threads of the build in progress")};
+        LatencyHistogram &m_wait {m_registry.AddHistogram("project_builder_build_wait_seconds", "Time from ready to started, per project")};
+        LatencyHistogram &m_run {m_registry.AddHistogram("project_builder_build_run_seconds", "Time to build, or restore, a project")};
+        Counter &m_CacheHits {m_registry.AddCounter("project_builder_artifact_cache_requests_total", "Artifact cache lookups", "result=\"hit\"")};
+        Counter &m_CacheMisses {m_registry.AddCounter("project_builder_artifact_cache_requests_total", "Artifact cache lookups", "result=\"miss\"")};
+        std::array<Counter *, 9> m_outcomes {};     //by BuildStatus
+
+        BuildMetrics()
+        {
+            using Label = std::pair<BuildStatus, const char *>;
+            for(auto [status, label] : {Label {BuildStatus::Built, "built"}, Label {BuildStatus::Restored, "restored"},
+                                        Label {BuildStatus::UpToDate, "up_to_date"}, Label {BuildStatus::Failed, "failed"},
+                                        Label {BuildStatus::Skipped, "skipped"}, Label {BuildStatus::Cancelled, "cancelled"},
+                                        Label {BuildStatus::Imported, "imported"}})
+            {
+                m_outcomes[static_cast<size_t>(status)] = &m_registry.AddCounter("project_builder_build_projects_total",
+                                                                                 "Projects by outcome",
+                                                                                 std::string("status=\"") + label + "\"");
+            }
+        }
+    };
+
+    static BuildMetrics &Metrics()
+    {
+        static auto metrics = BuildMetrics();
+        return (metrics);
+    }
+
+    size_t m_jobs {1};
+    std::string m_BuildFolder {"./build"};
+    std::shared_ptr<BuildStateStore> m_StateStore {nullptr};
+    std::shared_ptr<ProcessExecutor> m_executor {nullptr};
+    std::shared_ptr<RemoteExecutor> m_RemoteExecutor {nullptr};    //runs the build commands instead of m_executor
+    std::chrono::milliseconds m_SimulatedDuration {5000};     //of a project without a command
+    std::shared_ptr<ArtifactCache> m_ArtifactCache {nullptr};
+    ResourceBudget m_budget {ResourceDetector::Detect()};
+    bool m_KeepGoing {false};
+    std::vector<uint8_t> m_shard;   //by node, the projects to build; empty for all of them
+    nlohmann::ordered_json m_report;
+
+    //How many times a ready project may be passed over by lower priority projects, because it
+    //doesn't fit in what's left of the budget, before no lower priority project may start until
+    //it does. Without this, a stream of small projects could postpone a big one forever.
+    static constexpr uint32_t MaxBypasses {8};
+
+    [[nodiscard]] bool RunsCommand(const ProjectInfo &project) const
+    {
+        return ((m_executor || m_RemoteExecutor) && !project.GetBuildCommand().empty());
+    }
+
+    //Every project that runs a command gets a folder of its own for its outputs, named after the
+    //project file and a hash of its path so that projects with the same name don't collide.
+    [[nodiscard]] std::string OutputFolder(const ProjectInfo &project) const
+    {
+        auto &project_path = project.GetProjectPath();
+        auto path_hash = ContentHash();
+        path_hash.Update(project_path);
+        auto folder_name = std::filesystem::path(project_path).stem().string() + "_" + path_hash.ToString();
+        return ((std::filesystem::path(m_BuildFolder) / "outputs" / folder_name).string());
+    }
+
+    //A project that declares a "Build Command" is built by running it, on a build worker if there
+    //are any. Otherwise, the build is simulated. The priority orders the commands waiting for a
+    //worker.
+    std::optional<std::string> BuildOneProject(ProjectInfo &project, double priority)
     {
-        std::cout << "Building " << project->GetProjectPath() << "..." << std::endl;
-        std::this_thread::sleep_for(std::chrono::milliseconds(5000));
+        TRACE_SCOPE("BuildOneProject", project.GetProjectPath());
+        LogWriter::Instance().Console("Building " + project.GetProjectPath() + "...\n");
+        auto build_path = m_BuildFolder;
+        if(RunsCommand(project))
+        {
+            build_path = OutputFolder(project);
+
+            //A build starts from an empty folder: whatever is left there may be hard links into an
+            //artifact cache, restored by an earlier run even if this one has no cache, which writing
+            //to them would corrupt. And only what this build produces may be stored.
+            std::filesystem::remove_all(build_path);
+            std::filesystem::create_directories(build_path);
+
+            auto request = ProcessRequest::ForProject(project.GetBuildCommand(),
+                                                      project.GetProjectPath(),
+                                                      m_BuildFolder,
+                                                      build_path);
+            request.m_environment["CPU_SLOTS"] = std::to_string(Demand(project).m_CpuSlots);
+            auto result = ProcessResult();
+            if(m_RemoteExecutor)
+            {
+                auto inputs = std::vector<std::string>();
+                for(auto child_project : project.GetDependencies())
+                {
+                    inputs.emplace_back(child_project->GetProjectPath());
+                }
+                result = m_RemoteExecutor->Run(request, inputs, priority).get();
+            }
+            else
+            {
+                result = m_executor->Run(request).get();
+            }
+            project.SetCommandResult(result.m_ExitCode, result.m_output + result.m_error);
 
-        //if(error building project)
-        //{
-            //analyzer.AnalyzeResult();
-            //Generate error code and message
-            //std::cout << "Failed" << std::endl;
-            //return(error_message);
-        //}
+            auto error = result.GetError();
+            if(error)
+            {
+                LogWriter::Instance().Console("Failed " + project.GetProjectPath() + "\n" + project.GetLog());
+                return (error);
+            }
+        }
+        else
+        {
+            std::this_thread::sleep_for(m_SimulatedDuration);
+        }
 
-        project->SetBuild(std::make_shared<HatsDateTime>(), "./build");
-        std::cout << "Completed" << std::endl;
+        project.SetBuild(std::make_shared<HatsDateTime>(), build_path);
+        LogWriter::Instance().Console("Completed " + project.GetProjectPath() + "\n");
 
         return (std::nullopt);
     }
 
-    bool CanBuild(std::shared_ptr<ProjectInfo> project)
+    //Marks every project reachable from the roots as pending, except the ones already built and,
+    //with a shard, the ones of other shards. A project that several roots depend on is part of the
+    //build once.
+    void MarkReachable(BuildState &state, const std::vector<NodeId> &root_nodes)
     {
-        if(!project->GetBuildTime())
+        auto &graph = state.m_graph;
+        auto visited = std::vector<uint8_t>(graph.NodeCount(), 0);
+        auto s = root_nodes;
+        for(auto root_node : root_nodes)
+        {
+            visited[root_node] = 1;
+        }
+
+        while(!s.empty())
         {
-            auto child_projects = project->GetDependencies();
-            if(child_projects.empty())  //if leaf node, we can build
+            auto node = s.back();
+            s.pop_back();
+
+            //project->GetBuildTime() will only return a valid value if the project has been built.
+            //This implementation doesn't take into account force-building a project that has been built.
+            if(graph.Info(node).GetBuildTime())
             {
-                return (true);
+                state.m_status[node] = BuildStatus::UpToDate;
+                continue;
             }
 
-            for(auto child : child_projects)
+            if(m_shard.empty() || m_shard[node])
             {
-                if(!child->GetBuildTime())
+                state.m_pending[node] = 1;
+                state.m_status[node] = BuildStatus::Pending;
+            }
+            for(auto child_node : graph.Dependencies(node))
+            {
+                if(!visited[child_node])
                 {
-                    return (false);     //if at least one deoendency isn't built yet, just wait
+                    visited[child_node] = 1;
+                    s.emplace_back(child_node);
                 }
             }
+        }
+    }
+
+    //With a shard, the dependencies that other shards build are taken as built already, their
+    //outputs in the folder where this build would have put them. An import whose folder is missing
+    //fails, see Build(). Returns how many of those are missing.
+    size_t ImportDependencies(BuildState &state)
+    {
+        auto &graph = state.m_graph;
+        auto missing = size_t {0};
+        for(NodeId node = 0; node < graph.NodeCount(); ++node)
+        {
+            if(!state.m_pending[node])
+            {
+                continue;
+            }
+
+            for(auto child_node : graph.Dependencies(node))
+            {
+                if(state.m_status[child_node] != BuildStatus::NotInBuild)
+                {
+                    continue;
+                }
 
-            return (true);  //Project has one or more dependency and all have been built.
+                auto &child = graph.Info(child_node);
+                auto build_path = (RunsCommand(child) ? OutputFolder(child) : m_BuildFolder);
+                if(!std::filesystem::exists(build_path))
+                {
+                    state.m_status[child_node] = BuildStatus::Failed;
+                    state.m_errors[child_node] = "The imported output folder " + build_path + " is missing";
+                    JournalProject(state, child_node);
+                    LogWriter::Instance().Console(child.GetProjectPath() + ": " + state.m_errors[child_node] + "\n");
+                    ++missing;
+                    continue;
+                }
+                child.SetBuild(std::make_shared<HatsDateTime>(), build_path);
+                state.m_status[child_node] = BuildStatus::Imported;
+            }
         }
-        return (false);
+        return (missing);
     }
 
-public:
-    //Unlike conversion, building stops on first error. That is, if a project cannot be built, the
-    //remaining projects will not be built either.
-    void Build(std::shared_ptr<ProjectInfo> root_project)
+    //Visits the pending projects dependencies first and computes the signature of each one: the
+    //hash of its project file combined with the signatures of its dependencies. Projects whose
+    //recorded state matches are marked as built and dropped from the build; a project is only up
+    //to date if all of its dependencies are.
+    size_t SkipUpToDateProjects(BuildState &state)
     {
-        //Using a stack because we want to build the leafs first. It makes things easier.
-        auto s = std::stack<std::shared_ptr<ProjectInfo>>();
-        s.emplace(root_project);
+        auto &graph = state.m_graph;
+        auto signatures = std::vector<std::string>(graph.NodeCount());
+        auto skipped = size_t {0};
 
-        auto meter = Meter<std::ratio<1, 1>>();
+        for(auto node : graph.TopologicalOrder())
+        {
+            auto &project = graph.Info(node);
+            auto &current = state.m_inputs[node];
+            current.m_FileHash = ContentHash::HashFile(project.GetProjectPath());
+
+            auto all_children_up_to_date = true;
+            for(auto child_node : graph.Dependencies(node))
+            {
+                current.m_DependencyHashes[graph.Path(child_node)] = signatures[child_node];
+                all_children_up_to_date &= !state.m_pending[child_node];
+            }
+
+            auto signature = ContentHash();
+            signature.Update(current.m_FileHash);
+            for(auto &[dependency_path, dependency_hash] : current.m_DependencyHashes)
+            {
+                signature.Update(dependency_path);
+                signature.Update(dependency_hash);
+            }
+            signatures[node] = signature.ToString();
+
+            if(state.m_pending[node] && all_children_up_to_date)
+            {
+                auto recorded = m_StateStore->FindUpToDate(project.GetProjectPath(), current);
+                if(recorded)
+                {
+                    project.SetBuild(std::make_shared<HatsDateTime>(recorded->m_BuildTime),
+                                     recorded->m_BuildPath);
+                    state.m_OutputHashes[node] = recorded->m_OutputHash;
+                    state.m_pending[node] = 0;
+                    state.m_status[node] = BuildStatus::UpToDate;
+                    ++skipped;
+                }
+            }
+        }
+
+        return (skipped);
+    }
+
+    //HLFET-style list scheduling: the priority of a project is the length of the longest path
+    //from it to the end of the build, i.e. its own duration plus the largest priority among the
+    //pending projects that depend on it. Durations come from the previous builds. A project that
+    //was never built is assumed to take m_SimulatedDuration if it has no command to run, and the
+    //average of the known durations otherwise. Returns the predicted critical path length, unless
+    //such a project has no known duration to go by: its priority then counts a second for it, which
+    //still orders the projects by the length of their chains, but predicts nothing.
+    std::optional<double> ComputePriorities(BuildState &state)
+    {
+        auto &graph = state.m_graph;
+        auto known_total = 0.0;
+        auto known_count = size_t {0};
+        auto durations = std::vector<std::optional<double>>(graph.NodeCount());
+
+        for(NodeId node = 0; node < graph.NodeCount(); ++node)
+        {
+            if(state.m_pending[node] && m_StateStore)
+            {
+                durations[node] = m_StateStore->FindDuration(graph.Path(node));
+                if(durations[node])
+                {
+                    known_total += *durations[node];
+                    ++known_count;
+                }
+            }
+        }
+
+        auto simulated = std::chrono::duration<double>(m_SimulatedDuration).count();
+        auto estimate = (known_count > 0 ? known_total / static_cast<double>(known_count) : 1.0);
+        auto predicted = true;
+        auto critical_path = 0.0;
+
+        //Dependents come after their dependencies in topological order, so walk it backwards.
+        auto &order = graph.TopologicalOrder();
+        for(auto it = order.rbegin(); it != order.rend(); ++it)
+        {
+            auto node = *it;
+            if(!state.m_pending[node])
+            {
+                continue;
+            }
+
+            auto longest_after = 0.0;
+            for(auto parent_node : graph.Dependents(node))
+            {
+                if(state.m_pending[parent_node])
+                {
+                    longest_after = std::max(longest_after, state.m_priority[parent_node]);
+                }
+            }
+
+            auto duration = durations[node];
+            if(!duration)
+            {
+                auto runs_command = RunsCommand(graph.Info(node));
+                predicted = predicted && (!runs_command || known_count > 0);
+                duration = (runs_command ? estimate : simulated);
+            }
+            state.m_priority[node] = *duration + longest_after;
+            critical_path = std::max(critical_path, state.m_priority[node]);
+        }
+
+        if(!predicted)
+        {
+            return (std::nullopt);
+        }
+        return (critical_path);
+    }
+
+    void RecordBuild(BuildState &state, NodeId node, double duration)
+    {
+        if(!m_StateStore)
+        {
+            return;
+        }
+
+        auto &project = state.m_graph.Info(node);
+        auto build_state = state.m_inputs[node];    //written before the build started, read-only since
+        build_state.m_BuildPath = project.GetBuildPath().value_or("");
+        build_state.m_BuildTime = (*project.GetBuildTime())->GetTimeStamp();
+        build_state.m_duration = duration;
+        build_state.m_OutputHash = state.m_OutputHashes[node];
+        m_StateStore->Record(project.GetProjectPath(), build_state);
+    }
+
+    //Before the build starts, so that the workers only ever read them: the output hashes of the
+    //projects that were built earlier and that pending projects depend on.
+    void HashBuiltDependencies(BuildState &state)
+    {
+        auto &graph = state.m_graph;
+        for(NodeId node = 0; node < graph.NodeCount(); ++node)
+        {
+            if(!state.m_pending[node])
+            {
+                continue;
+            }
+
+            for(auto child_node : graph.Dependencies(node))
+            {
+                auto &child = graph.Info(child_node);
+                if(!state.m_pending[child_node] && state.m_OutputHashes[child_node].empty() && RunsCommand(child))
+                {
+                    state.m_OutputHashes[child_node] = ContentHash::HashFolder(child.GetBuildPath().value_or(""));
+                }
+            }
+        }
+    }
+
+    //What the outputs of a project are a function of: its project file, its command and the outputs
+    //of its dependencies. Paths are left out on purpose, so that the same project in another
+    //workspace, or in another folder, finds the same entry.
+    std::string ArtifactKey(BuildState &state, NodeId node)
+    {
+        auto &graph = state.m_graph;
+        auto &project = graph.Info(node);
+        auto file_hash = state.m_inputs[node].m_FileHash;
+        if(file_hash.empty())
+        {
+            file_hash = ContentHash::HashFile(project.GetProjectPath());
+        }
+
+        auto dependency_hashes = std::vector<std::string>();
+        for(auto child_node : graph.Dependencies(node))
+        {
+            dependency_hashes.emplace_back(state.m_OutputHashes[child_node]);
+        }
+        std::sort(dependency_hashes.begin(), dependency_hashes.end());
+
+        auto key = ContentHash();
+        key.Update(file_hash);
+        key.Update(project.GetBuildCommand());
+        for(auto &dependency_hash : dependency_hashes)
+        {
+            key.Update(dependency_hash);
+        }
+        return (key.ToString());
+    }
+
+    //Restores the outputs of the project from the artifact cache, if they are there.
+    bool RestoreProject(BuildState &state, NodeId node, const std::string &key)
+    {
+        auto &project = state.m_graph.Info(node);
+        auto output_folder = OutputFolder(project);
+        try
+        {
+            auto output_hash = m_ArtifactCache->Restore(key, output_folder);
+            if(!output_hash)
+            {
+                return (false);
+            }
+
+            state.m_OutputHashes[node] = *output_hash;
+            project.SetBuild(std::make_shared<HatsDateTime>(), output_folder);
+            LogWriter::Instance().Console("Restored " + project.GetProjectPath() + " from the artifact cache\n");
+            return (true);
+        }
+        catch(const std::exception &e)
+        {
+            //The cache only ever saves time: when it fails, the project is built.
+            LogWriter::Instance().Console("Unable to restore " + project.GetProjectPath() + ": " + e.what() + "\n");
+            return (false);
+        }
+    }
+
+    void StoreProject(BuildState &state, NodeId node, const std::string &key)
+    {
+        auto &project = state.m_graph.Info(node);
+        auto output_folder = OutputFolder(project);
+        state.m_OutputHashes[node] = ContentHash::HashFolder(output_folder);
+        try
+        {
+            m_ArtifactCache->Store(key, output_folder, state.m_OutputHashes[node]);
+        }
+        catch(const std::exception &e)
+        {
+            LogWriter::Instance().Console("Unable to cache the outputs of " + project.GetProjectPath() + ": " + e.what() + "\n");
+        }
+    }
+
+    //Counts the pending dependencies of every pending project, plus its conversion if it's still
+    //running. Returns the ones that are ready now.
+    std::vector<NodeId> CountDependencies(BuildState &state)
+    {
+        auto &graph = state.m_graph;
+        auto ready = std::vector<NodeId>();
+
+        for(NodeId node = 0; node < graph.NodeCount(); ++node)
+        {
+            if(!state.m_pending[node])
+            {
+                continue;
+            }
+
+            auto remaining = uint32_t {state.m_converting[node]};
+            for(auto child_node : graph.Dependencies(node))
+            {
+                remaining += state.m_pending[child_node];
+            }
+
+            state.m_nodes.Reset(node, remaining);
+            if(remaining == 0)
+            {
+                ready.emplace_back(node);
+            }
+        }
+
+        return (ready);
+    }
+
+    //After the project failed: the pending projects that depend on it, directly or not, are
+    //Skipped in the table at once, so that they never become ready, whatever else they wait for.
+    //Their status, and what blocked them, is settled in GenerateReport().
+    void SkipDependents(BuildState &state, NodeId node)
+    {
+        auto s = std::vector<NodeId> {node};
         while(!s.empty())
         {
-            auto project = s.top();
-            auto error = std::optional<std::string>{std::nullopt};
-            auto can_build = CanBuild(project);
+            auto current = s.back();
+            s.pop_back();
+            for(auto parent_node : state.m_graph.Dependents(current))
+            {
+                if(state.m_pending[parent_node] && state.m_nodes.Skip(parent_node))
+                {
+                    s.emplace_back(parent_node);
+                }
+            }
+        }
+    }
 
-            if(can_build)
+    //The project fails without building, since its conversion did. Its dependents are never
+    //released, as after a failed build.
+    void FailConversion(ThreadPool &pool, BuildState &state, NodeId node)
+    {
+        auto &project = state.m_graph.Info(node);
+        state.m_nodes.Fail(node);
+        state.m_status[node] = BuildStatus::Failed;
+        state.m_errors[node] = "The conversion failed";
+        JournalProject(state, node);
+        SkipDependents(state, node);
+        {
+            auto lock = std::lock_guard<std::mutex>(state.m_lock);
+            if(!state.m_error)
+            {
+                state.m_error = project.GetProjectPath() + ": " + state.m_errors[node];
+            }
+            if(!m_KeepGoing)
             {
-                BuildOneProject(project);
+                state.m_failed = true;
             }
+        }
+        state.m_ResourcesFreed.notify_all();   //the workers waiting for resources see the failure
+        if(!m_KeepGoing)
+        {
+            pool.Cancel();
+        }
+    }
 
-            //project->GetBuildTime() will only return a valid value if the project has been built.
-            //This implementation doesn't take into account force-building a project that has been built.
-            if(can_build || project->GetBuildTime())
+    //Phased runs: every conversion is over, and the pending projects whose conversion failed fail,
+    //as in a streaming run. Returns the projects that are ready now.
+    std::vector<NodeId> CheckConversions(ThreadPool &pool, BuildState &state)
+    {
+        auto ready = CountDependencies(state);
+        for(NodeId node = 0; node < state.m_graph.NodeCount(); ++node)
+        {
+            if(state.m_pending[node] && state.m_graph.Info(node).Status() != ConversionStatus::Converted)
             {
-                s.pop();
+                FailConversion(pool, state, node);
             }
+        }
+        ready.erase(std::remove_if(ready.begin(), ready.end(), [&state](NodeId node) {return (state.m_nodes.Get(node) != NodeState::Ready);}),
+                    ready.end());
+        return (ready);
+    }
+
+    //Streaming runs: the pending projects whose conversion is still running wait for it as they wait
+    //for their dependencies, and the gate tells when it's over. The projects whose conversion
+    //failed, before or after, fail, see FailConversion().
+    std::vector<NodeId> AttachConversions(ThreadPool &pool, BuildState &state, ConversionGate &gate)
+    {
+        auto ready = std::vector<NodeId>();
+        gate.Attach([this, &pool, &state, &ready](const std::unordered_set<uint32_t> &converting,
+                                                  const std::unordered_set<uint32_t> &failed)
+        {
+            for(auto path_id : converting)
+            {
+                auto node = state.m_graph.NodeOf(path_id);
+                if(node != InvalidNode && state.m_pending[node])
+                {
+                    state.m_converting[node] = 1;
+                }
+            }
+
+            //They wait for a conversion that is never over.
+            auto failed_nodes = std::vector<NodeId>();
+            for(auto path_id : failed)
+            {
+                auto node = state.m_graph.NodeOf(path_id);
+                if(node != InvalidNode && state.m_pending[node])
+                {
+                    state.m_converting[node] = 1;
+                    failed_nodes.emplace_back(node);
+                }
+            }
+            ready = CountDependencies(state);
+            for(auto node : failed_nodes)
+            {
+                state.m_converting[node] = 0;
+                FailConversion(pool, state, node);
+            }
+        },
+        [this, &pool, &state](uint32_t path_id, bool converted)
+        {
+            auto node = state.m_graph.NodeOf(path_id);
+            if(node != InvalidNode && state.m_converting[node])
+            {
+                state.m_converting[node] = 0;
+                if(!converted)
+                {
+                    FailConversion(pool, state, node);
+                }
+                else if(state.m_nodes.DependencyDone(node))
+                {
+                    Dispatch(pool, state, node);
+                }
+            }
+        });
+        return (ready);
+    }
 
-            auto child_projects = project->GetDependencies();
-            for(auto child_project : child_projects)
+    //The detected budget doesn't lower the parallelism asked for: with more jobs than CPUs, e.g.
+    //for builds waiting on I/O, the default budget has a CPU slot per job. Only a budget that's
+    //set explicitly, see SetResourceBudget(), can run fewer projects than jobs at once.
+    void AllowJobs()
+    {
+        m_budget.m_CpuSlots = std::max(m_budget.m_CpuSlots, static_cast<uint32_t>(std::min<size_t>(m_jobs, UINT32_MAX)));
+    }
+
+    //What the project takes out of the budget while it builds: what its project file declares,
+    //capped by the budget, so that a project asking for more than the machine has still builds,
+    //alone. Memory only counts when the budget has a limit.
+    [[nodiscard]] ResourceBudget Demand(const ProjectInfo &project) const
+    {
+        auto demand = ResourceBudget();
+        demand.m_CpuSlots = std::min(project.GetCpuSlots(), m_budget.m_CpuSlots);
+        demand.m_MemoryMB = std::min<uint64_t>(project.GetMemoryMB(), m_budget.m_MemoryMB);
+        return (demand);
+    }
+
+    //Must be called with the lock held.
+    [[nodiscard]] bool Fits(const BuildState &state, NodeId node) const
+    {
+        auto demand = Demand(state.m_graph.Info(node));
+        return (demand.m_CpuSlots <= state.m_free.m_CpuSlots && demand.m_MemoryMB <= state.m_free.m_MemoryMB);
+    }
+
+    //Takes the highest priority ready project that fits in what's left of the budget, and its
+    //resources, waiting for running projects to give theirs back if none does. Projects that
+    //don't fit are passed over, until one of them has been passed over MaxBypasses times: from
+    //then on, nothing below it starts until it fits. Returns InvalidNode once the build failed.
+    NodeId Acquire(BuildState &state)
+    {
+        auto lock = std::unique_lock<std::mutex>(state.m_lock);
+        while(!state.m_failed)
+        {
+            auto chosen = state.m_ready.end();
+            for(auto it = state.m_ready.begin(); it != state.m_ready.end(); ++it)
+            {
+                if(Fits(state, it->second))
+                {
+                    chosen = it;
+                    break;
+                }
+                if(state.m_bypassed[it->second] >= MaxBypasses)
+                {
+                    break;  //the rest waits for this one
+                }
+            }
+
+            if(chosen != state.m_ready.end())
             {
-                if(!child_project->GetBuildTime())  //only push projects that haven't been built
+                for(auto it = state.m_ready.begin(); it != chosen; ++it)
                 {
-                    s.emplace(child_project);
+                    ++state.m_bypassed[it->second];
                 }
+
+                auto node = chosen->second;
+                auto demand = Demand(state.m_graph.Info(node));
+                state.m_free.m_CpuSlots -= demand.m_CpuSlots;
+                state.m_free.m_MemoryMB -= demand.m_MemoryMB;
+                state.m_ready.erase(chosen);
+                state.m_waits[node] = std::chrono::duration<double>(std::chrono::steady_clock::now() - state.m_ReadySince[node]).count();
+                Metrics().m_QueueDepth.Set(static_cast<int64_t>(state.m_ready.size()));
+                return (node);
             }
+
+            //Backpressure: nothing starts until a running project is done.
+            state.m_ResourcesFreed.wait(lock);
+        }
+        return (InvalidNode);
+    }
+
+    void Release(BuildState &state, NodeId node)
+    {
+        {
+            auto lock = std::lock_guard<std::mutex>(state.m_lock);
+            auto demand = Demand(state.m_graph.Info(node));
+            state.m_free.m_CpuSlots += demand.m_CpuSlots;
+            state.m_free.m_MemoryMB += demand.m_MemoryMB;
+        }
+        state.m_ResourcesFreed.notify_all();
+    }
+
+    //Makes the project ready and hands the pool one more task. The task doesn't build this
+    //particular project but whichever ready project Acquire() picks when a worker gets to it, so
+    //the pool works on the longest remaining paths first, as far as the budget allows.
+    void Dispatch(ThreadPool &pool, BuildState &state, NodeId node)
+    {
+        {
+            auto lock = std::lock_guard<std::mutex>(state.m_lock);
+            state.m_ready.emplace(state.m_priority[node], node);
+            state.m_ReadySince[node] = std::chrono::steady_clock::now();
+            Metrics().m_QueueDepth.Set(static_cast<int64_t>(state.m_ready.size()));
+        }
+        state.m_ResourcesFreed.notify_one();    //a waiting worker may be able to start it
+
+        pool.Submit([this, &pool, &state]()
+        {
+            auto node = Acquire(state);
+            if(node == InvalidNode)
+            {
+                return;
+            }
+            if(!state.m_nodes.Start(node))
+            {
+                Release(state, node);   //skipped while it waited
+                return;
+            }
+
+            auto &metrics = Metrics();
+            metrics.m_wait.Record(state.m_waits[node]);
+            metrics.m_running.Add(1);
+            auto &project = state.m_graph.Info(node);
+            auto meter = Meter<std::ratio<1, 1>>();
+            auto use_cache = (m_ArtifactCache && RunsCommand(project));
+            auto key = (use_cache ? ArtifactKey(state, node) : std::string());
+            auto restored = (use_cache && RestoreProject(state, node, key));
+            if(use_cache)
+            {
+                (restored ? metrics.m_CacheHits : metrics.m_CacheMisses).Increment();
+            }
+
+            auto duration = 0.0;
+            if(restored)
+            {
+                //What the scheduler needs to know is how long building the project takes.
+                duration = m_StateStore ? m_StateStore->FindDuration(project.GetProjectPath()).value_or(0.0) : 0.0;
+                state.m_status[node] = BuildStatus::Restored;
+            }
+            else
+            {
+                auto error = BuildOneProject(project, state.m_priority[node]);
+                if(error)
+                {
+                    state.m_status[node] = BuildStatus::Failed;
+                    state.m_durations[node] = meter.ElapsedTime();
+                    state.m_errors[node] = *error;
+                    metrics.m_run.Record(state.m_durations[node]);
+                    metrics.m_running.Add(-1);
+                    state.m_nodes.Finish(node, false);
+                    JournalProject(state, node);
+                    {
+                        auto lock = std::lock_guard<std::mutex>(state.m_lock);
+                        if(!state.m_error)
+                        {
+                            state.m_error = project.GetProjectPath() + ": " + *error;
+                        }
+                        if(!m_KeepGoing)
+                        {
+                            state.m_failed = true;
+                        }
+                    }
+
+                    //The dependents are never released, so with m_KeepGoing the build goes on
+                    //without them: only the projects that depend on this one are skipped.
+                    SkipDependents(state, node);
+                    Release(state, node);   //also wakes the workers waiting for resources
+                    if(!m_KeepGoing)
+                    {
+                        pool.Cancel();
+                    }
+                    return;
+                }
+
+                if(use_cache)
+                {
+                    StoreProject(state, node, key);
+                }
+                duration = meter.ElapsedTime();
+                state.m_status[node] = BuildStatus::Built;
+            }
+            state.m_durations[node] = meter.ElapsedTime();
+            metrics.m_run.Record(state.m_durations[node]);
+            metrics.m_running.Add(-1);
+            JournalProject(state, node);
+
+            RecordBuild(state, node, duration);
+            Release(state, node);
+
+            //Whatever was written about the project above is visible to the workers that build
+            //its dependents.
+            state.m_nodes.Finish(node, true);
+            for(auto parent_node : state.m_graph.Dependents(node))
+            {
+                if(state.m_pending[parent_node] && state.m_nodes.DependencyDone(parent_node))
+                {
+                    Dispatch(pool, state, parent_node);
+                }
+            }
+        });
+    }
+
+    static const char *StatusName(BuildStatus status)
+    {
+        switch(status)
+        {
+            case BuildStatus::UpToDate: return ("Up To Date");
+            case BuildStatus::Built: return ("Built");
+            case BuildStatus::Restored: return ("Restored");
+            case BuildStatus::Failed: return ("Failed");
+            case BuildStatus::Skipped: return ("Skipped");
+            case BuildStatus::Cancelled: return ("Cancelled");
+            case BuildStatus::Imported: return ("Imported");
+            default: return ("Not Built");
+        }
+    }
+
+    //Appends the outcome of the project to the journal, and counts it, as soon as it is known.
+    void JournalProject(const BuildState &state, NodeId node, NodeId blocked_by = InvalidNode)
+    {
+        auto status = state.m_status[node];
+        auto outcome = Metrics().m_outcomes[static_cast<size_t>(status)];
+        if(outcome)
+        {
+            outcome->Increment();
+        }
+
+        auto record = nlohmann::ordered_json();
+        record["Phase"] = "Build";
+        record["Project"] = state.m_graph.Path(node);
+        record["Status"] = StatusName(status);
+        record["Duration"] = state.m_durations[node];
+        if(status == BuildStatus::Built || status == BuildStatus::Restored || status == BuildStatus::Failed)
+        {
+            record["Wait"] = state.m_waits[node];
+        }
+        if(!state.m_errors[node].empty())
+        {
+            record["Error"] = state.m_errors[node];
+        }
+        else if(blocked_by != InvalidNode)
+        {
+            record["Error"] = "A dependency failed";
+            record["Blocked By"] = state.m_graph.Path(blocked_by);
+        }
+        LogWriter::Instance().Record(std::move(record));
+    }
+
+    //Settles the projects that never got to build, dependencies first: a project that depends on
+    //a failed or skipped project is skipped, and blocked by the failed project at the bottom of
+    //the chain. The rest were cancelled when the build stopped. They are journaled now, along with
+    //the projects that were up to date. Then lists every project of the build, with its status, how
+    //long it took and why it failed or was skipped.
+    nlohmann::ordered_json GenerateReport(BuildState &state, double elapsed)
+    {
+        auto &graph = state.m_graph;
+        auto blocked_by = std::vector<NodeId>(graph.NodeCount(), InvalidNode);
+        auto counts = std::map<std::string, size_t>();
+        for(auto node : graph.TopologicalOrder())
+        {
+            if(state.m_status[node] == BuildStatus::Pending)
+            {
+                state.m_nodes.Skip(node);
+                state.m_status[node] = BuildStatus::Cancelled;
+                for(auto child_node : graph.Dependencies(node))
+                {
+                    if(state.m_status[child_node] == BuildStatus::Failed ||
+                       state.m_status[child_node] == BuildStatus::Skipped)
+                    {
+                        state.m_status[node] = BuildStatus::Skipped;
+                        blocked_by[node] = (blocked_by[child_node] != InvalidNode ? blocked_by[child_node] : child_node);
+                        break;
+                    }
+                }
+            }
+
+            if(state.m_status[node] == BuildStatus::UpToDate ||
+               state.m_status[node] == BuildStatus::Skipped ||
+               state.m_status[node] == BuildStatus::Cancelled ||
+               state.m_status[node] == BuildStatus::Imported)
+            {
+                JournalProject(state, node, blocked_by[node]);
+            }
+
+            if(state.m_status[node] != BuildStatus::NotInBuild)
+            {
+                ++counts[StatusName(state.m_status[node])];
+            }
+        }
+
+        auto dt = HatsDateTime();
+        m_report = nlohmann::ordered_json();
+        m_report["Report Date"] = dt.FormatDateTime();
+        m_report["Executed in "] = std::to_string(elapsed) + " seconds";
+        m_report["Status"] = (state.m_error ? "Failed" : "Success");
+        m_report["Keep Going"] = m_KeepGoing;
+
+        auto project_count = size_t {0};
+        auto &summary_json = m_report["Summary"];
+        for(auto status : {BuildStatus::Built, BuildStatus::Restored, BuildStatus::UpToDate,
+                           BuildStatus::Failed, BuildStatus::Skipped, BuildStatus::Cancelled, BuildStatus::Imported})
+        {
+            summary_json[StatusName(status)] = counts[StatusName(status)];
+            project_count += counts[StatusName(status)];
+        }
+        m_report["Project Count"] = project_count;
+
+        m_report["Projects"] = nlohmann::ordered_json::array();
+        auto &projects_json = m_report["Projects"];
+        for(NodeId node = 0; node < graph.NodeCount(); ++node)
+        {
+            if(state.m_status[node] == BuildStatus::NotInBuild)
+            {
+                continue;
+            }
+
+            auto project_json = nlohmann::ordered_json();
+            project_json["Project"] = graph.Path(node);
+            project_json["Status"] = StatusName(state.m_status[node]);
+            project_json["Duration"] = state.m_durations[node];
+            if(state.m_status[node] == BuildStatus::Failed)
+            {
+                project_json["Error"] = state.m_errors[node];
+                project_json["Output"] = graph.Info(node).GetLog();
+            }
+            else if(state.m_status[node] == BuildStatus::Skipped)
+            {
+                project_json["Error"] = "A dependency failed";
+                project_json["Blocked By"] = graph.Path(blocked_by[node]);
+            }
+            projects_json.emplace_back(std::move(project_json));
+        }
+
+        return (m_report);
+    }
+
+public:
+    ProjectBuilder() = default;
+
+    explicit ProjectBuilder(size_t jobs) : m_jobs(std::max<size_t>(jobs, 1))
+    {
+        AllowJobs();
+    }
+
+    //With a state store, projects that haven't changed since their last successful build, and
+    //whose dependencies haven't either, are skipped. With an executor, the build commands declared
+    //in the project files are run.
+    ProjectBuilder(size_t jobs,
+                   const std::string &build_folder,
+                   std::shared_ptr<BuildStateStore> state_store,
+                   std::shared_ptr<ProcessExecutor> executor = nullptr) : m_jobs(std::max<size_t>(jobs, 1)),
+                                                                          m_BuildFolder(build_folder),
+                                                                          m_StateStore(state_store),
+                                                                          m_executor(executor)
+    {
+        AllowJobs();
+    }
+
+    ~ProjectBuilder() = default;
+
+    //Unlike conversion, building stops on first error. That is, if a project cannot be built, the
+    //remaining projects will not be built either: work already queued is cancelled and only the
+    //projects that are running at the time of the error are allowed to finish. With SetKeepGoing(),
+    //a failure only skips the projects that depend on the failed one, directly or indirectly, and
+    //everything else is built.
+    //Either way, the outcome of every project is in the report, see GetLastReport().
+    //Projects are built from a ready queue: a project becomes ready as soon as all of its
+    //dependencies have been built, so independent projects build in parallel on up to m_jobs threads.
+    //Among the ready projects, the one with the longest remaining critical path goes first, as long
+    //as the CPU slots and memory its project file declares are left in the resource budget; running
+    //projects never take more than the budget together.
+    //The root projects of the map, i.e. the projects nothing depends on, and everything they depend
+    //on are built. A project whose conversion failed fails without building.
+    //With a gate, conversions are still running, see StreamingPipeline: a project is also only ready
+    //once its own conversion is over, and the build returns once every conversion is.
+    bool Build(ProjectMapper &project_map, ConversionGate *gate = nullptr)
+    {
+        TRACE_SCOPE("Build");
+        auto meter = Meter<std::ratio<1, 1>>();
+
+        auto &graph = project_map.GetGraph();
+        auto state = BuildState(graph, m_budget);
+        MarkReachable(state, project_map.GetRootNodes());
+        if(!m_shard.empty())
+        {
+            //Nothing builds on outputs that aren't there: the shards they come from go first.
+            auto missing = ImportDependencies(state);
+            if(missing > 0)
+            {
+                state.m_error = std::to_string(missing) + " imported output folder(s) are missing. The shards of the earlier stages have to be built first, see the shard manifest.";
+                GenerateReport(state, meter.ElapsedTime());
+                std::cout << "Build failed. " << *state.m_error << std::endl;
+                return (false);
+            }
+        }
+
+        if(m_StateStore)
+        {
+            auto skipped = SkipUpToDateProjects(state);
+            if(skipped > 0)
+            {
+                std::cout << skipped << " project(s) are up to date" << std::endl;
+            }
+        }
+
+        if(m_ArtifactCache)
+        {
+            HashBuiltDependencies(state);
+        }
+
+        std::cout << "Resource budget: " << m_budget.m_CpuSlots << " CPU slot(s), ";
+        if(m_budget.m_MemoryMB > 0)
+        {
+            std::cout << m_budget.m_MemoryMB << " MB of memory" << std::endl;
+        }
+        else
+        {
+            std::cout << "unlimited memory" << std::endl;
+        }
+        if(m_budget.m_CpuSlots < m_jobs)
+        {
+            std::cout << "Warning: the resource budget of " << m_budget.m_CpuSlots << " CPU slot(s) lets at most "
+                      << m_budget.m_CpuSlots << " of the " << m_jobs << " jobs build at once" << std::endl;
+        }
+
+        auto critical_path = ComputePriorities(state);
+        Metrics().m_workers.Set(static_cast<int64_t>(m_jobs));
+        {
+            auto pool = ThreadPool(m_jobs);
+            auto ready = (gate ? AttachConversions(pool, state, *gate) : CheckConversions(pool, state));
+            for(auto node : ready)
+            {
+                Dispatch(pool, state, node);
+            }
+            if(gate)
+            {
+                //Until then, the pool may run out of work while projects wait for their conversion.
+                gate->WaitForAll();
+                gate->Detach();
+            }
+            pool.Wait();
+        }
+        Metrics().m_workers.Set(0);
+        Metrics().m_QueueDepth.Set(0);     //what was still queued when the build stopped
+        LogWriter::Instance().Flush();  //what the workers printed goes before the summary
+
+        if(m_StateStore)
+        {
+            m_StateStore->Save();   //the projects that did build before a failure are kept
         }
 
         auto elapsed_time = meter.ElapsedTime();
-        std::cout << "Build completed in " << elapsed_time << " seconds" << std::endl;
+        GenerateReport(state, elapsed_time);
+        if(state.m_error)
+        {
+            std::cout << "Build failed after " << elapsed_time << " seconds. ";
+            if(m_KeepGoing)
+            {
+                std::cout << m_report["Summary"]["Failed"] << " project(s) failed and "
+                          << m_report["Summary"]["Skipped"] << " were skipped. First error: ";
+            }
+            std::cout << *state.m_error << std::endl;
+            return (false);
+        }
+
+        std::cout << "Build completed in " << elapsed_time << " seconds";
+        if(critical_path)
+        {
+            std::cout << " (predicted critical path: " << *critical_path << " seconds)";
+        }
+        std::cout << std::endl;
+        return (true);
     }
-};
\ No newline at end of file
+
+    [[nodiscard]] size_t GetJobs() const {return (m_jobs);}
+
+    //How long the simulated build of a project without a command takes. Zero makes the tool's
+    //own overhead measurable, as in the benchmarks.
+    void SetSimulatedDuration(std::chrono::milliseconds duration) {m_SimulatedDuration = duration;}
+
+    //With an artifact cache, a project that runs a build command is first looked up in the cache,
+    //and restored from it instead of being built if the same inputs were built before, here or in
+    //another workspace. Its outputs are stored after every build.
+    void SetArtifactCache(std::shared_ptr<ArtifactCache> artifact_cache) {m_ArtifactCache = artifact_cache;}
+
+    //The build commands then run on the build workers of the executor, see RemoteExecutor.
+    //Conversions stay local.
+    void SetRemoteExecutor(std::shared_ptr<RemoteExecutor> remote_executor) {m_RemoteExecutor = remote_executor;}
+
+    //Only the projects flagged in shard, by node id, are built, see ShardPlanner. Their dependencies
+    //outside of it are imported: another shard builds them, and their outputs are expected in
+    //GetOutputFolder() before the build starts. Empty builds every project.
+    void SetShard(std::vector<uint8_t> shard) {m_shard = std::move(shard);}
+
+    //Where the outputs of the project go, if it runs a build command.
+    [[nodiscard]] std::optional<std::string> GetOutputFolder(const ProjectInfo &project) const
+    {
+        return (RunsCommand(project) ? std::optional<std::string>(OutputFolder(project)) : std::nullopt);
+    }
+
+    //After a failure, keep building whatever doesn't depend on the failed project.
+    void SetKeepGoing(bool keep_going) {m_KeepGoing = keep_going;}
+
+    //Of the last call to Build(): the status of every project, how long it took and its error.
+    [[nodiscard]] nlohmann::ordered_json GetLastReport() const {return (m_report);}
+
+    //Detected from the machine by default, see ResourceDetector, with at least a CPU slot per job.
+    void SetResourceBudget(const ResourceBudget &budget) {m_budget = budget;}
+    [[nodiscard]] const ResourceBudget &GetResourceBudget() const {return (m_budget);}
+};
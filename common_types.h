@@ -1,38 +1,74 @@
 #pragma once
+#include <atomic>
+#include <functional>
 #include <string>
+#include <string_view>
 #include <fstream>
 #include <optional>
 #include "HatsDateTime.h"
+#include "project_graph.h"
 
 using namespace Hats::Tools;
 
 enum class ConversionStatus {NotConverted, Converted};
 
+//A node of the project map. Nodes are allocated and owned by the mapper, and refer to each other
+//by plain pointers. The path of the project file is interned: the node keeps its id and a
+//reference to the one copy in the mapper's path table.
+//The conversion status is atomic, as it's read while conversions run. The build fields are written
+//by the one worker that builds the project, and read by others only once its state in the
+//builder's NodeStateTable is Done.
 class ProjectInfo
 {
 private:
-    std::string m_FilePath;
-    ConversionStatus m_status {ConversionStatus::NotConverted};
+    const std::string *m_FilePath;
+    uint32_t m_PathId;
+    std::atomic<ConversionStatus> m_status {ConversionStatus::NotConverted};
     std::optional<std::shared_ptr<HatsDateTime>> m_LastBuilt;   //last time the project was built
     std::optional<std::string> m_BuildPath;                     //output path of the build process
     bool m_HasParent {false};
-    std::vector<std::shared_ptr<ProjectInfo>> m_dependencies;
+    bool m_external {false};                                    //outside the root folder
+    NodeId m_id {InvalidNode};                                  //index in the ProjectGraph
+    std::string m_BuildCommand;                                 //declared in the project file
+    std::string m_ConvertCommand;
+    uint32_t m_CpuSlots {1};                                    //what the build needs, see ProjectBuilder
+    uint32_t m_MemoryMB {0};
+    std::optional<int> m_ExitCode;                              //of the last command that ran
+    std::string m_log;                                          //output of the last command that ran
+    std::vector<ProjectInfo *> m_dependencies;
 
 public:
-    explicit ProjectInfo(const std::string &file_path) : m_FilePath(file_path)
+    ProjectInfo(const PathTable &paths, uint32_t path_id, bool has_parent = false) noexcept : m_FilePath(&paths.Get(path_id)),
+                                                                                              m_PathId(path_id),
+                                                                                              m_HasParent(has_parent)
     {
 
     }
 
-    ProjectInfo(const std::string &file_path, bool has_parent) : m_FilePath(file_path),
-                                                                 m_HasParent(has_parent)
-    {
+    ~ProjectInfo() = default;
+
+    void SetConverted() {m_status.store(ConversionStatus::Converted, std::memory_order_release);}
+    void SetHasParent() {m_HasParent = true;}
+    void SetExternal() {m_external = true;}
+    void SetId(NodeId id) {m_id = id;}
 
+    void SetCommands(std::string_view build_command, std::string_view convert_command)
+    {
+        m_BuildCommand = build_command;
+        m_ConvertCommand = convert_command;
     }
 
-    ~ProjectInfo() = default;
+    void SetResources(uint32_t cpu_slots, uint32_t memory_mb)
+    {
+        m_CpuSlots = cpu_slots;
+        m_MemoryMB = memory_mb;
+    }
 
-    void SetConverted() {m_status = ConversionStatus::Converted;}
+    void SetCommandResult(int exit_code, const std::string &log)
+    {
+        m_ExitCode = exit_code;
+        m_log = log;
+    }
 
     void SetBuild(std::shared_ptr<HatsDateTime> build_time, const std::string &build_path)
     {
@@ -40,15 +76,37 @@ public:
         m_BuildPath = build_path;
     }
 
-    void AddDependency(std::shared_ptr<ProjectInfo> project)
+    void AddDependency(ProjectInfo *project)
     {
         m_dependencies.emplace_back(project);
     }
 
-    [[nodiscard]] inline ConversionStatus Status() const {return (m_status);}
+    void ClearDependencies() {m_dependencies.clear();}
+
+    //Makes the project look as if it had never been converted or built, e.g. after its project file
+    //or one of its dependencies changed.
+    void Reset()
+    {
+        m_status.store(ConversionStatus::NotConverted, std::memory_order_release);
+        m_LastBuilt.reset();
+        m_BuildPath.reset();
+        m_ExitCode.reset();
+        m_log.clear();
+    }
+
+    [[nodiscard]] inline ConversionStatus Status() const {return (m_status.load(std::memory_order_acquire));}
     [[nodiscard]] inline bool HasParent() const {return (m_HasParent);}
-    [[nodiscard]] inline std::vector<std::shared_ptr<ProjectInfo>> GetDependencies() {return (m_dependencies);}
-    [[nodiscard]] inline std::string GetProjectPath() const {return (m_FilePath);}
+    [[nodiscard]] inline bool IsExternal() const {return (m_external);}
+    [[nodiscard]] inline NodeId GetId() const {return (m_id);}
+    [[nodiscard]] inline const std::string &GetBuildCommand() const {return (m_BuildCommand);}
+    [[nodiscard]] inline const std::string &GetConvertCommand() const {return (m_ConvertCommand);}
+    [[nodiscard]] inline uint32_t GetCpuSlots() const {return (m_CpuSlots);}
+    [[nodiscard]] inline uint32_t GetMemoryMB() const {return (m_MemoryMB);}
+    [[nodiscard]] inline std::optional<int> GetExitCode() const {return (m_ExitCode);}
+    [[nodiscard]] inline const std::string &GetLog() const {return (m_log);}
+    [[nodiscard]] inline const std::vector<ProjectInfo *> &GetDependencies() const {return (m_dependencies);}
+    [[nodiscard]] inline const std::string &GetProjectPath() const {return (*m_FilePath);}
+    [[nodiscard]] inline uint32_t GetPathId() const {return (m_PathId);}
 
     [[nodiscard]] inline std::optional<std::shared_ptr<HatsDateTime>> GetBuildTime() const
     {
@@ -60,14 +118,17 @@ public:
     [[nodiscard]] inline bool HasDependency() const {return (!m_dependencies.empty());}
 };
 
+//Projects of the same map are the same project if they have the same path, i.e. the same path id.
+//The ordering is the order in which the paths were first seen, which is enough for sorting and
+//searching; it isn't alphabetical.
 inline bool operator ==(const ProjectInfo &lhs, const ProjectInfo &rhs)
 {
-    return (lhs.GetProjectPath() == rhs.GetProjectPath());
+    return (lhs.GetPathId() == rhs.GetPathId());
 }
 
 inline bool operator <(const ProjectInfo& lhs, const ProjectInfo& rhs)
 {
-    return (lhs.GetProjectPath() < rhs.GetProjectPath());
+    return (lhs.GetPathId() < rhs.GetPathId());
 }
 
 inline bool operator >(const ProjectInfo &lhs, const ProjectInfo &rhs) { return(rhs < lhs);}
@@ -80,6 +141,18 @@ inline std::ostream &operator <<(std::ostream &os, const ProjectInfo &project_in
     auto status_str = (project_info.Status() == ConversionStatus::Converted ?
                                     "Converted" : "Not Converted");
 
-    os << "Project: " << p.filename() << " -- " << status_str << std::endl;
+    os << "Project: " << p.filename() << (project_info.IsExternal() ? " (external)" : "") << " -- " << status_str << std::endl;
     return (os);
-}
\ No newline at end of file
+}
+
+namespace std
+{
+    template<>
+    struct hash<ProjectInfo>
+    {
+        size_t operator()(const ProjectInfo &project_info) const noexcept
+        {
+            return (hash<uint32_t>()(project_info.GetPathId()));
+        }
+    };
+}
@@ -1,105 +1,319 @@
 #pragma once
+#include <algorithm>
 #include <iostream>
+#include <mutex>
 #include <thread>
 #include "queue"
 #include "json.hpp"
 #include "common_types.h"
+#include "log_writer.h"
 #include "mapper.h"
+#include "metrics.h"
+#include "process_executor.h"
+#include "thread_pool.h"
+#include "trace.h"
 #include "HatsDateTime.h"
 #include "ExecutionMeter.h"
 
 using namespace Hats::Tools;
 
-class ProjectConverter
+//Collects the outcome of every conversion. Conversions run on several threads at once, so every
+//access goes through the lock.
+class ConversionSink
 {
 private:
+    std::mutex m_lock;
     std::vector<std::string> m_converted;
     std::vector<std::string> m_failed;
+
+public:
+    ConversionSink() = default;
+    ~ConversionSink() = default;
+
+    void AddConverted(const std::string &project_path)
+    {
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        m_converted.emplace_back(project_path);
+    }
+
+    void AddFailed(const std::string &project_path)
+    {
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        m_failed.emplace_back(project_path);
+    }
+
+    //Completion order depends on thread timing. Sorting keeps the report identical between runs.
+    std::pair<std::vector<std::string>, std::vector<std::string>> Collect()
+    {
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        auto converted = m_converted;
+        auto failed = m_failed;
+        std::sort(converted.begin(), converted.end());
+        std::sort(failed.begin(), failed.end());
+        return (std::pair {converted, failed});
+    }
+
+    void Clear()
+    {
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        m_converted.clear();
+        m_failed.clear();
+    }
+};
+
+class ProjectConverter
+{
+private:
+    //Published while conversions run, see MetricsRegistry. Every converter of the process adds to
+    //the same ones.
+    struct ConversionMetrics
+    {
+        MetricsRegistry &m_registry {MetricsRegistry::Instance()};
+        Gauge &m_QueueDepth {m_registry.AddGauge("project_builder_conversion_queue_depth", "Projects waiting for a thread to convert them")};
+        Gauge &m_running {m_registry.AddGauge("project_builder_conversion_running", "Projects converting")};
+        Gauge &m_workers {m_registry.AddGauge("project_builder_conversion_workers", "Threads of the conversion in progress")};
+        LatencyHistogram &m_wait {m_registry.AddHistogram("project_builder_conversion_wait_seconds", "Time from queued to started, per project")};
+        LatencyHistogram &m_run {m_registry.AddHistogram("project_builder_conversion_run_seconds", "Time to convert a project")};
+        Counter &m_converted {m_registry.AddCounter("project_builder_conversion_projects_total", "Projects by outcome", "status=\"converted\"")};
+        Counter &m_failed {m_registry.AddCounter("project_builder_conversion_projects_total", "Projects by outcome", "status=\"failed\"")};
+    };
+
+    static ConversionMetrics &Metrics()
+    {
+        static auto metrics = ConversionMetrics();
+        return (metrics);
+    }
+
+    ConversionSink m_sink;
     nlohmann::ordered_json m_report;
+    size_t m_jobs {1};
+    std::shared_ptr<ProcessExecutor> m_executor {nullptr};
+    std::chrono::milliseconds m_SimulatedDuration {2000};     //of a project without a command
+    std::string m_BuildFolder {"./build"};
+
+    //Streaming runs only, see Begin().
+    std::unique_ptr<ThreadPool> m_pool {nullptr};
+    Meter<std::ratio<1, 1>> m_meter;
+    std::mutex m_ErrorLock;
+    std::exception_ptr m_error {nullptr};      //the first exception a conversion threw, protected by m_ErrorLock
 
-    //ConversionAnalyzer m_analyzer;    //for future use
-    std::optional<std::string> ConvertOneProject(std::shared_ptr<ProjectInfo> project)
+    //A project that declares a "Convert Command" is converted by running it. Otherwise, the
+    //conversion is simulated.
+    std::optional<std::string> ConvertOneProject(ProjectInfo &project)
     {
-        std::cout << "Converting " << project->GetProjectPath() << "..." << std::endl;
-        std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+        TRACE_SCOPE("ConvertOneProject", project.GetProjectPath());
+        LogWriter::Instance().Console("Converting " + project.GetProjectPath() + "...\n");
+        auto meter = Meter<std::ratio<1, 1>>();
+        if(m_executor && !project.GetConvertCommand().empty())
+        {
+            auto request = ProcessRequest::ForProject(project.GetConvertCommand(),
+                                                      project.GetProjectPath(),
+                                                      m_BuildFolder);
+            auto result = m_executor->Run(request).get();
+            project.SetCommandResult(result.m_ExitCode, result.m_output + result.m_error);
 
-        //if(error converting project)
-        //{
-            //analyzer.AnalyzeResult();
-            //Generate error code and message
-            //failed.emplace_back(project->GetProjectPath());
-            //std::cout << "Failed" << std::endl;
-            //return(error_message);
-        //}
+            auto error = result.GetError();
+            if(error)
+            {
+                m_sink.AddFailed(project.GetProjectPath());
+                LogWriter::Instance().Console("Failed " + project.GetProjectPath() + "\n" + project.GetLog());
+                JournalProject(project, meter.ElapsedTime(), error);
+                return (error);
+            }
+        }
+        else
+        {
+            std::this_thread::sleep_for(m_SimulatedDuration);
+        }
 
-        m_converted.emplace_back(project->GetProjectPath());
-        project->SetConverted();
-        std::cout << "Completed" << std::endl;
+        m_sink.AddConverted(project.GetProjectPath());
+        project.SetConverted();
+        LogWriter::Instance().Console("Completed " + project.GetProjectPath() + "\n");
+        JournalProject(project, meter.ElapsedTime(), std::nullopt);
 
         return (std::nullopt);
     }
 
+    //queued is when the project was handed to the pool.
+    std::optional<std::string> RunConversion(ProjectInfo &project, std::chrono::steady_clock::time_point queued)
+    {
+        auto &metrics = Metrics();
+        metrics.m_QueueDepth.Add(-1);
+        metrics.m_wait.Record(std::chrono::duration<double>(std::chrono::steady_clock::now() - queued).count());
+        metrics.m_running.Add(1);
+        try
+        {
+            auto error = ConvertOneProject(project);
+            metrics.m_running.Add(-1);
+            return (error);
+        }
+        catch(...)
+        {
+            metrics.m_running.Add(-1);
+            throw;
+        }
+    }
+
+    //Appends the outcome of the conversion to the journal, and counts it, as soon as it is known.
+    static void JournalProject(const ProjectInfo &project, double duration, const std::optional<std::string> &error)
+    {
+        auto &metrics = Metrics();
+        metrics.m_run.Record(duration);
+        (error ? metrics.m_failed : metrics.m_converted).Increment();
+
+        auto record = nlohmann::ordered_json();
+        record["Phase"] = "Conversion";
+        record["Project"] = project.GetProjectPath();
+        record["Status"] = (error ? "Failed" : "Converted");
+        record["Duration"] = duration;
+        if(error)
+        {
+            record["Error"] = *error;
+        }
+        LogWriter::Instance().Record(std::move(record));
+    }
+
     nlohmann::ordered_json GenerateReport(double elapsed)
     {
         auto dt = HatsDateTime();
         auto elapsed_str = std::to_string(elapsed) + " seconds";
+        auto [converted, failed] = m_sink.Collect();
 
         m_report["Report Date"] = dt.FormatDateTime();
         m_report["Executed in "] = elapsed_str;
-        m_report["Status"] = (m_failed.empty() ? "Success" : "Failed");
-        m_report["Project Count"] = m_converted.size() + m_failed.size();
+        m_report["Status"] = (failed.empty() ? "Success" : "Failed");
+        m_report["Project Count"] = converted.size() + failed.size();
 
         m_report["Completed"] = nlohmann::ordered_json();
         auto &completed_json = m_report["Completed"];
-        completed_json["Count"] = m_converted.size();
-        completed_json["Converted Projects"] = m_converted;
+        completed_json["Count"] = converted.size();
+        completed_json["Converted Projects"] = converted;
 
         m_report["Failed"] = nlohmann::ordered_json();
         auto &failed_json = m_report["Failed"];
-        failed_json["Count"] = m_failed.size();
-        failed_json["Failed Projects"] = m_failed;
+        failed_json["Count"] = failed.size();
+        failed_json["Failed Projects"] = failed;
 
         return (m_report);
     }
 
 public:
     ProjectConverter() = default;
+
+    explicit ProjectConverter(size_t jobs) : m_jobs(std::max<size_t>(jobs, 1))
+    {
+
+    }
+
+    //With an executor, the conversion commands declared in the project files are run.
+    ProjectConverter(size_t jobs,
+                     const std::string &build_folder,
+                     std::shared_ptr<ProcessExecutor> executor) : m_jobs(std::max<size_t>(jobs, 1)),
+                                                                  m_executor(executor),
+                                                                  m_BuildFolder(build_folder)
+    {
+
+    }
+
     ~ProjectConverter() = default;
 
     //One improvement is to separate the processing of the conversion from the caching of last run
     //so that we don't have to reset. But that's a topic for another day.
+    //Conversions are independent of the dependencies among projects, so every project in the map
+    //that isn't converted yet is queued at once, and converted once, up to m_jobs at a time.
     nlohmann::ordered_json Convert(ProjectMapper &project_map)
     {
         Reset();    //Make sure not to add new runs to old ones
+        TRACE_SCOPE("Convert");
 
         auto meter = Meter<std::ratio<1, 1>>();
-        for(auto &[proj_path, project] : project_map)
+        Metrics().m_workers.Set(static_cast<int64_t>(m_jobs));
         {
-            if(project->Status() == ConversionStatus::NotConverted)
+            auto &graph = project_map.GetGraph();
+            auto pool = ThreadPool(m_jobs);
+            for(NodeId node = 0; node < graph.NodeCount(); ++node)
             {
-                ConvertOneProject(project);
+                auto &project = graph.Info(node);
+                if(project.Status() == ConversionStatus::NotConverted)
+                {
+                    Metrics().m_QueueDepth.Add(1);
+                    pool.Submit([this, &project, queued = std::chrono::steady_clock::now()]()
+                    {
+                        RunConversion(project, queued);
+                    });
+                }
             }
+            pool.Wait();
+        }
+        Metrics().m_workers.Set(0);
+        LogWriter::Instance().Flush();  //what the workers printed goes before the summary
 
-            for(auto child_project : project->GetDependencies())
+        auto elapsed_time = meter.ElapsedTime();
+        std::cout << "Conversion completed. Conversion report has been saved to ./output" << std::endl;
+        return (GenerateReport(elapsed_time));
+    }
+
+    //Streaming conversion, see StreamingPipeline: Begin() starts a run, Submit() converts a project
+    //on the pool as soon as it's known, from any thread, and End() waits for every conversion and
+    //returns the report. done is called once the conversion is over, with false if it failed or
+    //threw. An exception doesn't cancel the other conversions as in Convert(): End() rethrows the
+    //first one.
+    void Begin()
+    {
+        Reset();
+        m_error = nullptr;
+        m_meter = Meter<std::ratio<1, 1>>();
+        m_pool = std::make_unique<ThreadPool>(m_jobs);
+        Metrics().m_workers.Set(static_cast<int64_t>(m_jobs));
+    }
+
+    void Submit(ProjectInfo &project, std::function<void(bool)> done)
+    {
+        Metrics().m_QueueDepth.Add(1);
+        m_pool->Submit([this, &project, done = std::move(done), queued = std::chrono::steady_clock::now()]()
+        {
+            auto converted = false;
+            try
             {
-                if(child_project->Status() == ConversionStatus::NotConverted)
+                converted = !RunConversion(project, queued);
+            }
+            catch(...)
+            {
+                auto lock = std::lock_guard<std::mutex>(m_ErrorLock);
+                if(!m_error)
                 {
-                    ConvertOneProject(child_project);
+                    m_error = std::current_exception();
                 }
             }
+            done(converted);
+        });
+    }
+
+    nlohmann::ordered_json End()
+    {
+        m_pool->Wait();
+        m_pool.reset();
+        Metrics().m_workers.Set(0);
+        LogWriter::Instance().Flush();
+        if(m_error)
+        {
+            std::rethrow_exception(m_error);
         }
 
-        auto elapsed_time = meter.ElapsedTime();
+        auto elapsed_time = m_meter.ElapsedTime();
         std::cout << "Conversion completed. Conversion report has been saved to ./output" << std::endl;
         return (GenerateReport(elapsed_time));
     }
 
     [[nodiscard]] nlohmann::ordered_json GetLastReport() const {return (m_report);}
 
+    //How long the simulated conversion of a project without a command takes. Zero makes the tool's
+    //own overhead measurable, as in the benchmarks.
+    void SetSimulatedDuration(std::chrono::milliseconds duration) {m_SimulatedDuration = duration;}
+
     void Reset()
     {
-        m_converted.clear();
-        m_failed.clear();
+        m_sink.Clear();
         m_report.clear();
     }
 };
@@ -14,7 +14,7 @@ namespace Hats::Tools
         std::chrono::time_point<std::chrono::steady_clock> m_start;
 
     public:
-        Meter() : m_start(std::chrono::high_resolution_clock::now())
+        Meter() : m_start(std::chrono::steady_clock::now())
         {
 
         }
@@ -22,7 +22,7 @@ namespace Hats::Tools
 
         double ElapsedTime()
         {
-            auto end = std::chrono::high_resolution_clock::now();
+            auto end = std::chrono::steady_clock::now();
             std::chrono::duration<double, T> m_elapsed = end - m_start;
 
             return (m_elapsed.count());
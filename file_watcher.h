@@ -0,0 +1,189 @@
+#pragma once
+#include <chrono>
+#include <filesystem>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "project_exceptions.h"
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+//Reports the files and folders that change under a set of watched folders, using inotify. Folders
+//are watched recursively, and folders created later are picked up as they appear.
+//Events aren't reported one by one: an editor saving a file, or a checkout touching hundreds of
+//them, produces bursts of events that are collected until the folders have been quiet for a while,
+//and every path that changed in the burst is reported once. What happened to a path is left to the
+//caller to find out from the filesystem, which is the only reliable source once events have been
+//coalesced: a file that exists was created or edited, one that doesn't was removed or moved away.
+//When so many events come at once that the kernel drops some, e.g. on a large checkout, the changes
+//can't be known: the caller is told to look at everything again.
+class FileWatcher
+{
+public:
+    struct Changes
+    {
+        std::vector<std::string> m_paths;   //sorted and without duplicates
+        bool m_rescan {false};              //events were lost: any path under the folders may have changed
+    };
+
+private:
+#if defined(__linux__)
+    static constexpr uint32_t FolderMask {IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MOVED_FROM |
+                                          IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR};
+
+    int m_fd {-1};
+    std::unordered_map<int, std::string> m_folders;    //watch descriptor --> folder
+    bool m_overflowed {false};      //since the last WaitForChanges()
+
+    void AddWatch(const std::string &folder)
+    {
+        auto wd = inotify_add_watch(m_fd, folder.c_str(), FolderMask);
+        if(wd >= 0)
+        {
+            m_folders[wd] = folder;
+        }
+    }
+
+    //Returns false if nothing arrived within the timeout.
+    bool ReadEvents(std::set<std::string> &changes, int timeout_ms)
+    {
+        auto pfd = pollfd {m_fd, POLLIN, 0};
+        if(poll(&pfd, 1, timeout_ms) <= 0)
+        {
+            return (false);
+        }
+
+        alignas(inotify_event) char buffer[64 * 1024];
+        auto size = read(m_fd, buffer, sizeof(buffer));
+        for(ssize_t offset = 0; offset < size; )
+        {
+            auto event = reinterpret_cast<const inotify_event *>(buffer + offset);
+            offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+
+            if(event->mask & IN_Q_OVERFLOW)
+            {
+                m_overflowed = true;    //the queue was full and events were dropped, wd is -1
+                continue;
+            }
+            if(event->mask & IN_IGNORED)
+            {
+                m_folders.erase(event->wd);
+                continue;
+            }
+
+            auto it = m_folders.find(event->wd);
+            if(it == m_folders.end() || event->len == 0)
+            {
+                continue;
+            }
+
+            auto path = (std::filesystem::path(it->second) / event->name).string();
+            if((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)))
+            {
+                //Files created in the folder before the watch is in place are found by the caller
+                //when it looks at the folder.
+                Watch(path);
+            }
+            changes.emplace(path);
+        }
+        return (true);
+    }
+#endif
+
+public:
+    FileWatcher()
+    {
+#if defined(__linux__)
+        m_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+        ThrowIfFalse<BaseException>(m_fd >= 0, "FileWatcher::FileWatcher", "Unable to initialize inotify");
+#else
+        throw(BaseException("FileWatcher::FileWatcher", "Watching folders is only supported on Linux"));
+#endif
+    }
+
+    FileWatcher(const FileWatcher &) = delete;
+    FileWatcher &operator=(const FileWatcher &) = delete;
+
+    ~FileWatcher()
+    {
+#if defined(__linux__)
+        if(m_fd >= 0)
+        {
+            close(m_fd);
+        }
+#endif
+    }
+
+    //Watches the folder and every folder below it.
+    void Watch(const std::string &folder)
+    {
+#if defined(__linux__)
+        auto error = std::error_code();
+        if(!std::filesystem::is_directory(folder, error))
+        {
+            return;
+        }
+
+        AddWatch(folder);
+        for(auto it = std::filesystem::recursive_directory_iterator(folder, error);
+            it != std::filesystem::recursive_directory_iterator(); it.increment(error))
+        {
+            if(error)
+            {
+                break;
+            }
+            if(it->is_directory(error))
+            {
+                AddWatch(it->path().string());
+            }
+        }
+#endif
+    }
+
+    //Watches the folder itself only, e.g. the folder of a project outside the root folder.
+    void WatchFolder(const std::string &folder)
+    {
+#if defined(__linux__)
+        AddWatch(folder);
+#endif
+    }
+
+    //Blocks until something changes, then keeps collecting until nothing has changed for
+    //quiet_period. Returns every path that changed, and whether events were lost on the way, in
+    //which case the folders created meanwhile may not be watched either: the caller has to Watch()
+    //its folders again and look at everything under them.
+    Changes WaitForChanges(std::chrono::milliseconds quiet_period)
+    {
+        auto changes = std::set<std::string>();
+        auto result = Changes();
+#if defined(__linux__)
+        m_overflowed = false;
+        while(!ReadEvents(changes, -1) || (changes.empty() && !m_overflowed))
+        {
+
+        }
+
+        while(ReadEvents(changes, static_cast<int>(quiet_period.count())))
+        {
+
+        }
+        result.m_rescan = m_overflowed;
+#endif
+        result.m_paths.assign(changes.begin(), changes.end());
+        return (result);
+    }
+
+    [[nodiscard]] size_t WatchCount() const
+    {
+#if defined(__linux__)
+        return (m_folders.size());
+#else
+        return (0);
+#endif
+    }
+};
@@ -0,0 +1,400 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//Read-only view of a whole file. On POSIX systems the file is memory-mapped, so opening even a
+//large file costs a single system call and pages are only read when touched. Elsewhere, the file is
+//read into memory.
+class MappedFile
+{
+private:
+    const char *m_data {nullptr};
+    size_t m_size {0};
+    std::vector<char> m_buffer;     //only used when the file can't be mapped
+
+public:
+    explicit MappedFile(const std::filesystem::path &file_path)
+    {
+#ifndef _WIN32
+        auto fd = ::open(file_path.c_str(), O_RDONLY);
+        if(fd < 0)
+        {
+            return;
+        }
+
+        struct stat file_stat {};
+        if(::fstat(fd, &file_stat) == 0 && file_stat.st_size > 0)
+        {
+            auto size = static_cast<size_t>(file_stat.st_size);
+            auto address = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(address != MAP_FAILED)
+            {
+                m_data = static_cast<const char *>(address);
+                m_size = size;
+            }
+        }
+        ::close(fd);
+#else
+        auto s = std::ifstream(file_path, std::ios::in | std::ios::binary);
+        if(s)
+        {
+            m_buffer.assign(std::istreambuf_iterator<char>(s), std::istreambuf_iterator<char>());
+            m_data = m_buffer.data();
+            m_size = m_buffer.size();
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile()
+    {
+#ifndef _WIN32
+        if(m_data != nullptr)
+        {
+            ::munmap(const_cast<char *>(m_data), m_size);
+        }
+#endif
+    }
+
+    [[nodiscard]] const char *Data() const {return (m_data);}
+    [[nodiscard]] size_t Size() const {return (m_size);}
+    [[nodiscard]] bool IsOpen() const {return (m_data != nullptr);}
+};
+
+//The resolved project graph in the shape it is cached in. Nodes are numbered from 0 and their
+//dependencies are stored CSR-style: the dependencies of node n are
+//m_EdgeTargets[m_EdgeOffsets[n] .. m_EdgeOffsets[n + 1]).
+struct GraphSnapshot
+{
+    std::string m_RootFolder;
+    std::vector<std::string> m_folders;         //every folder crawled, used to detect changes
+    std::vector<std::string> m_projects;        //project file of every node
+    std::vector<uint8_t> m_HasParent;
+    std::vector<uint8_t> m_external;            //1 if the project is outside the root folder
+    std::vector<std::string> m_BuildCommands;   //empty if the project doesn't declare one
+    std::vector<std::string> m_ConvertCommands;
+    std::vector<uint32_t> m_CpuSlots;           //declared resources of every node
+    std::vector<uint32_t> m_MemoryMB;
+    std::vector<uint32_t> m_EdgeOffsets;
+    std::vector<uint32_t> m_EdgeTargets;
+    std::vector<uint32_t> m_TopologicalOrder;   //dependencies before the projects that use them
+    uint32_t m_RootProject {0};
+};
+
+//Saves a GraphSnapshot to a compact binary file and loads it back, provided that nothing on disk
+//has changed since. The file is laid out so that it can be used straight from the mapping:
+    //header | string offsets | string bytes | folders | nodes | commands | resources | edge offsets | edge targets | topological order
+//Every path is stored once in the string table and referred to by its index. Every folder and
+//project file is stored with its modification time; a folder's time changes when an entry is added
+//to it or removed from it, and a project file's time changes when it's edited. If any of them
+//differs, the snapshot is stale and the graph has to be mapped again.
+class GraphCache
+{
+private:
+    static constexpr char Magic[8] = {'P', 'B', 'G', 'R', 'A', 'P', 'H', '\0'};
+    static constexpr uint32_t Version {4};
+    static constexpr int64_t Missing {std::numeric_limits<int64_t>::min()};
+
+    struct Header
+    {
+        char m_magic[8];
+        uint32_t m_version;
+        uint32_t m_StringCount;
+        uint64_t m_StringBytes;
+        uint32_t m_FolderCount;
+        uint32_t m_NodeCount;
+        uint32_t m_EdgeCount;
+        uint32_t m_RootProject;
+    };
+
+    struct Entry    //a folder or a node
+    {
+        uint32_t m_PathId;
+        uint32_t m_flags;
+        int64_t m_ModifiedTime;
+    };
+
+    struct Commands //of a node, as string ids
+    {
+        uint32_t m_BuildCommand;
+        uint32_t m_ConvertCommand;
+    };
+
+    struct Resources //of a node
+    {
+        uint32_t m_CpuSlots;
+        uint32_t m_MemoryMB;
+    };
+
+    static constexpr uint32_t HasParentFlag {1};
+    static constexpr uint32_t ExternalFlag {2};
+
+    static size_t Align(size_t size) {return ((size + 7) & ~size_t {7});}
+
+    static int64_t ModifiedTime(const std::string &path)
+    {
+        auto error = std::error_code();
+        auto time = std::filesystem::last_write_time(path, error);
+        return (error ? Missing : static_cast<int64_t>(time.time_since_epoch().count()));
+    }
+
+    //Hands out one index per distinct string
+    class StringTable
+    {
+    private:
+        std::unordered_map<std::string, uint32_t> m_ids;
+        std::vector<uint32_t> m_offsets {0};
+        std::string m_bytes;
+
+    public:
+        uint32_t Intern(const std::string &str)
+        {
+            auto [it, inserted] = m_ids.emplace(str, static_cast<uint32_t>(m_offsets.size() - 1));
+            if(inserted)
+            {
+                m_bytes += str;
+                m_offsets.emplace_back(static_cast<uint32_t>(m_bytes.size()));
+            }
+            return (it->second);
+        }
+
+        [[nodiscard]] const std::vector<uint32_t> &Offsets() const {return (m_offsets);}
+        [[nodiscard]] const std::string &Bytes() const {return (m_bytes);}
+    };
+
+    template <class T>
+    static void Write(std::ofstream &out, const T *data, size_t count)
+    {
+        auto size = sizeof(T) * count;
+        out.write(reinterpret_cast<const char *>(data), static_cast<std::streamsize>(size));
+
+        static const char padding[8] = {};
+        out.write(padding, static_cast<std::streamsize>(Align(size) - size));
+    }
+
+    //Hands out consecutive, aligned sections of the mapped file and remembers if any of them
+    //doesn't fit, which means the file is truncated or corrupt.
+    class Reader
+    {
+    private:
+        const char *m_data;
+        size_t m_size;
+        size_t m_offset {0};
+        bool m_valid {true};
+
+    public:
+        Reader(const char *data, size_t size) : m_data(data), m_size(size)
+        {
+
+        }
+
+        template <class T>
+        const T *Section(size_t count)
+        {
+            auto size = sizeof(T) * count;
+            if(!m_valid || m_offset + size > m_size)
+            {
+                m_valid = false;
+                return (nullptr);
+            }
+
+            auto section = reinterpret_cast<const T *>(m_data + m_offset);
+            m_offset += Align(size);
+            return (section);
+        }
+
+        [[nodiscard]] bool IsValid() const {return (m_valid);}
+    };
+
+public:
+    static void Save(const std::filesystem::path &cache_file, const GraphSnapshot &snapshot)
+    {
+        auto strings = StringTable();
+        strings.Intern(snapshot.m_RootFolder);  //always string 0
+
+        auto folders = std::vector<Entry>();
+        for(auto &folder : snapshot.m_folders)
+        {
+            folders.emplace_back(Entry {strings.Intern(folder), 0, ModifiedTime(folder)});
+        }
+
+        auto nodes = std::vector<Entry>();
+        auto commands = std::vector<Commands>();
+        auto resources = std::vector<Resources>();
+        for(size_t i = 0; i < snapshot.m_projects.size(); ++i)
+        {
+            auto &project = snapshot.m_projects[i];
+            auto flags = (snapshot.m_HasParent[i] ? HasParentFlag : 0) | (snapshot.m_external[i] ? ExternalFlag : 0);
+            nodes.emplace_back(Entry {strings.Intern(project), flags, ModifiedTime(project)});
+            commands.emplace_back(Commands {strings.Intern(snapshot.m_BuildCommands[i]),
+                                            strings.Intern(snapshot.m_ConvertCommands[i])});
+            resources.emplace_back(Resources {snapshot.m_CpuSlots[i], snapshot.m_MemoryMB[i]});
+        }
+
+        auto header = Header();
+        std::memcpy(header.m_magic, Magic, sizeof(Magic));
+        header.m_version = Version;
+        header.m_StringCount = static_cast<uint32_t>(strings.Offsets().size() - 1);
+        header.m_StringBytes = strings.Bytes().size();
+        header.m_FolderCount = static_cast<uint32_t>(folders.size());
+        header.m_NodeCount = static_cast<uint32_t>(nodes.size());
+        header.m_EdgeCount = static_cast<uint32_t>(snapshot.m_EdgeTargets.size());
+        header.m_RootProject = snapshot.m_RootProject;
+
+        //Write to a temporary file first so that a concurrent run never maps a partial file.
+        auto temp_file = cache_file;
+        temp_file += ".tmp";
+        {
+            auto out = std::ofstream(temp_file, std::ios::out | std::ios::binary | std::ios::trunc);
+            Write(out, &header, 1);
+            Write(out, strings.Offsets().data(), strings.Offsets().size());
+            Write(out, strings.Bytes().data(), strings.Bytes().size());
+            Write(out, folders.data(), folders.size());
+            Write(out, nodes.data(), nodes.size());
+            Write(out, commands.data(), commands.size());
+            Write(out, resources.data(), resources.size());
+            Write(out, snapshot.m_EdgeOffsets.data(), snapshot.m_EdgeOffsets.size());
+            Write(out, snapshot.m_EdgeTargets.data(), snapshot.m_EdgeTargets.size());
+            Write(out, snapshot.m_TopologicalOrder.data(), snapshot.m_TopologicalOrder.size());
+        }
+        std::filesystem::rename(temp_file, cache_file);
+    }
+
+    //Returns nothing if the file doesn't exist, was written for a different root folder or another
+    //version, is corrupt, or if any folder or project file has changed since it was written.
+    static std::optional<GraphSnapshot> Load(const std::filesystem::path &cache_file,
+                                             const std::string &root_folder)
+    {
+        auto file = MappedFile(cache_file);
+        if(!file.IsOpen())
+        {
+            return (std::nullopt);
+        }
+
+        auto reader = Reader(file.Data(), file.Size());
+        auto header = reader.Section<Header>(1);
+        if(header == nullptr ||
+           std::memcmp(header->m_magic, Magic, sizeof(Magic)) != 0 ||
+           header->m_version != Version ||
+           header->m_StringCount == 0)
+        {
+            return (std::nullopt);
+        }
+
+        auto string_offsets = reader.Section<uint32_t>(header->m_StringCount + size_t {1});
+        auto string_bytes = reader.Section<char>(header->m_StringBytes);
+        auto folders = reader.Section<Entry>(header->m_FolderCount);
+        auto nodes = reader.Section<Entry>(header->m_NodeCount);
+        auto commands = reader.Section<Commands>(header->m_NodeCount);
+        auto resources = reader.Section<Resources>(header->m_NodeCount);
+        auto edge_offsets = reader.Section<uint32_t>(header->m_NodeCount + size_t {1});
+        auto edge_targets = reader.Section<uint32_t>(header->m_EdgeCount);
+        auto topological_order = reader.Section<uint32_t>(header->m_NodeCount);
+        if(!reader.IsValid())
+        {
+            return (std::nullopt);
+        }
+
+        for(uint32_t i = 0; i < header->m_StringCount; ++i)
+        {
+            if(string_offsets[i] > string_offsets[i + 1] || string_offsets[i + 1] > header->m_StringBytes)
+            {
+                return (std::nullopt);
+            }
+        }
+
+        auto get_string = [&](uint32_t id) -> std::optional<std::string>
+        {
+            if(id >= header->m_StringCount)
+            {
+                return (std::nullopt);
+            }
+            return (std::string(string_bytes + string_offsets[id], string_offsets[id + 1] - string_offsets[id]));
+        };
+
+        if(get_string(0) != root_folder)
+        {
+            return (std::nullopt);
+        }
+
+        auto snapshot = GraphSnapshot();
+        snapshot.m_RootFolder = root_folder;
+        snapshot.m_RootProject = header->m_RootProject;
+
+        for(uint32_t i = 0; i < header->m_FolderCount; ++i)
+        {
+            auto folder = get_string(folders[i].m_PathId);
+            if(!folder || ModifiedTime(*folder) != folders[i].m_ModifiedTime)
+            {
+                return (std::nullopt);
+            }
+            snapshot.m_folders.emplace_back(*folder);
+        }
+
+        for(uint32_t i = 0; i < header->m_NodeCount; ++i)
+        {
+            auto project = get_string(nodes[i].m_PathId);
+            if(!project || ModifiedTime(*project) != nodes[i].m_ModifiedTime)
+            {
+                return (std::nullopt);
+            }
+            auto build_command = get_string(commands[i].m_BuildCommand);
+            auto convert_command = get_string(commands[i].m_ConvertCommand);
+            if(!build_command || !convert_command)
+            {
+                return (std::nullopt);
+            }
+
+            snapshot.m_projects.emplace_back(*project);
+            snapshot.m_HasParent.emplace_back((nodes[i].m_flags & HasParentFlag) != 0);
+            snapshot.m_external.emplace_back((nodes[i].m_flags & ExternalFlag) != 0);
+            snapshot.m_BuildCommands.emplace_back(*build_command);
+            snapshot.m_ConvertCommands.emplace_back(*convert_command);
+            snapshot.m_CpuSlots.emplace_back(resources[i].m_CpuSlots);
+            snapshot.m_MemoryMB.emplace_back(resources[i].m_MemoryMB);
+        }
+
+        if(edge_offsets[0] != 0 || edge_offsets[header->m_NodeCount] != header->m_EdgeCount ||
+           (header->m_NodeCount > 0 && header->m_RootProject >= header->m_NodeCount))
+        {
+            return (std::nullopt);
+        }
+
+        for(uint32_t i = 0; i < header->m_NodeCount; ++i)
+        {
+            if(edge_offsets[i] > edge_offsets[i + 1] || topological_order[i] >= header->m_NodeCount)
+            {
+                return (std::nullopt);
+            }
+        }
+
+        for(uint32_t i = 0; i < header->m_EdgeCount; ++i)
+        {
+            if(edge_targets[i] >= header->m_NodeCount)
+            {
+                return (std::nullopt);
+            }
+        }
+
+        snapshot.m_EdgeOffsets.assign(edge_offsets, edge_offsets + header->m_NodeCount + 1);
+        snapshot.m_EdgeTargets.assign(edge_targets, edge_targets + header->m_EdgeCount);
+        snapshot.m_TopologicalOrder.assign(topological_order, topological_order + header->m_NodeCount);
+        return (snapshot);
+    }
+};
@@ -0,0 +1,344 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "project_exceptions.h"
+#include "project_graph.h"
+
+//A set of nodes of one graph, one bit per node. Unions and intersections go a 64-bit word at a
+//time, in loops that compilers vectorize.
+class NodeSet
+{
+private:
+    std::vector<uint64_t> m_words;
+
+public:
+    explicit NodeSet(size_t node_count) : m_words((node_count + 63) / 64, 0)
+    {
+
+    }
+
+    void Insert(NodeId node) {m_words[node / 64] |= (uint64_t {1} << (node % 64));}
+    [[nodiscard]] bool Contains(NodeId node) const {return ((m_words[node / 64] >> (node % 64)) & 1);}
+
+    NodeSet &operator|=(const NodeSet &rhs)
+    {
+        for(size_t i = 0; i < m_words.size(); ++i)
+        {
+            m_words[i] |= rhs.m_words[i];
+        }
+        return (*this);
+    }
+
+    NodeSet &operator&=(const NodeSet &rhs)
+    {
+        for(size_t i = 0; i < m_words.size(); ++i)
+        {
+            m_words[i] &= rhs.m_words[i];
+        }
+        return (*this);
+    }
+
+    [[nodiscard]] size_t Count() const
+    {
+        auto count = size_t {0};
+        for(auto word : m_words)
+        {
+            count += static_cast<size_t>(__builtin_popcountll(word));
+        }
+        return (count);
+    }
+
+    //In id order.
+    [[nodiscard]] std::vector<NodeId> Nodes() const
+    {
+        auto nodes = std::vector<NodeId>();
+        for(size_t i = 0; i < m_words.size(); ++i)
+        {
+            for(auto word = m_words[i]; word != 0; word &= word - 1)
+            {
+                nodes.emplace_back(static_cast<NodeId>(i * 64 + static_cast<size_t>(__builtin_ctzll(word))));
+            }
+        }
+        return (nodes);
+    }
+};
+
+//Answers questions about a mapped graph without building anything: what a project depends on,
+//what depends on it, how one project comes to depend on another and which projects a set of
+//changed files affects, e.g. to build only those in CI.
+//Dependencies and dependents are walked over the CSR arrays of the graph, both ways, touching only
+//what's reachable. For paths, every node carries a reachability label: LabelBits bits, one of which
+//is set for the node itself, ORed with the labels of its dependencies, a word at a time. A node
+//whose label lacks a bit of the target's label, or that comes before the target in topological
+//order, can't reach it, so the search never enters most of the graph. Construction is linear, and
+//paths are only looked at by the queries that take paths.
+class GraphQuery
+{
+private:
+    static constexpr size_t LabelWords {4};
+    static constexpr size_t LabelBits {LabelWords * 64};
+    using Label = std::array<uint64_t, LabelWords>;
+
+    const ProjectGraph &m_graph;
+    std::vector<uint32_t> m_rank;                                       //position in the topological order
+    std::vector<Label> m_labels;
+    std::unordered_map<std::string, std::vector<NodeId>> m_ByFolder;    //absolute, normalized; built by AffectedBy()
+    std::filesystem::path m_CurrentFolder {std::filesystem::current_path()};
+
+    //Absolute and without . or .. components, without a system call per path, unlike
+    //std::filesystem::absolute().
+    [[nodiscard]] std::filesystem::path Normalize(const std::filesystem::path &path) const
+    {
+        return ((path.is_absolute() ? path : m_CurrentFolder / path).lexically_normal());
+    }
+
+    [[nodiscard]] static std::string_view FileName(std::string_view path)
+    {
+        auto separator = path.find_last_of('/');
+        return (separator == std::string_view::npos ? path : path.substr(separator + 1));
+    }
+
+    //Spreads the ids over the bits, so that neighbouring nodes rarely share one.
+    static size_t LabelBit(NodeId node)
+    {
+        return (static_cast<size_t>((node * uint64_t {0x9E3779B97F4A7C15}) >> 56) % LabelBits);
+    }
+
+    //False if from certainly can't reach to.
+    [[nodiscard]] bool MayReach(NodeId from, NodeId to) const
+    {
+        if(m_rank[from] < m_rank[to])
+        {
+            return (false);
+        }
+
+        auto &from_label = m_labels[from];
+        auto &to_label = m_labels[to];
+        auto missing = uint64_t {0};
+        for(size_t i = 0; i < LabelWords; ++i)
+        {
+            missing |= (to_label[i] & ~from_label[i]);
+        }
+        return (missing == 0);
+    }
+
+    //Everything reachable from the nodes, them included, following dependencies or dependents.
+    template<typename Edges>
+    NodeSet Closure(const std::vector<NodeId> &nodes, Edges edges) const
+    {
+        auto visited = NodeSet(m_graph.NodeCount());
+        auto s = std::vector<NodeId>();
+        for(auto node : nodes)
+        {
+            if(!visited.Contains(node))
+            {
+                visited.Insert(node);
+                s.emplace_back(node);
+            }
+        }
+
+        while(!s.empty())
+        {
+            auto node = s.back();
+            s.pop_back();
+            for(auto next_node : edges(node))
+            {
+                if(!visited.Contains(next_node))
+                {
+                    visited.Insert(next_node);
+                    s.emplace_back(next_node);
+                }
+            }
+        }
+        return (visited);
+    }
+
+public:
+    explicit GraphQuery(const ProjectGraph &graph) : m_graph(graph),
+                                                     m_rank(graph.NodeCount(), 0),
+                                                     m_labels(graph.NodeCount(), Label {})
+    {
+        auto &order = graph.TopologicalOrder();
+        for(size_t i = 0; i < order.size(); ++i)
+        {
+            auto node = order[i];
+            m_rank[node] = static_cast<uint32_t>(i);
+
+            auto &label = m_labels[node];
+            auto bit = LabelBit(node);
+            label[bit / 64] |= (uint64_t {1} << (bit % 64));
+            for(auto child_node : graph.Dependencies(node))
+            {
+                for(size_t w = 0; w < LabelWords; ++w)
+                {
+                    label[w] |= m_labels[child_node][w];
+                }
+            }
+        }
+    }
+
+    GraphQuery(const GraphQuery &) = delete;
+    GraphQuery &operator=(const GraphQuery &) = delete;
+
+    //The project file, by path or, if no other project file has the same name, by name alone.
+    //Only the projects with the same file name are normalized, unless the path is spelled the way
+    //the map has it.
+    [[nodiscard]] NodeId Resolve(const std::string &project) const
+    {
+        auto node = m_graph.Find(project);
+        if(node != InvalidNode)
+        {
+            return (node);
+        }
+
+        auto by_name = std::vector<NodeId>();
+        auto project_path = Normalize(project);
+        auto name = FileName(project);
+        for(NodeId candidate = 0; candidate < m_graph.NodeCount(); ++candidate)
+        {
+            if(FileName(m_graph.Path(candidate)) == name)
+            {
+                if(Normalize(m_graph.Path(candidate)) == project_path)
+                {
+                    return (candidate);
+                }
+                by_name.emplace_back(candidate);
+            }
+        }
+
+        ThrowIfFalse<BaseException>(name == project && !by_name.empty(), "GraphQuery::Resolve", "No project " + project + " in the map");
+        ThrowIfFalse<BaseException>(by_name.size() == 1, "GraphQuery::Resolve", project + " is ambiguous, give its path instead");
+        return (by_name.front());
+    }
+
+    //The projects and everything they depend on, i.e. what building them takes.
+    [[nodiscard]] NodeSet Deps(const std::vector<NodeId> &nodes) const
+    {
+        return (Closure(nodes, [this](NodeId node) {return (m_graph.Dependencies(node));}));
+    }
+
+    //The projects and everything that depends on them, i.e. what changing them affects.
+    [[nodiscard]] NodeSet Rdeps(const std::vector<NodeId> &nodes) const
+    {
+        return (Closure(nodes, [this](NodeId node) {return (m_graph.Dependents(node));}));
+    }
+
+    //A chain of dependencies that leads from one project to the other, both included. Empty if
+    //from doesn't depend on to.
+    [[nodiscard]] std::vector<NodeId> SomePath(NodeId from, NodeId to) const
+    {
+        if(!MayReach(from, to))
+        {
+            return (std::vector<NodeId>());
+        }
+
+        auto visited = NodeSet(m_graph.NodeCount());
+        auto path = std::vector<NodeId> {from};
+        auto next = std::vector<uint32_t> {0};  //index of the next dependency to try, per level
+        visited.Insert(from);
+        while(!path.empty())
+        {
+            auto node = path.back();
+            if(node == to)
+            {
+                return (path);
+            }
+
+            auto dependencies = m_graph.Dependencies(node);
+            auto found = false;
+            while(next.back() < dependencies.size() && !found)
+            {
+                auto child_node = dependencies[next.back()++];
+                if(!visited.Contains(child_node) && MayReach(child_node, to))
+                {
+                    visited.Insert(child_node);
+                    path.emplace_back(child_node);
+                    next.emplace_back(0);
+                    found = true;
+                }
+            }
+            if(!found)
+            {
+                path.pop_back();
+                next.pop_back();
+            }
+        }
+        return (std::vector<NodeId>());
+    }
+
+    //Indexes the projects by folder, for AffectedBy(). Done by its first call, unless called before.
+    void IndexFolders()
+    {
+        if(!m_ByFolder.empty())
+        {
+            return;
+        }
+
+        for(NodeId node = 0; node < m_graph.NodeCount(); ++node)
+        {
+            //Most paths are absolute and normal already, and lexically_normal() is slow.
+            auto &path = m_graph.Path(node);
+            auto is_normal = (!path.empty() && path.front() == '/' &&
+                              path.find("/.") == std::string::npos && path.find("//") == std::string::npos);
+            auto folder = (is_normal ? path.substr(0, path.find_last_of('/')) : Normalize(path).parent_path().string());
+            m_ByFolder[folder].emplace_back(node);
+        }
+    }
+
+    //The projects that own the files and everything that depends on them. A file is owned by the
+    //projects of the innermost folder that holds it and has project files; a project file is owned
+    //by itself. The files that no project owns are returned in unowned.
+    [[nodiscard]] NodeSet AffectedBy(const std::vector<std::string> &changed_files, std::vector<std::string> &unowned)
+    {
+        IndexFolders();
+
+        auto owners = std::vector<NodeId>();
+        for(auto &changed_file : changed_files)
+        {
+            auto path = Normalize(changed_file);
+            auto owned = false;
+            for(auto folder = path.parent_path(); !owned; folder = folder.parent_path())
+            {
+                auto by_folder = m_ByFolder.find(folder.string());
+                if(by_folder != m_ByFolder.end())
+                {
+                    //A project file only affects its own project.
+                    auto project_files = std::vector<NodeId>();
+                    for(auto node : by_folder->second)
+                    {
+                        if(folder == path.parent_path() && FileName(m_graph.Path(node)) == path.filename().string())
+                        {
+                            project_files.emplace_back(node);
+                        }
+                    }
+                    auto &folder_owners = (project_files.empty() ? by_folder->second : project_files);
+                    owners.insert(owners.end(), folder_owners.begin(), folder_owners.end());
+                    owned = true;
+                }
+                if(folder == folder.root_path())
+                {
+                    break;
+                }
+            }
+            if(!owned)
+            {
+                unowned.emplace_back(changed_file);
+            }
+        }
+        return (Rdeps(owners));
+    }
+
+    //Dependencies before the projects that depend on them, i.e. in an order they can be built in.
+    [[nodiscard]] std::vector<NodeId> Ordered(const NodeSet &nodes) const
+    {
+        auto ordered = nodes.Nodes();
+        std::sort(ordered.begin(), ordered.end(), [this](NodeId lhs, NodeId rhs) {return (m_rank[lhs] < m_rank[rhs]);});
+        return (ordered);
+    }
+};
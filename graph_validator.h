@@ -0,0 +1,127 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "project_exceptions.h"
+#include "project_graph.h"
+
+//Cycle detection and topological sorting in a single O(V + E) pass: an iterative depth-first walk
+//that colors every node white (not visited yet), gray (on the current path) or black (done, along
+//with everything below it). Meeting a gray node means the walk came back to a project on its own
+//path, which is a cycle. Nodes turn black in post-order, which is a topological order with every
+//project after all of its dependencies.
+class GraphValidator
+{
+private:
+    enum class Color : uint8_t {White, Gray, Black};
+
+    static std::vector<std::string> CyclePath(const ProjectGraph &graph,
+                                              const std::vector<std::pair<NodeId, uint32_t>> &s,
+                                              NodeId cycle_start)
+    {
+        auto first = s.size();
+        while(first > 0 && s[first - 1].first != cycle_start)
+        {
+            --first;
+        }
+
+        auto cycle = std::vector<std::string>();
+        for(auto i = (first > 0 ? first - 1 : 0); i < s.size(); ++i)
+        {
+            cycle.emplace_back(graph.Path(s[i].first));
+        }
+        cycle.emplace_back(graph.Path(cycle_start));
+        return (cycle);
+    }
+
+    //Depth-first walk from start, following only the dependencies for which follow() is true.
+    //Appends the nodes that turn black to order.
+    template <class Follow>
+    static void Walk(const ProjectGraph &graph,
+                     NodeId start,
+                     std::vector<Color> &colors,
+                     std::vector<NodeId> &order,
+                     Follow follow)
+    {
+        //The stack holds exactly the gray nodes, in path order, each with the index of the next
+        //dependency to visit.
+        auto s = std::vector<std::pair<NodeId, uint32_t>>();
+
+        colors[start] = Color::Gray;
+        s.emplace_back(start, 0);
+        while(!s.empty())
+        {
+            auto &[node, next_child] = s.back();
+            auto dependencies = graph.Dependencies(node);
+            if(next_child == dependencies.size())
+            {
+                colors[node] = Color::Black;
+                order.emplace_back(node);
+                s.pop_back();
+                continue;
+            }
+
+            auto child_node = dependencies[next_child++];
+            if(!follow(child_node))
+            {
+                continue;
+            }
+
+            if(colors[child_node] == Color::White)
+            {
+                colors[child_node] = Color::Gray;
+                s.emplace_back(child_node, 0);
+            }
+            else if(colors[child_node] == Color::Gray)
+            {
+                throw(CircularReferenceException("GraphValidator::SortTopologically",
+                                                 CyclePath(graph, s, child_node)));
+            }
+        }
+    }
+
+public:
+    //Returns every node of the graph, dependencies first. Throws CircularReferenceException with
+    //the full path of the first cycle found.
+    static std::vector<NodeId> SortTopologically(const ProjectGraph &graph)
+    {
+        auto node_count = graph.NodeCount();
+        auto order = std::vector<NodeId>();
+        order.reserve(node_count);
+        auto colors = std::vector<Color>(node_count, Color::White);
+
+        for(NodeId start = 0; start < node_count; ++start)
+        {
+            if(colors[start] == Color::White)
+            {
+                Walk(graph, start, colors, order, [](NodeId) {return (true);});
+            }
+        }
+
+        return (order);
+    }
+
+    //Same as above, for a region of the graph that is closed under dependents, i.e. every project
+    //that depends on a region node is in the region too. Returns the region nodes, dependencies
+    //first. Nodes outside the region keep their relative order and can go before the whole region.
+    //When only the projects in the region changed, every new cycle goes through a changed project
+    //and, from there, only through projects that depend on it, so it's entirely inside the region
+    //and walking the region is enough to find it.
+    static std::vector<NodeId> SortRegion(const ProjectGraph &graph,
+                                          const std::vector<uint8_t> &in_region,
+                                          const std::vector<NodeId> &region)
+    {
+        auto order = std::vector<NodeId>();
+        order.reserve(region.size());
+        auto colors = std::vector<Color>(graph.NodeCount(), Color::White);
+
+        for(auto start : region)
+        {
+            if(colors[start] == Color::White)
+            {
+                Walk(graph, start, colors, order, [&in_region](NodeId node) {return (in_region[node] != 0);});
+            }
+        }
+
+        return (order);
+    }
+};
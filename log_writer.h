@@ -0,0 +1,151 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "json.hpp"
+
+//Writes the console output and the journal of the run on a thread of its own, so that the threads
+//converting and building projects never wait on the console or the disk. Any thread can queue
+//messages; the writer takes everything queued at once and writes it as one batch, with a single
+//flush per batch.
+//Every Console() call is written in one piece, so the lines of a message never interleave with
+//the ones of another thread. Every Record() is one line of json appended to the journal, a JSONL
+//file that grows as projects complete: unlike the reports, which are written at the end, it
+//survives a crash up to the last batch.
+class LogWriter
+{
+private:
+    struct Message
+    {
+        bool m_record {false};  //a journal line rather than console output
+        std::string m_text;
+    };
+
+    std::mutex m_lock;
+    std::condition_variable m_queued;
+    std::condition_variable m_written;
+    std::vector<Message> m_messages;    //protected by m_lock
+    uint64_t m_QueuedCount {0};         //protected by m_lock
+    uint64_t m_WrittenCount {0};        //protected by m_lock
+    bool m_stopping {false};            //protected by m_lock
+    std::ofstream m_journal;            //only opened or closed while the writer is idle, see OpenJournal()
+    std::thread m_thread;
+
+    LogWriter() : m_thread([this]() {Loop();})
+    {
+
+    }
+
+    void Loop()
+    {
+        auto batch = std::vector<Message>();
+        auto console = std::string();
+        auto journal = std::string();
+        while(true)
+        {
+            {
+                auto lock = std::unique_lock<std::mutex>(m_lock);
+                m_queued.wait(lock, [this]() {return (!m_messages.empty() || m_stopping);});
+                if(m_messages.empty())
+                {
+                    return;     //stopping, and everything is written
+                }
+                batch.swap(m_messages);
+            }
+
+            console.clear();
+            journal.clear();
+            for(auto &message : batch)
+            {
+                (message.m_record ? journal : console) += message.m_text;
+            }
+
+            if(!console.empty())
+            {
+                std::cout.write(console.data(), static_cast<std::streamsize>(console.size()));
+                std::cout.flush();
+            }
+            if(!journal.empty() && m_journal.is_open())
+            {
+                m_journal.write(journal.data(), static_cast<std::streamsize>(journal.size()));
+                m_journal.flush();
+            }
+
+            {
+                auto lock = std::lock_guard<std::mutex>(m_lock);
+                m_WrittenCount += batch.size();
+            }
+            m_written.notify_all();
+            batch.clear();
+        }
+    }
+
+    void Queue(bool record, std::string text)
+    {
+        {
+            auto lock = std::lock_guard<std::mutex>(m_lock);
+            m_messages.emplace_back(Message {record, std::move(text)});
+            ++m_QueuedCount;
+        }
+        m_queued.notify_one();
+    }
+
+public:
+    LogWriter(const LogWriter &) = delete;
+    LogWriter &operator=(const LogWriter &) = delete;
+
+    //Writes whatever is still queued.
+    ~LogWriter()
+    {
+        {
+            auto lock = std::lock_guard<std::mutex>(m_lock);
+            m_stopping = true;
+        }
+        m_queued.notify_one();
+        m_thread.join();
+    }
+
+    static LogWriter &Instance()
+    {
+        static auto writer = LogWriter();
+        return (writer);
+    }
+
+    //One or more whole lines, written together.
+    void Console(std::string text)
+    {
+        Queue(false, std::move(text));
+    }
+
+    //Stamped with the time it was queued, in milliseconds since the epoch. Dropped while no
+    //journal is open.
+    void Record(nlohmann::ordered_json record)
+    {
+        auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
+        record["Timestamp"] = now.count();
+        Queue(true, record.dump() + "\n");
+    }
+
+    //Appends the records to journal_file from now on.
+    void OpenJournal(const std::filesystem::path &journal_file)
+    {
+        Flush();
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        m_journal.close();
+        m_journal.open(journal_file, std::ios::out | std::ios::app);
+    }
+
+    //Blocks until everything queued so far is written, e.g. before writing to std::cout directly.
+    void Flush()
+    {
+        auto lock = std::unique_lock<std::mutex>(m_lock);
+        auto target = m_QueuedCount;
+        m_written.wait(lock, [this, target]() {return (m_WrittenCount >= target);});
+    }
+};
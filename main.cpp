@@ -1,6 +1,12 @@
 #include "mapper.h"
 #include "converter.h"
 #include "builder.h"
+#include "file_watcher.h"
+#include "graph_query.h"
+#include "metrics_server.h"
+#include "run_history.h"
+#include "shard_planner.h"
+#include "streaming.h"
 
 std::filesystem::path CreateOutputFolder()
 {
@@ -30,49 +36,750 @@ std::filesystem::path CreateBuildFolder()
     return (out_folder);
 }
 
-void SaveReport(nlohmann::ordered_json &conversion_report, std::filesystem::path &out_folder)
+//The name of the report is the prefix followed by a timestamp, e.g. conversion_report_<timestamp>.json
+void SaveReport(const nlohmann::ordered_json &report, std::filesystem::path &out_folder, const std::string &prefix)
 {
     auto dt = HatsDateTime();
     auto ts = dt.GetTimeStamp();
-    auto fname = std::string("conversion_report_") + std::to_string(ts) + ".json";
+    auto fname = prefix + std::to_string(ts) + ".json";
     auto report_file_path = out_folder / fname;
     auto out_file = std::ofstream(report_file_path, std::ios::out | std::ios::trunc);
-    out_file << conversion_report.dump(4);
+    out_file << report.dump(4);
     out_file.flush();
     out_file.close();
 }
 
-int main(int argc, char *argv[])
+struct RunOptions
+{
+    std::vector<std::string> m_RootFolders;
+    size_t m_jobs {1};
+    size_t m_MaxProcesses {0};      //0: same as m_jobs
+    bool m_rebuild {false};
+    bool m_UseGraphCache {true};
+    std::optional<std::string> m_TraceFile;
+    bool m_watch {false};
+    std::optional<std::string> m_ArtifactCacheFolder;
+    uint64_t m_ArtifactCacheSize {5120};    //MB
+    std::optional<uint32_t> m_CpuSlots;     //detected when not given
+    std::optional<uint64_t> m_MemoryMB;
+    bool m_KeepGoing {false};
+    bool m_stream {false};                  //overlap mapping, conversion and build
+    std::optional<uint16_t> m_WorkerPort;   //run as a build worker
+    std::string m_BindAddress {"127.0.0.1"};    //of the build worker
+    std::optional<std::string> m_TokenFile; //the worker token, PROJECT_BUILDER_WORKER_TOKEN otherwise
+    uint64_t m_MaxPayloadSize {1024};      //MB, of a message between a coordinator and a build worker
+    std::vector<std::string> m_workers;     //host:port of the build workers to use
+    std::vector<std::string> m_query;       //the query and its arguments, e.g. {"rdeps", "sb3_1.proj"}
+    std::optional<uint16_t> m_MetricsPort;  //serve the metrics while the run goes on
+    std::optional<std::pair<uint32_t, uint32_t>> m_shard;    //build shard first of second, from 1
+};
+
+void PrintUsage()
+{
+    std::cout << "Usage: project_builder [--jobs N] [--max-processes N] [--rebuild] [--no-graph-cache] [--trace FILE] [--watch] [--artifact-cache DIR] [--artifact-cache-size MB] [--cpu-slots N] [--memory MB] [--keep-going] [--stream] [--discover-roots DIR] [--workers HOST:PORT,... [--token-file FILE] [--max-payload MB]] [--metrics-port PORT] [--shard I/N] <root folder>..." << std::endl;
+    std::cout << "       project_builder --worker PORT [--bind ADDRESS] [--token-file FILE] [--max-payload MB] [--jobs N]" << std::endl;
+    std::cout << "       project_builder [--no-graph-cache] (--deps PROJECT | --rdeps PROJECT | --somepath FROM TO | --affected-by FILE) <root folder>..." << std::endl;
+    std::cout << "       project_builder stats [--last N] [history file]" << std::endl;
+}
+
+std::optional<RunOptions> ParseArguments(int argc, char *argv[])
 {
-    if(argc != 2)
+    auto options = RunOptions();
+    for(int i = 1; i < argc; ++i)
+    {
+        auto arg = std::string(argv[i]);
+        if(arg == "--jobs" || arg == "-j")
+        {
+            if(i + 1 >= argc)
+            {
+                std::cout << arg << " requires the number of parallel jobs." << std::endl;
+                return (std::nullopt);
+            }
+
+            auto jobs = std::atoi(argv[++i]);
+            if(jobs <= 0)
+            {
+                std::cout << "Invalid number of jobs: " << argv[i] << std::endl;
+                return (std::nullopt);
+            }
+            options.m_jobs = static_cast<size_t>(jobs);
+        }
+        else if(arg == "--max-processes")
+        {
+            auto max_processes = (i + 1 < argc ? std::atoi(argv[++i]) : 0);
+            if(max_processes <= 0)
+            {
+                std::cout << "--max-processes requires a positive number of processes." << std::endl;
+                return (std::nullopt);
+            }
+            options.m_MaxProcesses = static_cast<size_t>(max_processes);
+        }
+        else if(arg == "--rebuild")
+        {
+            options.m_rebuild = true;
+        }
+        else if(arg == "--no-graph-cache")
+        {
+            options.m_UseGraphCache = false;
+        }
+        else if(arg == "--keep-going" || arg == "-k")
+        {
+            options.m_KeepGoing = true;
+        }
+        else if(arg == "--stream")
+        {
+            options.m_stream = true;
+        }
+        else if(arg == "--watch")
+        {
+            options.m_watch = true;
+        }
+        else if(arg == "--trace")
+        {
+            if(i + 1 >= argc)
+            {
+                std::cout << "--trace requires the name of the trace file." << std::endl;
+                return (std::nullopt);
+            }
+            options.m_TraceFile = argv[++i];
+        }
+        else if(arg == "--artifact-cache")
+        {
+            if(i + 1 >= argc)
+            {
+                std::cout << "--artifact-cache requires the cache folder." << std::endl;
+                return (std::nullopt);
+            }
+            options.m_ArtifactCacheFolder = argv[++i];
+        }
+        else if(arg == "--artifact-cache-size")
+        {
+            auto size = (i + 1 < argc ? std::atoll(argv[++i]) : 0);
+            if(size <= 0)
+            {
+                std::cout << "--artifact-cache-size requires a positive size in MB." << std::endl;
+                return (std::nullopt);
+            }
+            options.m_ArtifactCacheSize = static_cast<uint64_t>(size);
+        }
+        else if(arg == "--max-payload")
+        {
+            auto size = (i + 1 < argc ? std::atoll(argv[++i]) : 0);
+            if(size <= 0)
+            {
+                std::cout << "--max-payload requires a positive size in MB." << std::endl;
+                return (std::nullopt);
+            }
+            options.m_MaxPayloadSize = static_cast<uint64_t>(size);
+        }
+        else if(arg == "--cpu-slots")
+        {
+            auto cpu_slots = (i + 1 < argc ? std::atoi(argv[++i]) : 0);
+            if(cpu_slots <= 0)
+            {
+                std::cout << "--cpu-slots requires a positive number of CPU slots." << std::endl;
+                return (std::nullopt);
+            }
+            options.m_CpuSlots = static_cast<uint32_t>(cpu_slots);
+        }
+        else if(arg == "--memory")
+        {
+            auto memory = (i + 1 < argc ? std::atoll(argv[++i]) : -1);
+            if(memory < 0)
+            {
+                std::cout << "--memory requires a size in MB, 0 for unlimited." << std::endl;
+                return (std::nullopt);
+            }
+            options.m_MemoryMB = static_cast<uint64_t>(memory);
+        }
+        else if(arg == "--worker")
+        {
+            auto port = (i + 1 < argc ? std::atoi(argv[++i]) : 0);
+            if(port <= 0 || port > 65535)
+            {
+                std::cout << "--worker requires the port to listen on." << std::endl;
+                return (std::nullopt);
+            }
+            options.m_WorkerPort = static_cast<uint16_t>(port);
+        }
+        else if(arg == "--bind")
+        {
+            if(i + 1 >= argc)
+            {
+                std::cout << "--bind requires the IPv4 address to listen on, 0.0.0.0 for every interface." << std::endl;
+                return (std::nullopt);
+            }
+            options.m_BindAddress = argv[++i];
+        }
+        else if(arg == "--token-file")
+        {
+            if(i + 1 >= argc)
+            {
+                std::cout << "--token-file requires the file that holds the worker token." << std::endl;
+                return (std::nullopt);
+            }
+            options.m_TokenFile = argv[++i];
+        }
+        else if(arg == "--metrics-port")
+        {
+            auto port = (i + 1 < argc ? std::atoi(argv[++i]) : -1);
+            if(port < 0 || port > 65535)
+            {
+                std::cout << "--metrics-port requires the port to serve the metrics on, 0 for any." << std::endl;
+                return (std::nullopt);
+            }
+            options.m_MetricsPort = static_cast<uint16_t>(port);
+        }
+        else if(arg == "--shard")
+        {
+            auto index = 0;
+            auto count = 0;
+            auto end = 0;
+            if(i + 1 >= argc || std::sscanf(argv[i + 1], "%d/%d%n", &index, &count, &end) != 2 ||
+               argv[i + 1][end] != '\0' || index < 1 || index > count)
+            {
+                std::cout << "--shard requires the shard to build and the number of shards, e.g. 2/4." << std::endl;
+                return (std::nullopt);
+            }
+            options.m_shard = std::make_pair(static_cast<uint32_t>(index), static_cast<uint32_t>(count));
+            ++i;
+        }
+        else if(arg == "--workers")
+        {
+            if(i + 1 >= argc)
+            {
+                std::cout << "--workers requires a comma-separated list of host:port." << std::endl;
+                return (std::nullopt);
+            }
+
+            auto s = std::istringstream(argv[++i]);
+            auto endpoint = std::string();
+            while(std::getline(s, endpoint, ','))
+            {
+                if(!endpoint.empty())
+                {
+                    options.m_workers.emplace_back(endpoint);
+                }
+            }
+        }
+        else if(arg == "--deps" || arg == "--rdeps" || arg == "--affected-by")
+        {
+            if(i + 1 >= argc)
+            {
+                std::cout << arg << " requires " << (arg == "--affected-by" ? "a file that lists the changed files, or -"
+                                                                           : "a project file") << "." << std::endl;
+                return (std::nullopt);
+            }
+            options.m_query = {arg.substr(2), argv[++i]};
+        }
+        else if(arg == "--somepath")
+        {
+            if(i + 2 >= argc)
+            {
+                std::cout << "--somepath requires two project files." << std::endl;
+                return (std::nullopt);
+            }
+            options.m_query = {"somepath", argv[i + 1], argv[i + 2]};
+            i += 2;
+        }
+        else if(arg == "--discover-roots")
+        {
+            if(i + 1 >= argc || !std::filesystem::is_directory(argv[i + 1]))
+            {
+                std::cout << "--discover-roots requires the folder that contains the root folders." << std::endl;
+                return (std::nullopt);
+            }
+
+            auto discovered = ProjectMapper::DiscoverRootFolders(argv[++i]);
+            std::cout << "Discovered " << discovered.size() << " root folder(s) in " << argv[i] << std::endl;
+            options.m_RootFolders.insert(options.m_RootFolders.end(), discovered.begin(), discovered.end());
+        }
+        else if(arg.compare(0, 1, "-") != 0)
+        {
+            options.m_RootFolders.emplace_back(arg);
+        }
+        else
+        {
+            std::cout << "Unexpected argument: " << arg << std::endl;
+            return (std::nullopt);
+        }
+    }
+
+    if(options.m_RootFolders.empty() && !options.m_WorkerPort)
     {
         std::cout << "Root folder wasn't provided." << std::endl;
-        return(-1);
+        return (std::nullopt);
+    }
+
+    if(options.m_shard && (options.m_watch || !options.m_query.empty()))
+    {
+        std::cout << "--shard only applies to a single build, not to --watch or a query." << std::endl;
+        return (std::nullopt);
+    }
+
+    return (options);
+}
+
+//One path per line, without the empty lines. "-" reads them from stdin.
+std::vector<std::string> ReadLines(const std::string &file_name)
+{
+    auto file = std::ifstream();
+    if(file_name != "-")
+    {
+        file.open(file_name);
+        ThrowIfFalse<BaseException>(file.is_open(), "ReadLines", "Unable to open " + file_name);
+    }
+
+    auto &s = (file_name == "-" ? std::cin : static_cast<std::istream &>(file));
+    auto lines = std::vector<std::string>();
+    auto line = std::string();
+    while(std::getline(s, line))
+    {
+        if(!line.empty())
+        {
+            lines.emplace_back(line);
+        }
+    }
+    return (lines);
+}
+
+//Prints the answer, one project per line, in an order the projects can be built in, so that it can
+//be piped into other tools, e.g. to build only what a change affects in CI. Everything else goes to
+//stderr. Returns the exit code: a somepath query that finds no path fails.
+int RunQuery(ProjectMapper &mapper, const std::vector<std::string> &query)
+{
+    try
+    {
+        auto &graph = mapper.GetGraph();
+        auto meter = Meter<std::micro>();
+        auto graph_query = GraphQuery(graph);
+        auto index_time = meter.ElapsedTime();
+
+        meter = Meter<std::micro>();
+        auto &kind = query.front();
+        auto result = std::vector<NodeId>();
+        auto unowned = std::vector<std::string>();
+        if(kind == "deps" || kind == "rdeps")
+        {
+            auto node = graph_query.Resolve(query[1]);
+            result = graph_query.Ordered(kind == "deps" ? graph_query.Deps({node}) : graph_query.Rdeps({node}));
+        }
+        else if(kind == "somepath")
+        {
+            result = graph_query.SomePath(graph_query.Resolve(query[1]), graph_query.Resolve(query[2]));
+        }
+        else
+        {
+            result = graph_query.Ordered(graph_query.AffectedBy(ReadLines(query[1]), unowned));
+        }
+        auto query_time = meter.ElapsedTime();
+
+        for(auto node : result)
+        {
+            std::cout << graph.Path(node) << "\n";
+        }
+        std::cout.flush();
+
+        for(auto &file : unowned)
+        {
+            std::cerr << "No project owns " << file << std::endl;
+        }
+        std::cerr << result.size() << " project(s) in " << query_time << " us, index built in "
+                  << index_time << " us" << std::endl;
+        return (kind == "somepath" && result.empty() ? 1 : 0);
+    }
+    catch(const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return (-1);
+    }
+}
+
+//project_builder stats [--last N] [history file]: summarizes the runs recorded in the history file,
+//build/history.jsonl by default.
+int RunStats(int argc, char *argv[])
+{
+    auto last = size_t {20};
+    auto history_file = CreateBuildFolder() / "history.jsonl";
+    for(int i = 2; i < argc; ++i)
+    {
+        auto arg = std::string(argv[i]);
+        if(arg == "--last" && i + 1 < argc && std::atoi(argv[i + 1]) >= 0)
+        {
+            last = static_cast<size_t>(std::atoi(argv[++i]));     //0: all of them
+        }
+        else if(arg.compare(0, 1, "-") != 0)
+        {
+            history_file = arg;
+        }
+        else
+        {
+            PrintUsage();
+            return (-1);
+        }
+    }
+
+    try
+    {
+        RunHistory::Summarize(history_file, last, std::cout);
+        return (0);
+    }
+    catch(const std::exception &e)
+    {
+        std::cout << e.what() << std::endl;
+        return (-1);
+    }
+}
+
+//What the run history records about a run, besides its metrics.
+nlohmann::ordered_json DescribeRun(const RunOptions &options, bool streaming)
+{
+    auto run = nlohmann::ordered_json();
+    run["Roots"] = options.m_RootFolders;
+    run["Jobs"] = options.m_jobs;
+    run["Streaming"] = streaming;
+    return (run);
+}
+
+//Splits the graph into shards and has the builder build only the one given, see ShardPlanner. Its
+//manifest, what it builds and what it imports, is saved to the output folder.
+void PlanShard(ProjectMapper &mapper,
+               ProjectBuilder &builder,
+               std::vector<double> weights,
+               std::filesystem::path &out_folder,
+               const RunOptions &options)
+{
+    auto &graph = mapper.GetGraph();
+    auto [index, count] = *options.m_shard;
+    auto shard = index - 1;
+    auto planner = ShardPlanner(graph, std::move(weights), count);
+    auto manifest = planner.Manifest(shard, [&graph, &builder](NodeId node) {return (builder.GetOutputFolder(graph.Info(node)));});
+    SaveReport(manifest, out_folder, "shard_manifest_");
+
+    auto total_weight = 0.0;
+    for(uint32_t other = 0; other < count; ++other)
+    {
+        total_weight += planner.Weight(other);
+    }
+    std::cout << "Shard " << index << "/" << count << ": " << planner.ProjectCount(shard) << " of " << graph.NodeCount()
+              << " project(s), " << planner.Weight(shard) << " of " << total_weight << " seconds of build time, critical path "
+              << manifest["Critical Path"].get<double>() << " seconds, " << manifest["Imports"].size() << " import(s), stage "
+              << planner.Stage(shard) + 1 << " of " << planner.StageCount() << "; "
+              << planner.CutEdges() << " dependencies cross shards in plan " << planner.GetHash() << std::endl;
+    builder.SetShard(planner.InShard(shard));
+}
+
+void SaveTrace(const RunOptions &options)
+{
+    if(options.m_TraceFile)
+    {
+        Tracer::Instance().WriteChromeTrace(*options.m_TraceFile);
+        std::cout << "Trace saved to " << *options.m_TraceFile << std::endl;
+        Tracer::Instance().PrintUtilization(std::cout);
+    }
+}
+
+//Keeps the map in memory and, whenever project files or folders change, converts and builds only
+//the projects affected by the change. A failure is reported and the watch goes on. Runs until the
+//process is stopped.
+void Watch(ProjectMapper &mapper,
+           ProjectConverter &converter,
+           ProjectBuilder &builder,
+           RunHistory &history,
+           std::filesystem::path &out_folder,
+           const RunOptions &options)
+{
+    auto watcher = FileWatcher();
+    for(auto &root_folder : options.m_RootFolders)
+    {
+        watcher.Watch(root_folder);
+    }
+    while(true)
+    {
+        //Projects outside the root folders are watched through their own folders.
+        auto &graph = mapper.GetGraph();
+        for(NodeId node = 0; node < graph.NodeCount(); ++node)
+        {
+            if(graph.Info(node).IsExternal())
+            {
+                watcher.WatchFolder(std::filesystem::path(graph.Path(node)).parent_path().string());
+            }
+        }
+
+        std::cout << "Watching " << watcher.WatchCount() << " folder(s) for changes..." << std::endl;
+        auto changes = watcher.WaitForChanges(std::chrono::milliseconds(200));
+        if(changes.m_rescan)
+        {
+            //Events were lost, e.g. on a large checkout: the root folders are crawled again, and
+            //every known project file is looked at, to find the ones that are gone.
+            std::cout << "Too many changes at once to follow, looking at every project again" << std::endl;
+            for(auto &root_folder : options.m_RootFolders)
+            {
+                watcher.Watch(root_folder);
+                changes.m_paths.emplace_back(root_folder);
+            }
+            for(NodeId node = 0; node < graph.NodeCount(); ++node)
+            {
+                changes.m_paths.emplace_back(graph.Path(node));
+            }
+        }
+        try
+        {
+            auto update = mapper.Update(changes.m_paths);
+            for(auto &error : update.m_errors)
+            {
+                std::cout << "Unable to update the project map. " << error << std::endl;
+            }
+
+            if(update.m_dirty.empty())
+            {
+                continue;
+            }
+
+            std::cout << update.m_dirty.size() << " project(s) affected by the change" << std::endl;
+            history.Begin();
+            auto conversion_report = converter.Convert(mapper);
+            SaveReport(conversion_report, out_folder, "conversion_report_");
+            builder.Build(mapper);
+            SaveReport(builder.GetLastReport(), out_folder, "build_report_");
+            history.Append(DescribeRun(options, false), builder.GetLastReport());
+        }
+        catch(const std::exception &e)
+        {
+            std::cout << "Unable to update the project map. " << e.what() << std::endl;
+        }
+        SaveTrace(options);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc > 1 && std::string(argv[1]) == "stats")
+    {
+        return (RunStats(argc, argv));
     }
 
-    auto root_folder = std::string(argv[1]);
-    if(!std::filesystem::exists(root_folder))
+    auto options = ParseArguments(argc, argv);
+    if(!options)
     {
-        std::cout << "Invalid root folder. " << root_folder << " isn't found." << std::endl;
+        PrintUsage();
         return(-1);
     }
 
+    //Workers and coordinators share a token, without which a worker serves nobody.
+    auto worker_token = std::string();
+    if(options->m_WorkerPort || !options->m_workers.empty())
+    {
+        try
+        {
+            worker_token = WorkerToken::Load(options->m_TokenFile);
+        }
+        catch(const std::exception &e)
+        {
+            std::cout << e.what() << std::endl;
+            return(-1);
+        }
+        if(worker_token.empty())
+        {
+            std::cout << "Remote builds require the worker token, in --token-file or in "
+                      << WorkerToken::EnvironmentVariable << "." << std::endl;
+            return(-1);
+        }
+    }
+
+    //A worker only runs the build commands a coordinator sends it, until it's stopped.
+    if(options->m_WorkerPort)
+    {
+        try
+        {
+            auto worker = BuildWorker(*options->m_WorkerPort,
+                                      options->m_jobs,
+                                      CreateBuildFolder() / ("worker_" + std::to_string(*options->m_WorkerPort)),
+                                      worker_token,
+                                      options->m_BindAddress);
+            worker.SetMaxPayloadSize(options->m_MaxPayloadSize * 1024 * 1024);
+            std::cout << "Build worker listening on " << options->m_BindAddress << ":" << worker.GetPort() << " with "
+                      << worker.GetSlots() << " slot(s)" << std::endl;
+            worker.Run();
+        }
+        catch(const std::exception &e)
+        {
+            std::cout << e.what() << std::endl;
+            return(-1);
+        }
+        return 0;
+    }
+
+    for(auto &root_folder : options->m_RootFolders)
+    {
+        if(!std::filesystem::exists(root_folder))
+        {
+            std::cout << "Invalid root folder. " << root_folder << " isn't found." << std::endl;
+            return(-1);
+        }
+    }
+
     auto out_folder = CreateOutputFolder();
-    CreateBuildFolder();
+    auto build_folder = CreateBuildFolder();
+
+    if(options->m_TraceFile)
+    {
+        Tracer::Instance().Enable();
+    }
 
     //Mapper has to be called first, obviously. We will let any exception leak and shutdown the run.
-    auto mapper = ProjectMapper(std::filesystem::path{root_folder});
-    mapper.Print();
+    //The graph cache is named after the root folders so that different roots don't evict each other.
+    auto root_folders = options->m_RootFolders;
+    std::sort(root_folders.begin(), root_folders.end());
+    root_folders.erase(std::unique(root_folders.begin(), root_folders.end()), root_folders.end());
+    auto root_hash = ContentHash();
+    for(auto &root_folder : root_folders)
+    {
+        root_hash.Update(std::filesystem::path{root_folder}.string());
+    }
+    auto graph_cache_file = build_folder / ("graph_" + root_hash.ToString() + ".bin");
+    if(!options->m_UseGraphCache)
+    {
+        std::filesystem::remove(graph_cache_file);
+    }
+
+    //Every project is journaled as soon as it is converted or built, for the whole run, watch
+    //included, and every run is added to the history. A query only reads the map: nothing is
+    //converted or built.
+    auto history = RunHistory(build_folder / "history.jsonl");
+    auto metrics_server = std::unique_ptr<MetricsServer>();
+    if(options->m_query.empty())
+    {
+        auto journal_file = out_folder / ("journal_" + std::to_string(HatsDateTime().GetTimeStamp()) + ".jsonl");
+        LogWriter::Instance().OpenJournal(journal_file);
+        history.Begin();
+
+        if(options->m_MetricsPort)
+        {
+            try
+            {
+                metrics_server = std::make_unique<MetricsServer>(*options->m_MetricsPort);
+                std::cout << "Metrics served on http://127.0.0.1:" << metrics_server->GetPort() << "/metrics" << std::endl;
+            }
+            catch(const std::exception &e)
+            {
+                std::cout << e.what() << std::endl;
+                return(-1);
+            }
+        }
+    }
+
+    //Build and conversion commands declared in the project files all run through one executor,
+    //which caps the number of child processes.
+    auto executor = std::make_shared<ProcessExecutor>(options->m_MaxProcesses > 0 ? options->m_MaxProcesses
+                                                                                  : options->m_jobs);
+    auto converter = ProjectConverter(options->m_jobs, build_folder.string(), executor);
 
-    auto converter = ProjectConverter();
-    auto conversion_report = converter.Convert(mapper);
+    //Streaming, projects start converting while the crawl maps the rest of the tree. The pipeline
+    //is declared after the converter, so that it waits for those conversions if the mapping fails.
+    auto streaming = (options->m_stream && options->m_query.empty());
+    auto pipeline = StreamingPipeline(converter);
+    auto mapper = ProjectMapper(root_folders,
+                                options->m_jobs,
+                                graph_cache_file,
+                                streaming ? pipeline.Start() : ProjectMapper::ProjectListener());
 
-    SaveReport(conversion_report, out_folder);
+    if(!options->m_query.empty())
+    {
+        return (RunQuery(mapper, options->m_query));
+    }
+
+    if(mapper.IsFromCache())
+    {
+        std::cout << "Project graph loaded from " << graph_cache_file << std::endl;
+    }
+    std::cout << mapper.GetRootFolders().size() << " root folder(s), "
+              << mapper.GetRootNodes().size() << " root project(s), "
+              << mapper.GetGraph().NodeCount() << " project(s)" << std::endl;
+
+    if(!streaming)
+    {
+        mapper.Print();
+        auto conversion_report = converter.Convert(mapper);
+        SaveReport(conversion_report, out_folder, "conversion_report_");
+        mapper.Print(); //Print the projects and their dependencies again to make sure conversion happened
+    }
+
+    //The state of the last build is kept next to the build output. --rebuild ignores it, but the
+    //state is still recorded for the next run, and the shards are still weighed by it.
+    auto state_store = std::make_shared<BuildStateStore>(build_folder / "build_state.json");
+    auto shard_weights = (options->m_shard ? ShardPlanner::EstimateWeights(mapper.GetGraph(), state_store.get())
+                                           : std::vector<double>());
+    if(options->m_rebuild)
+    {
+        state_store->Clear();
+    }
+
+    //With build workers, there is a thread per slot of theirs and the budget is theirs too, unless
+    //it's given.
+    auto remote_executor = std::shared_ptr<RemoteExecutor>();
+    auto build_jobs = options->m_jobs;
+    if(!options->m_workers.empty())
+    {
+        try
+        {
+            remote_executor = std::make_shared<RemoteExecutor>(options->m_workers, worker_token);
+            remote_executor->SetMaxPayloadSize(options->m_MaxPayloadSize * 1024 * 1024);
+        }
+        catch(const std::exception &e)
+        {
+            std::cout << e.what() << std::endl;
+            return(-1);
+        }
+        build_jobs = std::max(build_jobs, remote_executor->GetSlots());
+        std::cout << "Building on " << remote_executor->GetWorkerCount() << " build worker(s) with "
+                  << remote_executor->GetSlots() << " slot(s)" << std::endl;
+    }
+
+    auto builder = ProjectBuilder(build_jobs, build_folder.string(), state_store, executor);
+    if(remote_executor)
+    {
+        builder.SetRemoteExecutor(remote_executor);
+        builder.SetResourceBudget(ResourceBudget {static_cast<uint32_t>(remote_executor->GetSlots()), 0});
+    }
+    if(options->m_ArtifactCacheFolder)
+    {
+        builder.SetArtifactCache(std::make_shared<ArtifactCache>(*options->m_ArtifactCacheFolder,
+                                                                 options->m_ArtifactCacheSize * 1024 * 1024));
+    }
+
+    auto budget = builder.GetResourceBudget();
+    budget.m_CpuSlots = options->m_CpuSlots.value_or(budget.m_CpuSlots);
+    budget.m_MemoryMB = options->m_MemoryMB.value_or(budget.m_MemoryMB);
+    builder.SetResourceBudget(budget);
+    builder.SetKeepGoing(options->m_KeepGoing);
+    if(options->m_shard)
+    {
+        PlanShard(mapper, builder, std::move(shard_weights), out_folder, *options);
+    }
+
+    //Streaming, conversions are still running: every project builds as soon as it's converted.
+    auto succeeded = (streaming ? pipeline.Build(mapper, builder) : builder.Build(mapper));
+    if(streaming)
+    {
+        SaveReport(converter.GetLastReport(), out_folder, "conversion_report_");
+        mapper.Print();
+    }
+    SaveReport(builder.GetLastReport(), out_folder, "build_report_");
+    std::cout << "Build report has been saved to " << out_folder << std::endl;
+    history.Append(DescribeRun(*options, streaming), builder.GetLastReport());
+
+    //A failed build is when the trace is needed the most.
+    SaveTrace(*options);
 
-    mapper.Print(); //Print the projects and their dependencies again to make sure conversion happened
+    if(options->m_watch)
+    {
+        Watch(mapper, converter, builder, history, out_folder, *options);
+    }
 
-    auto root = mapper.GetRootProject();
-    auto builder = ProjectBuilder();
-    builder.Build(root);
+    if(!succeeded)
+    {
+        return(-1);
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -1,25 +1,53 @@
 #pragma once
-#include <stack>
-#include <map>
-#include <regex>
-#include <set>
+#include <algorithm>
+#include <mutex>
+#include <unordered_set>
 #include "json.hpp"
 #include "common_types.h"
 #include "project_exceptions.h"
+#include "graph_cache.h"
+#include "graph_validator.h"
+#include "object_arena.h"
+#include "project_graph.h"
+#include "project_parser.h"
+#include "thread_pool.h"
+#include "trace.h"
 
 class ProjectMapper
 {
+public:
+    //Called from the crawler threads with every project whose file was just parsed, while the rest
+    //of the tree is still being mapped. The project's commands are set; its node id isn't yet.
+    using ProjectListener = std::function<void(ProjectInfo &)>;
+
 private:
+    static constexpr std::string_view ProjectSuffix {".proj"};
+
     using FolderInfoType = std::pair<std::vector<std::string>, std::optional<std::string>>;
-    using CacheIteratorType = std::map<std::string, std::shared_ptr<ProjectInfo>>::iterator;
 
-    std::filesystem::path m_RootFolderPath;
-    std::map<std::string, std::shared_ptr<ProjectInfo>> m_ProjectCache;
-    std::shared_ptr<ProjectInfo> m_RootProject {nullptr};
+    //Every project file is resolved against the root folder it's in, see RootFolderOf(). Roots
+    //are kept sorted, so that a map of the same roots is the same whatever order they came in.
+    std::vector<std::string> m_RootFolders;
+
+    //The project cache: every project path is interned once in m_paths, and its id indexes
+    //m_ProjectCache, which holds the node, or nullptr once the project is gone. The nodes
+    //themselves are allocated from m_arena.
+    PathTable m_paths;
+    ObjectArena<ProjectInfo> m_arena;
+    std::vector<ProjectInfo *> m_ProjectCache;
+    std::mutex m_CacheLock;     //guards the cache, m_folders and m_ExternalQueue while the crawl is running
+    std::vector<std::string> m_ExternalQueue;   //external projects referenced but not loaded yet
+    std::vector<std::string> m_folders;
+    ProjectGraph m_graph {m_paths};     //index-based view of the cache used by every traversal
+    std::vector<NodeId> m_RootNodes;    //the projects nothing depends on, in node order
+    bool m_FromCache {false};
+    bool m_NeedsFullValidation {false};     //the last update left a cycle in the graph
+    std::vector<ProjectInfo *> m_PendingChanges;    //changed by that update
+    ProjectListener m_OnProjectLoaded;              //while the constructor maps the folders only
 
     FolderInfoType GetSubfolders(const std::string &folder)
     {
-        auto file_pattern = std::regex(".*\\.proj$");
+        TRACE_SCOPE("GetSubfolders", folder);
 
         auto sub_folders = std::vector<std::string>();
         auto p = std::filesystem::path {folder};
@@ -34,7 +62,9 @@ private:
             }
             else if(dir_entry.is_regular_file())
             {
-                if (std::regex_match(name.string(), file_pattern))
+                auto &file_name = name.native();
+                if(file_name.size() >= ProjectSuffix.size() &&
+                   file_name.compare(file_name.size() - ProjectSuffix.size(), ProjectSuffix.size(), ProjectSuffix) == 0)
                 {
                     ThrowIfFalse<MapperException>(!project_file,
                                                   "ProjectMapper::GetSubfolders",
@@ -47,28 +77,128 @@ private:
         return (std::pair {sub_folders, project_file});
     }
 
-    std::vector<std::string> Load(const std::string &proj_file)
+    //One parser per crawler thread: it reuses its buffers from one project file to the next, so
+    //after the first few files, parsing allocates next to nothing. The result is valid until the
+    //thread loads its next file.
+    const ProjectFileData &Load(const std::string &proj_file)
     {
+        TRACE_SCOPE("Load", proj_file);
+
         ThrowIfFalse<MapperException>(std::filesystem::exists(proj_file),
                                       "ProjectMapper::Load",
                                       std::string("Invalid project file: ") + proj_file);
 
-        auto dependencies = std::vector<std::string>();
+        static thread_local auto parser = ProjectFileParser();
+        return (parser.Parse(proj_file, RootFolderOf(proj_file)));
+    }
 
-        auto s = std::ifstream(proj_file);
-        auto project_config = nlohmann::json::parse(s);
-        for(auto &reference : project_config["References"])
+    static bool IsUnder(std::string_view path, const std::string &folder)
+    {
+        return (path.size() > folder.size() &&
+                path.compare(0, folder.size(), folder) == 0 &&
+                (folder.back() == '/' || path[folder.size()] == '/'));
+    }
+
+    [[nodiscard]] bool IsUnderRoot(std::string_view project_path) const
+    {
+        return (std::any_of(m_RootFolders.begin(), m_RootFolders.end(), [&](auto &root_folder)
         {
-            auto absolute_path = m_RootFolderPath / reference["Relative Path"];
-            dependencies.emplace_back(absolute_path);
+            return (IsUnder(project_path, root_folder));
+        }));
+    }
+
+    //The references of a project file are relative to the innermost root folder it's in. Those of
+    //an external project, in none of them, are relative to the first root folder.
+    [[nodiscard]] const std::string &RootFolderOf(std::string_view project_path) const
+    {
+        auto root_folder = &m_RootFolders.front();
+        auto found = false;
+        for(auto &folder : m_RootFolders)
+        {
+            if(IsUnder(project_path, folder) && (!found || folder.size() > root_folder->size()))
+            {
+                root_folder = &folder;
+                found = true;
+            }
         }
-        return (dependencies);
+        return (*root_folder);
     }
 
-    std::vector<std::string> LoadExternalDependency(const std::string &proj_file)
+    //The graph cache is keyed on the root folders, one per line.
+    [[nodiscard]] std::string RootKey() const
     {
-        auto dependencies = std::vector<std::string>();
-        return (dependencies);
+        auto root_key = std::string();
+        for(auto &root_folder : m_RootFolders)
+        {
+            root_key += (root_key.empty() ? "" : "\n") + root_folder;
+        }
+        return (root_key);
+    }
+
+    void SetRootFolders(const std::vector<std::string> &root_folders)
+    {
+        ThrowIfFalse<MapperException>(!root_folders.empty(), "ProjectMapper::SetRootFolders", "No root folder");
+        for(auto &root_folder : root_folders)
+        {
+            ThrowIfFalse<MapperException>(std::filesystem::exists(root_folder),
+                                          "ProjectMapper::SetRootFolders",
+                                          "Root folder not found: " + root_folder);
+            m_RootFolders.emplace_back(std::filesystem::path(root_folder).string());
+        }
+
+        std::sort(m_RootFolders.begin(), m_RootFolders.end());
+        m_RootFolders.erase(std::unique(m_RootFolders.begin(), m_RootFolders.end()), m_RootFolders.end());
+    }
+
+    [[nodiscard]] ProjectInfo *FindProject(std::string_view project_path) const
+    {
+        auto path_id = m_paths.Find(project_path);
+        return (path_id < m_ProjectCache.size() ? m_ProjectCache[path_id] : nullptr);
+    }
+
+    //Returns the node of a project, creating it if this is the first time it's seen. Must be called
+    //with the lock held.
+    ProjectInfo *AddProject(std::string_view project_path, bool has_parent, bool &created)
+    {
+        auto path_id = m_paths.Intern(project_path);
+        if(path_id >= m_ProjectCache.size())
+        {
+            m_ProjectCache.resize(m_paths.Size(), nullptr);
+        }
+
+        auto &project = m_ProjectCache[path_id];
+        created = (project == nullptr);
+        if(created)
+        {
+            project = m_arena.Create(m_paths, path_id, has_parent);
+        }
+        else if(has_parent)
+        {
+            //The dependency may have been crawled before any of its parents.
+            project->SetHasParent();
+        }
+        return (project);
+    }
+
+    //Projects taken out of the cache go back to the arena, to be reused for the next new project.
+    void ReleaseProjects(const std::vector<ProjectInfo *> &removed)
+    {
+        for(auto project : removed)
+        {
+            m_arena.Release(project);
+        }
+    }
+
+    template<typename Function>
+    void ForEachProject(Function function) const
+    {
+        for(auto project : m_ProjectCache)
+        {
+            if(project)
+            {
+                function(project);
+            }
+        }
     }
 
     //This function builds the dependency graph one step at a time as it encounters the nodes:
@@ -77,164 +207,623 @@ private:
         //- If the project is already in the cache and its dependency count == 0, the dependencies
         //  are added.
         //- A project that exists in the cache is never re-created. That is, if A and B have C as
-        //  dependency, both point to the same C, hence, the shared_ptr.
-    void UpdateCache(const std::string &file_path)
+        //  dependency, both point to the same C.
+    //The project file is parsed by the caller, outside the lock, so only the merge is serialized.
+    ProjectInfo *UpdateCache(const std::string &file_path, const ProjectFileData &project_data)
     {
-        auto project_info = std::shared_ptr<ProjectInfo> {nullptr};
+        TRACE_SCOPE("UpdateCache", file_path);     //includes waiting for the lock
+        auto lock = std::lock_guard<std::mutex>(m_CacheLock);
 
-        if(m_ProjectCache.find(file_path) == m_ProjectCache.end())
+        auto created = false;
+        auto project_info = AddProject(file_path, false, created);
+        project_info->SetCommands(project_data.m_BuildCommand, project_data.m_ConvertCommand);
+        project_info->SetResources(project_data.m_CpuSlots, project_data.m_MemoryMB);
+        if(!project_info->HasDependency())
         {
-            project_info = std::make_shared<ProjectInfo>(file_path);
-            m_ProjectCache[file_path] = project_info;
+            for(auto dependency : project_data.m_dependencies)
+            {
+                project_info->AddDependency(AddProject(dependency, true, created));
+            }
+
+            //An external project is outside the root folder, so the crawl won't get to it. It's
+            //queued to be loaded once the crawl is done.
+            for(auto dependency : project_data.m_ExternalDependencies)
+            {
+                auto child_project = AddProject(dependency, true, created);
+                if(created && !IsUnderRoot(dependency))
+                {
+                    child_project->SetExternal();
+                    m_ExternalQueue.emplace_back(dependency);
+                }
+                project_info->AddDependency(child_project);
+            }
         }
-        else
+        return (project_info);
+    }
+
+    //Loads the external projects referenced during the crawl, and the ones they reference in turn.
+    void LoadExternalProjects()
+    {
+        while(!m_ExternalQueue.empty())
         {
-            project_info = m_ProjectCache[file_path];
+            auto proj_file = m_ExternalQueue.back();
+            m_ExternalQueue.pop_back();
+            auto project = UpdateCache(proj_file, Load(proj_file));
+            if(m_OnProjectLoaded)
+            {
+                m_OnProjectLoaded(*project);
+            }
         }
+    }
 
-        if(!project_info->HasDependency())
+    //Numbers the projects in path order and lays their dependencies out in a ProjectGraph, so that
+    //the node ids, and everything printed or reported in node order, don't depend on the order in
+    //which the crawl found the projects. Crawling needs the pointer-based nodes; everything after
+    //it runs on the graph.
+    void BuildGraph()
+    {
+        m_graph.Clear();
+
+        auto projects = std::vector<ProjectInfo *>();
+        ForEachProject([&projects](ProjectInfo *project) {projects.emplace_back(project);});
+        std::sort(projects.begin(), projects.end(), [](auto a, auto b) {return (a->GetProjectPath() < b->GetProjectPath());});
+
+        auto node = NodeId {0};
+        for(auto project : projects)
+        {
+            project->SetId(node++);
+        }
+
+        auto dependencies = std::vector<NodeId>();
+        for(auto project : projects)
         {
-            auto dependency_files = Load(file_path);
-            for (auto &dependency: dependency_files)
+            dependencies.clear();
+            for(auto child_project : project->GetDependencies())
             {
-                if (m_ProjectCache.find(dependency) == m_ProjectCache.end())
-                {
-                    auto child_project = std::make_shared<ProjectInfo>(dependency,
-                                                                                            true);
-                    project_info->AddDependency(child_project);
-                    m_ProjectCache[dependency] = child_project;
-                }
-                else
-                {
-                    project_info->AddDependency(m_ProjectCache[dependency]);
-                }
+                dependencies.emplace_back(child_project->GetId());
             }
+            m_graph.AddNode(project->GetPathId(), project, dependencies);
         }
+        m_graph.Finalize();
     }
 
-    void FindRootProject()
+    //Every project that no other project depends on is a root: the top of a solution. Several root
+    //folders usually have one each, but a single root folder may well have more than one.
+    void FindRootProjects()
     {
-        for(auto &[file_name, project] : m_ProjectCache)
+        m_RootNodes.clear();
+        for(NodeId node = 0; node < m_graph.NodeCount(); ++node)
         {
-            if(!project->HasParent())
+            if(m_graph.Dependents(node).empty())
             {
-                m_RootProject = project;
-                return;
+                m_RootNodes.emplace_back(node);
             }
         }
     }
 
     //Make sure that there are no circular references that hinders the build:
     // directly or indirectly having a path such that A --> B and B --> A
+    //Every project is visited once, so this is linear in the number of projects and references.
+    //The topological order it produces is kept in the graph for the converter and the builder.
     void ValidateStructure()
     {
-        auto s = std::stack<std::shared_ptr<ProjectInfo>>();
-        s.push(m_RootProject);
+        TRACE_SCOPE("ValidateStructure");
+        m_graph.SetTopologicalOrder(GraphValidator::SortTopologically(m_graph));
+    }
+
+    //Every folder is a task on the pool: it enumerates its entries, submits its sub-folders as new
+    //tasks and parses its project file, if any, before merging it into the cache.
+    void CrawlFolder(ThreadPool &pool, const std::string &folder)
+    {
+        {
+            auto lock = std::lock_guard<std::mutex>(m_CacheLock);
+            m_folders.emplace_back(folder);
+        }
+
+        auto folder_data = GetSubfolders(folder);
+        for(auto &f : folder_data.first)
+        {
+            pool.Submit([this, &pool, f]() {CrawlFolder(pool, f);});
+        }
+
+        if(folder_data.second.has_value())
+        {
+            auto &project_data = Load(*folder_data.second);
+            auto project = UpdateCache(*folder_data.second, project_data);
+            if(m_OnProjectLoaded)
+            {
+                m_OnProjectLoaded(*project);
+            }
+        }
+    }
+
+    //Assume no virtual folders or symlinks that create a cycle
+    //All the root folders are crawled at once, on the same pool, into the same cache, so a project
+    //that several roots reference is mapped, and later converted and built, once. A root folder
+    //inside another one is crawled as part of it.
+    void BuildMap(size_t jobs)
+    {
+        auto pool = ThreadPool(jobs);
+        for(auto &root_folder : m_RootFolders)
+        {
+            if(!IsUnderRoot(root_folder))
+            {
+                pool.Submit([this, &pool, root_folder]() {CrawlFolder(pool, root_folder);});
+            }
+        }
+
+        //The first exception thrown by any of the tasks cancels the crawl and is rethrown here.
+        pool.Wait();
+    }
+
+    void MapFolders(size_t jobs)
+    {
+        TRACE_SCOPE("MapFolders");
+        BuildMap(jobs);
+        LoadExternalProjects();
+        BuildGraph();
+        FindRootProjects();
+        ValidateStructure();
+    }
+
+    //Parses the project file again and replaces its dependencies and commands. If the file can't
+    //be parsed, the exception leaves the project as it was.
+    void ReloadProject(const std::string &proj_file, std::vector<ProjectInfo *> &changed)
+    {
+        auto &project_data = Load(proj_file);
+        auto project = FindProject(proj_file);
+        if(project)
+        {
+            project->ClearDependencies();
+        }
+        UpdateCache(proj_file, project_data);
+        changed.emplace_back(FindProject(proj_file));
+    }
+
+    //A folder that appeared, e.g. created or moved under the root folder.
+    void CrawlNewFolder(const std::string &folder, std::vector<ProjectInfo *> &changed)
+    {
+        if(std::find(m_folders.begin(), m_folders.end(), folder) == m_folders.end())
+        {
+            m_folders.emplace_back(folder);
+        }
+
+        auto folder_data = GetSubfolders(folder);
+        if(folder_data.second)
+        {
+            ReloadProject(*folder_data.second, changed);
+        }
+
+        for(auto &f : folder_data.first)
+        {
+            CrawlNewFolder(f, changed);
+        }
+    }
 
-        //Keep track of parents. std::set keeps a sorted list
-        auto parent_map = std::map<std::string, std::set<std::string>>();
+    //Everything that was under a folder that is gone. There are no events for its contents when
+    //the folder is moved away rather than deleted, so the projects are found by their path.
+    void RemoveFolder(const std::string &folder, std::vector<std::string> &removed_files)
+    {
+        auto prefix = folder + "/";
+        m_folders.erase(std::remove_if(m_folders.begin(), m_folders.end(), [&](auto &f)
+        {
+            return (f == folder || f.compare(0, prefix.size(), prefix) == 0);
+        }), m_folders.end());
 
-        while(!s.empty())
+        ForEachProject([&](ProjectInfo *project)
         {
-            auto project = s.top();
-            s.pop();
-            auto proj_it = parent_map.find(project->GetProjectPath());
-            if(proj_it != parent_map.end())
+            if(project->GetProjectPath().compare(0, prefix.size(), prefix) == 0)
             {
-                //remember to remove the parent bookmark at the same time as popping the stack
-                parent_map.erase(proj_it);
+                removed_files.emplace_back(project->GetProjectPath());
             }
+        });
+    }
 
-            auto child_nodes = project->GetDependencies();
-            for(auto child_node : child_nodes)
+    //A project whose file is gone is dropped from the map, unless other projects still reference
+    //it. In that case it stays, without dependencies, as it would have if it had never existed.
+    //The removed projects are taken out of the cache but stay valid until the caller releases them.
+    void RemoveProjects(const std::vector<std::string> &removed_files,
+                        std::vector<ProjectInfo *> &changed,
+                        std::vector<ProjectInfo *> &removed)
+    {
+        auto candidates = std::unordered_set<const ProjectInfo *>();
+        for(auto &proj_file : removed_files)
+        {
+            auto project = FindProject(proj_file);
+            if(project && !std::filesystem::exists(proj_file))
             {
-                s.push(child_node);
+                project->ClearDependencies();
+                project->SetCommands("", "");
+                project->SetResources(1, 0);
+                candidates.emplace(project);
+            }
+        }
 
-                auto proj_path = child_node->GetProjectPath();
-                if(parent_map.find(proj_path) == parent_map.end())  //if not found
+        auto referenced = std::unordered_set<const ProjectInfo *>();
+        ForEachProject([&](ProjectInfo *project)
+        {
+            for(auto child_project : project->GetDependencies())
+            {
+                if(candidates.count(child_project) > 0)
                 {
-                    parent_map[proj_path] = std::set<std::string>();
-                    parent_map[proj_path].emplace(project->GetProjectPath());
+                    referenced.emplace(child_project);
                 }
-                else
-                {
-                    //Check if the same parent has been encountered before. This can only happen
-                    //if there is a circular path that leads back to the same parent.
-                    auto parents = parent_map[proj_path];
-                    auto it = parents.find(project->GetProjectPath());
-                    ThrowIfFalse<MapperException>(it == parents.end(),
-                                                  "ProjectMapper::BuildMap",
-                                                  "The projects have a circular reference, which is not allowed");
+            }
+        });
 
+        for(auto &proj_file : removed_files)
+        {
+            auto project = FindProject(proj_file);
+            if(!project || candidates.count(project) == 0)
+            {
+                continue;
+            }
 
-                }
+            if(referenced.count(project) > 0)
+            {
+                changed.emplace_back(project);
+            }
+            else
+            {
+                removed.emplace_back(project);
+                m_ProjectCache[project->GetPathId()] = nullptr;
             }
         }
     }
 
-    //Assume no virtual folders or symlinks that create a cycle
-    void BuildMap()
+    [[nodiscard]] GraphSnapshot CreateSnapshot() const
     {
-        auto s = std::stack<std::string>();
-        s.push(m_RootFolderPath);
+        auto snapshot = GraphSnapshot();
+        snapshot.m_RootFolder = RootKey();
+        snapshot.m_folders = m_folders;
+        std::sort(snapshot.m_folders.begin(), snapshot.m_folders.end());
 
-        while(!s.empty())
+        for(NodeId node = 0; node < m_graph.NodeCount(); ++node)
         {
-            auto folder = s.top();
-            s.pop();
+            snapshot.m_projects.emplace_back(m_graph.Path(node));
+            snapshot.m_HasParent.emplace_back(m_graph.Info(node).HasParent());
+            snapshot.m_external.emplace_back(m_graph.Info(node).IsExternal());
+            snapshot.m_BuildCommands.emplace_back(m_graph.Info(node).GetBuildCommand());
+            snapshot.m_ConvertCommands.emplace_back(m_graph.Info(node).GetConvertCommand());
+            snapshot.m_CpuSlots.emplace_back(m_graph.Info(node).GetCpuSlots());
+            snapshot.m_MemoryMB.emplace_back(m_graph.Info(node).GetMemoryMB());
+        }
+
+        snapshot.m_EdgeOffsets = m_graph.DependencyOffsets();
+        snapshot.m_EdgeTargets = m_graph.DependencyTargets();
+        snapshot.m_TopologicalOrder = m_graph.TopologicalOrder();
+        snapshot.m_RootProject = (m_RootNodes.empty() ? 0 : m_RootNodes.front());
+        return (snapshot);
+    }
 
-            auto folder_data = GetSubfolders(folder);
-            if(folder_data.second.has_value())
+    void RestoreSnapshot(const GraphSnapshot &snapshot)
+    {
+        auto nodes = std::vector<ProjectInfo *>();
+        nodes.reserve(snapshot.m_projects.size());
+        for(size_t i = 0; i < snapshot.m_projects.size(); ++i)
+        {
+            auto created = false;
+            nodes.emplace_back(AddProject(snapshot.m_projects[i], snapshot.m_HasParent[i] != 0, created));
+            nodes.back()->SetCommands(snapshot.m_BuildCommands[i], snapshot.m_ConvertCommands[i]);
+            nodes.back()->SetResources(snapshot.m_CpuSlots[i], snapshot.m_MemoryMB[i]);
+            if(snapshot.m_external[i])
             {
-                UpdateCache(*folder_data.second);
+                nodes.back()->SetExternal();
             }
-            for(auto &f : folder_data.first)
+        }
+
+        for(size_t i = 0; i < nodes.size(); ++i)
+        {
+            for(auto e = snapshot.m_EdgeOffsets[i]; e < snapshot.m_EdgeOffsets[i + 1]; ++e)
             {
-                s.push(f);
+                nodes[i]->AddDependency(nodes[snapshot.m_EdgeTargets[e]]);
             }
         }
+
+        //The snapshot was written in node order, i.e. path order, so the node ids come out the same.
+        BuildGraph();
+        m_graph.SetTopologicalOrder(snapshot.m_TopologicalOrder);
+
+        m_folders = snapshot.m_folders;
+        FindRootProjects();
     }
 
 public:
-    explicit ProjectMapper(const std::string &root_folder) : m_RootFolderPath(root_folder)
+    //jobs is the number of threads that crawl the folders and parse the project files.
+    //Several root folders, e.g. the solutions of a monorepo, are mapped into a single graph.
+    //on_loaded, if any, is told about every project as soon as it's parsed, see ProjectListener.
+    explicit ProjectMapper(const std::vector<std::string> &root_folders,
+                           size_t jobs = 1,
+                           ProjectListener on_loaded = nullptr) : m_OnProjectLoaded(std::move(on_loaded))
+    {
+        SetRootFolders(root_folders);
+        MapFolders(jobs);
+        m_OnProjectLoaded = nullptr;
+    }
+
+    explicit ProjectMapper(const std::string &root_folder, size_t jobs = 1) :
+                                                        ProjectMapper(std::vector<std::string> {root_folder}, jobs)
     {
-        ThrowIfFalse<MapperException>(std::filesystem::exists(root_folder),
-                                      "ProjectMapper::ProjectMapper",
-                                      "Root folder not found");
 
-        BuildMap();
-        FindRootProject();
-        ValidateStructure();
     }
 
-    ~ProjectMapper() = default;
+    //Same as above, except that the resolved graph is cached in cache_file. If none of the folders
+    //and project files changed since the cache was written, the graph is loaded from the cache
+    //instead of crawling, parsing and validating the projects again, and on_loaded isn't called.
+    ProjectMapper(const std::vector<std::string> &root_folders,
+                  size_t jobs,
+                  const std::filesystem::path &cache_file,
+                  ProjectListener on_loaded = nullptr) : m_OnProjectLoaded(std::move(on_loaded))
+    {
+        SetRootFolders(root_folders);
+        auto snapshot = GraphCache::Load(cache_file, RootKey());
+        if(snapshot)
+        {
+            RestoreSnapshot(*snapshot);
+            m_FromCache = true;
+            m_OnProjectLoaded = nullptr;
+            return;
+        }
+
+        MapFolders(jobs);
+        m_OnProjectLoaded = nullptr;
 
-    inline std::shared_ptr<ProjectInfo> GetRootProject()
+        //The cache is an optimization. Failing to write it mustn't fail the run.
+        try
+        {
+            GraphCache::Save(cache_file, CreateSnapshot());
+        }
+        catch(const std::exception &e)
+        {
+            std::cout << "Unable to save the project graph cache to " << cache_file << ": " << e.what() << std::endl;
+        }
+    }
+
+    ProjectMapper(const std::string &root_folder, size_t jobs, const std::filesystem::path &cache_file) :
+                                        ProjectMapper(std::vector<std::string> {root_folder}, jobs, cache_file)
     {
-        return (m_RootProject);
+
     }
 
-    void Print()
+    ~ProjectMapper() = default;
+
+    //Every sub-folder of folder that has a project file of its own, e.g. every solution at the top
+    //of a monorepo, sorted.
+    static std::vector<std::string> DiscoverRootFolders(const std::string &folder)
     {
-        for(auto &[proj_path, project] : m_ProjectCache)
+        auto root_folders = std::vector<std::string>();
+        for(auto const &dir_entry : std::filesystem::directory_iterator{folder})
         {
-            std::cout << *project;
-            for(auto child_project : project->GetDependencies())
+            if(!dir_entry.is_directory())
             {
-                std::cout << "========= " << *child_project;
+                continue;
+            }
+
+            for(auto const &entry : std::filesystem::directory_iterator{dir_entry.path()})
+            {
+                if(entry.is_regular_file() && entry.path().extension() == ProjectSuffix)
+                {
+                    root_folders.emplace_back(dir_entry.path().string());
+                    break;
+                }
             }
-            std::cout << std::endl;
         }
+
+        std::sort(root_folders.begin(), root_folders.end());
+        return (root_folders);
     }
 
-    CacheIteratorType begin()
+    //The first root project, if there is any.
+    inline ProjectInfo *GetRootProject()
     {
-        return(m_ProjectCache.begin());
+        return (m_RootNodes.empty() ? nullptr : &m_graph.Info(m_RootNodes.front()));
     }
 
-    CacheIteratorType end()
+    //What Update() did: the projects to convert and build again, and the files it couldn't parse.
+    struct UpdateResult
     {
-        return(m_ProjectCache.end());
+        std::vector<NodeId> m_dirty;
+        std::vector<std::string> m_errors;
+    };
+
+    //Watch mode: applies a batch of changed paths, typically from a FileWatcher, to the map. A path
+    //may be a project file that was created, edited or removed, or a folder that was created or
+    //removed. Only the project files involved are parsed again. The graph is then laid out again
+    //and only the changed projects, plus everything that depends on them, are checked for cycles
+    //and re-ordered; the rest of the topological order is kept.
+    //Returns the projects that have to be converted and built again, i.e. the changed projects and
+    //their dependents, direct or not, which are reset accordingly. A file that can't be parsed is
+    //reported in m_errors and its project is left as it was. A cycle throws
+    //CircularReferenceException, and the next update validates the whole graph again.
+    UpdateResult Update(const std::vector<std::string> &changed_paths)
+    {
+        auto result = UpdateResult();
+        auto changed = std::vector<ProjectInfo *>();
+        auto removed = std::vector<ProjectInfo *>();    //released once the order is remapped
+        auto removed_files = std::vector<std::string>();
+
+        auto old_order = std::vector<ProjectInfo *>();
+        for(auto node : m_graph.TopologicalOrder())
+        {
+            old_order.emplace_back(&m_graph.Info(node));
+        }
+
+        for(auto &path : changed_paths)
+        {
+            try
+            {
+                auto error = std::error_code();
+                if(std::filesystem::is_directory(path, error))
+                {
+                    CrawlNewFolder(path, changed);
+                }
+                else if(std::filesystem::exists(path, error))
+                {
+                    if(path.size() >= ProjectSuffix.size() &&
+                       path.compare(path.size() - ProjectSuffix.size(), ProjectSuffix.size(), ProjectSuffix) == 0)
+                    {
+                        ReloadProject(path, changed);
+                    }
+                }
+                else if(FindProject(path))
+                {
+                    removed_files.emplace_back(path);
+                }
+                else
+                {
+                    RemoveFolder(path, removed_files);
+                }
+            }
+            catch(const std::exception &e)
+            {
+                result.m_errors.emplace_back(path + ": " + e.what());
+            }
+        }
+
+        try
+        {
+            LoadExternalProjects();
+        }
+        catch(const std::exception &e)
+        {
+            m_ExternalQueue.clear();
+            result.m_errors.emplace_back(e.what());
+        }
+
+        RemoveProjects(removed_files, changed, removed);
+
+        //Changes from an update that failed on a cycle haven't been converted or built yet.
+        changed.insert(changed.end(), m_PendingChanges.begin(), m_PendingChanges.end());
+        m_PendingChanges.clear();
+        if(changed.empty() && removed.empty())
+        {
+            return (result);
+        }
+
+        for(auto project : removed)
+        {
+            project->SetId(InvalidNode);
+        }
+        ForEachProject([](ProjectInfo *project)
+        {
+            project->SetId(InvalidNode);    //new projects are the ones still without an id afterwards
+        });
+
+        BuildGraph();
+        FindRootProjects();
+
+        //The region: changed and new projects, and everything that depends on them.
+        auto node_count = m_graph.NodeCount();
+        auto in_region = std::vector<uint8_t>(node_count, 0);
+        auto in_old_order = std::vector<uint8_t>(node_count, 0);
+        for(auto project : old_order)
+        {
+            if(project->GetId() != InvalidNode)
+            {
+                in_old_order[project->GetId()] = 1;
+            }
+        }
+
+        auto region = std::vector<NodeId>();
+        auto add_to_region = [&](NodeId node)
+        {
+            if(!in_region[node])
+            {
+                in_region[node] = 1;
+                region.emplace_back(node);
+            }
+        };
+
+        for(auto project : changed)
+        {
+            if(project->GetId() != InvalidNode)
+            {
+                add_to_region(project->GetId());
+            }
+        }
+        for(NodeId node = 0; node < node_count && !m_NeedsFullValidation; ++node)
+        {
+            if(!in_old_order[node])
+            {
+                add_to_region(node);
+            }
+        }
+        for(size_t i = 0; i < region.size(); ++i)
+        {
+            for(auto parent_node : m_graph.Dependents(region[i]))
+            {
+                add_to_region(parent_node);
+            }
+        }
+
+        //Without the order of a valid graph to start from, e.g. after a cycle, the whole graph is
+        //sorted again. New projects then don't have to be in the region: they were never
+        //converted or built, so they will be anyway.
+        try
+        {
+            if(m_NeedsFullValidation)
+            {
+                ValidateStructure();
+            }
+            else
+            {
+                auto order = std::vector<NodeId>();
+                order.reserve(node_count);
+                for(auto project : old_order)
+                {
+                    auto node = project->GetId();
+                    if(node != InvalidNode && !in_region[node])
+                    {
+                        order.emplace_back(node);
+                    }
+                }
+
+                auto region_order = GraphValidator::SortRegion(m_graph, in_region, region);
+                order.insert(order.end(), region_order.begin(), region_order.end());
+                m_graph.SetTopologicalOrder(std::move(order));
+            }
+        }
+        catch(const CircularReferenceException &)
+        {
+            //The changes are kept for the next update, except for the projects about to be deleted.
+            m_NeedsFullValidation = true;
+            changed.erase(std::remove_if(changed.begin(), changed.end(), [&](ProjectInfo *project)
+            {
+                return (std::find(removed.begin(), removed.end(), project) != removed.end());
+            }), changed.end());
+            m_PendingChanges = changed;
+            ReleaseProjects(removed);
+            throw;
+        }
+        m_NeedsFullValidation = false;
+        ReleaseProjects(removed);
+
+        for(auto node : region)
+        {
+            m_graph.Info(node).Reset();
+        }
+        std::sort(region.begin(), region.end());
+        result.m_dirty = std::move(region);
+        return (result);
+    }
+
+    [[nodiscard]] inline NodeId GetRootNode() const {return (m_RootNodes.empty() ? InvalidNode : m_RootNodes.front());}
+    [[nodiscard]] inline const std::vector<NodeId> &GetRootNodes() const {return (m_RootNodes);}
+    [[nodiscard]] inline const std::vector<std::string> &GetRootFolders() const {return (m_RootFolders);}
+    [[nodiscard]] inline const ProjectGraph &GetGraph() const {return (m_graph);}
+    [[nodiscard]] bool IsFromCache() const {return (m_FromCache);}
+
+    void Print()
+    {
+        for(NodeId node = 0; node < m_graph.NodeCount(); ++node)
+        {
+            std::cout << m_graph.Info(node);
+            for(auto child_node : m_graph.Dependencies(node))
+            {
+                std::cout << "========= " << m_graph.Info(child_node);
+            }
+            std::cout << std::endl;
+        }
     }
 };
 
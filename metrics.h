@@ -0,0 +1,373 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "json.hpp"
+
+//What a LatencyHistogram held at some point, e.g. to tell what one run added to it. Counts are per
+//bucket, and durations are in microseconds.
+struct HistogramSnapshot
+{
+    std::vector<uint64_t> m_counts;
+    uint64_t m_SumMicros {0};
+
+    [[nodiscard]] uint64_t Count() const
+    {
+        auto count = uint64_t {0};
+        for(auto bucket_count : m_counts)
+        {
+            count += bucket_count;
+        }
+        return (count);
+    }
+
+    //In seconds, 0 for an empty snapshot.
+    [[nodiscard]] double Percentile(double p) const;
+
+    HistogramSnapshot &operator+=(const HistogramSnapshot &rhs)
+    {
+        m_counts.resize(std::max(m_counts.size(), rhs.m_counts.size()), 0);
+        for(size_t i = 0; i < rhs.m_counts.size(); ++i)
+        {
+            m_counts[i] += rhs.m_counts[i];
+        }
+        m_SumMicros += rhs.m_SumMicros;
+        return (*this);
+    }
+
+    //Only meant for a later snapshot of the same histogram, which has at least as many of everything.
+    HistogramSnapshot &operator-=(const HistogramSnapshot &rhs)
+    {
+        for(size_t i = 0; i < std::min(m_counts.size(), rhs.m_counts.size()); ++i)
+        {
+            m_counts[i] -= rhs.m_counts[i];
+        }
+        m_SumMicros -= rhs.m_SumMicros;
+        return (*this);
+    }
+
+    //Only the buckets that aren't empty, as [bucket, count] pairs: a run's worth of projects fits on a
+    //line.
+    [[nodiscard]] nlohmann::ordered_json ToJson() const
+    {
+        auto buckets_json = nlohmann::ordered_json::array();
+        for(size_t i = 0; i < m_counts.size(); ++i)
+        {
+            if(m_counts[i] > 0)
+            {
+                buckets_json.push_back({i, m_counts[i]});
+            }
+        }
+        return (nlohmann::ordered_json {{"Sum", m_SumMicros}, {"Buckets", buckets_json}});
+    }
+
+    static HistogramSnapshot FromJson(const nlohmann::ordered_json &snapshot_json);
+};
+
+//Latencies in the style of an HDR histogram: below 2^SubBits microseconds, every value has a bucket
+//of its own; above, every power of two is split into 2^SubBits buckets of equal width. A bucket is
+//never wider than 1/16 of the values it holds, so every percentile is within about 6% of the exact
+//one, from a microsecond to weeks, in a fixed array of counters. Recording is a couple of relaxed
+//atomic increments.
+class LatencyHistogram
+{
+public:
+    static constexpr size_t SubBits {4};
+    static constexpr size_t SubCount {size_t {1} << SubBits};
+    static constexpr size_t MaxExponent {42};   //2^42 us is about 50 days
+    static constexpr size_t BucketCount {(MaxExponent - SubBits + 2) * SubCount};
+
+private:
+    std::array<std::atomic<uint64_t>, BucketCount> m_counts {};
+    std::atomic<uint64_t> m_SumMicros {0};
+
+public:
+    static size_t BucketOf(uint64_t micros)
+    {
+        if(micros < SubCount)
+        {
+            return (static_cast<size_t>(micros));
+        }
+
+        auto exponent = std::min<size_t>(63 - static_cast<size_t>(__builtin_clzll(micros)), MaxExponent);
+        auto sub_bucket = std::min<size_t>(micros >> (exponent - SubBits), 2 * SubCount - 1) - SubCount;
+        return ((exponent - SubBits + 1) * SubCount + sub_bucket);
+    }
+
+    //The smallest value of the next bucket.
+    static uint64_t UpperBound(size_t bucket)
+    {
+        if(bucket < SubCount)
+        {
+            return (bucket + 1);
+        }
+
+        auto exponent = bucket / SubCount + SubBits - 1;
+        return ((SubCount + bucket % SubCount + 1) << (exponent - SubBits));
+    }
+
+    static uint64_t LowerBound(size_t bucket)
+    {
+        return (bucket == 0 ? 0 : UpperBound(bucket - 1));
+    }
+
+    void Record(double seconds)
+    {
+        auto micros = static_cast<uint64_t>(std::llround(std::max(seconds, 0.0) * 1e6));
+        m_counts[BucketOf(micros)].fetch_add(1, std::memory_order_relaxed);
+        m_SumMicros.fetch_add(micros, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] HistogramSnapshot Snapshot() const
+    {
+        auto snapshot = HistogramSnapshot();
+        snapshot.m_counts.resize(BucketCount);
+        for(size_t i = 0; i < BucketCount; ++i)
+        {
+            snapshot.m_counts[i] = m_counts[i].load(std::memory_order_relaxed);
+        }
+        snapshot.m_SumMicros = m_SumMicros.load(std::memory_order_relaxed);
+        return (snapshot);
+    }
+};
+
+//The middle of the bucket the percentile falls in.
+inline double HistogramSnapshot::Percentile(double p) const
+{
+    auto count = Count();
+    if(count == 0)
+    {
+        return (0.0);
+    }
+
+    auto rank = static_cast<uint64_t>(std::ceil(p / 100.0 * static_cast<double>(count)));
+    rank = std::max<uint64_t>(rank, 1);
+    auto seen = uint64_t {0};
+    auto bucket = size_t {0};
+    while(bucket + 1 < m_counts.size() && seen + m_counts[bucket] < rank)
+    {
+        seen += m_counts[bucket++];
+    }
+
+    auto lower = LatencyHistogram::LowerBound(bucket);
+    auto upper = LatencyHistogram::UpperBound(bucket);
+    return (static_cast<double>(lower + upper - 1) / 2.0 / 1e6);
+}
+
+inline HistogramSnapshot HistogramSnapshot::FromJson(const nlohmann::ordered_json &snapshot_json)
+{
+    auto snapshot = HistogramSnapshot();
+    snapshot.m_counts.resize(LatencyHistogram::BucketCount, 0);
+    snapshot.m_SumMicros = snapshot_json.value("Sum", uint64_t {0});
+    for(auto &bucket_json : snapshot_json.value("Buckets", nlohmann::ordered_json::array()))
+    {
+        auto bucket = bucket_json.at(0).get<size_t>();
+        if(bucket < snapshot.m_counts.size())
+        {
+            snapshot.m_counts[bucket] += bucket_json.at(1).get<uint64_t>();
+        }
+    }
+    return (snapshot);
+}
+
+class Counter
+{
+private:
+    std::atomic<uint64_t> m_value {0};
+
+public:
+    void Increment(uint64_t count = 1) {m_value.fetch_add(count, std::memory_order_relaxed);}
+    [[nodiscard]] uint64_t Value() const {return (m_value.load(std::memory_order_relaxed));}
+};
+
+class Gauge
+{
+private:
+    std::atomic<int64_t> m_value {0};
+
+public:
+    void Set(int64_t value) {m_value.store(value, std::memory_order_relaxed);}
+    void Add(int64_t delta) {m_value.fetch_add(delta, std::memory_order_relaxed);}
+    [[nodiscard]] int64_t Value() const {return (m_value.load(std::memory_order_relaxed));}
+};
+
+//The metrics of the process, published by the converter and the builder while they run and read
+//by the MetricsServer and the RunHistory. Registering a metric takes the lock; updating one is an
+//atomic operation on the metric itself. Metrics are never removed, so the references handed out
+//stay valid for the life of the process. A name and labels registered twice are the same metric.
+class MetricsRegistry
+{
+private:
+    enum class MetricType : uint8_t {Counter, Gauge, Histogram};
+
+    struct Entry
+    {
+        std::string m_name;
+        std::string m_labels;   //e.g. status="built", without the braces
+        std::string m_help;
+        MetricType m_type;
+        std::unique_ptr<Counter> m_counter;
+        std::unique_ptr<Gauge> m_gauge;
+        std::unique_ptr<LatencyHistogram> m_histogram;
+    };
+
+    //Histogram buckets in seconds, as Prometheus exposes them. The fine buckets of every histogram
+    //are folded into these.
+    static constexpr std::array<double, 14> ExposedBounds {0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 30, 60, 300, 900, 3600};
+
+    mutable std::mutex m_lock;
+    std::vector<std::unique_ptr<Entry>> m_entries;
+
+    MetricsRegistry() = default;
+
+    Entry &Add(const std::string &name, const std::string &labels, const std::string &help, MetricType type)
+    {
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        for(auto &entry : m_entries)
+        {
+            if(entry->m_name == name && entry->m_labels == labels && entry->m_type == type)
+            {
+                return (*entry);
+            }
+        }
+
+        auto entry = std::make_unique<Entry>(Entry {name, labels, help, type, nullptr, nullptr, nullptr});
+        entry->m_counter = (type == MetricType::Counter ? std::make_unique<Counter>() : nullptr);
+        entry->m_gauge = (type == MetricType::Gauge ? std::make_unique<Gauge>() : nullptr);
+        entry->m_histogram = (type == MetricType::Histogram ? std::make_unique<LatencyHistogram>() : nullptr);
+        m_entries.emplace_back(std::move(entry));
+        return (*m_entries.back());
+    }
+
+    static std::string Key(const Entry &entry)
+    {
+        return (entry.m_labels.empty() ? entry.m_name : entry.m_name + "{" + entry.m_labels + "}");
+    }
+
+    static std::string WithLabel(const Entry &entry, const std::string &label)
+    {
+        return ("{" + entry.m_labels + (entry.m_labels.empty() ? "" : ",") + label + "}");
+    }
+
+public:
+    MetricsRegistry(const MetricsRegistry &) = delete;
+    MetricsRegistry &operator=(const MetricsRegistry &) = delete;
+    ~MetricsRegistry() = default;
+
+    static MetricsRegistry &Instance()
+    {
+        static auto registry = MetricsRegistry();
+        return (registry);
+    }
+
+    Counter &AddCounter(const std::string &name, const std::string &help, const std::string &labels = "")
+    {
+        return (*Add(name, labels, help, MetricType::Counter).m_counter);
+    }
+
+    Gauge &AddGauge(const std::string &name, const std::string &help, const std::string &labels = "")
+    {
+        return (*Add(name, labels, help, MetricType::Gauge).m_gauge);
+    }
+
+    //In seconds.
+    LatencyHistogram &AddHistogram(const std::string &name, const std::string &help, const std::string &labels = "")
+    {
+        return (*Add(name, labels, help, MetricType::Histogram).m_histogram);
+    }
+
+    //Every counter and histogram, by name and labels in the Prometheus notation.
+    [[nodiscard]] std::vector<std::pair<std::string, uint64_t>> CounterValues() const
+    {
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        auto values = std::vector<std::pair<std::string, uint64_t>>();
+        for(auto &entry : m_entries)
+        {
+            if(entry->m_type == MetricType::Counter)
+            {
+                values.emplace_back(Key(*entry), entry->m_counter->Value());
+            }
+        }
+        return (values);
+    }
+
+    [[nodiscard]] std::vector<std::pair<std::string, HistogramSnapshot>> HistogramSnapshots() const
+    {
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        auto snapshots = std::vector<std::pair<std::string, HistogramSnapshot>>();
+        for(auto &entry : m_entries)
+        {
+            if(entry->m_type == MetricType::Histogram)
+            {
+                snapshots.emplace_back(Key(*entry), entry->m_histogram->Snapshot());
+            }
+        }
+        return (snapshots);
+    }
+
+    //The Prometheus text exposition format, version 0.0.4: the metrics of a name together, under
+    //one HELP and TYPE, in the order the names were first registered.
+    [[nodiscard]] std::string Render() const
+    {
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        auto s = std::ostringstream();
+        auto rendered = std::vector<std::string>();
+        for(auto &family : m_entries)
+        {
+            if(std::find(rendered.begin(), rendered.end(), family->m_name) != rendered.end())
+            {
+                continue;
+            }
+            rendered.emplace_back(family->m_name);
+
+            static const char *type_names[] = {"counter", "gauge", "histogram"};
+            s << "# HELP " << family->m_name << " " << family->m_help << "\n";
+            s << "# TYPE " << family->m_name << " " << type_names[static_cast<size_t>(family->m_type)] << "\n";
+            for(auto &entry : m_entries)
+            {
+                if(entry->m_name != family->m_name)
+                {
+                    continue;
+                }
+
+                auto labels = (entry->m_labels.empty() ? std::string() : "{" + entry->m_labels + "}");
+                if(entry->m_counter)
+                {
+                    s << entry->m_name << labels << " " << entry->m_counter->Value() << "\n";
+                }
+                else if(entry->m_gauge)
+                {
+                    s << entry->m_name << labels << " " << entry->m_gauge->Value() << "\n";
+                }
+                else
+                {
+                    //A fine bucket counts towards the first bound it's entirely below.
+                    auto snapshot = entry->m_histogram->Snapshot();
+                    auto cumulative = uint64_t {0};
+                    auto bucket = size_t {0};
+                    for(auto bound : ExposedBounds)
+                    {
+                        auto bound_micros = static_cast<uint64_t>(bound * 1e6);
+                        while(bucket < snapshot.m_counts.size() && LatencyHistogram::UpperBound(bucket) <= bound_micros + 1)
+                        {
+                            cumulative += snapshot.m_counts[bucket++];
+                        }
+                        s << entry->m_name << "_bucket" << WithLabel(*entry, "le=\"" + nlohmann::json(bound).dump() + "\"") << " " << cumulative << "\n";
+                    }
+                    s << entry->m_name << "_bucket" << WithLabel(*entry, "le=\"+Inf\"") << " " << snapshot.Count() << "\n";
+                    s << entry->m_name << "_sum" << labels << " " << static_cast<double>(snapshot.m_SumMicros) / 1e6 << "\n";
+                    s << entry->m_name << "_count" << labels << " " << snapshot.Count() << "\n";
+                }
+            }
+        }
+        return (s.str());
+    }
+};
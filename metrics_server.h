@@ -0,0 +1,129 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <thread>
+#include "metrics.h"
+#include "project_exceptions.h"
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+//Serves the MetricsRegistry over HTTP while a run goes on, for Prometheus to scrape or for curl:
+//GET /metrics returns every metric in the text exposition format. It only listens on the loopback
+//interface, one request per connection, on a thread of its own, so a slow scraper never holds up a
+//build.
+class MetricsServer
+{
+private:
+    static constexpr size_t MaxRequestSize {8192};
+
+    int m_listener {-1};
+    uint16_t m_port {0};
+    std::atomic<bool> m_stopping {false};
+    std::thread m_thread;
+
+#if defined(__linux__) || defined(__APPLE__)
+    static void SendAll(int fd, const std::string &data)
+    {
+        auto sent = size_t {0};
+        while(sent < data.size())
+        {
+            auto count = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if(count <= 0)
+            {
+                return;
+            }
+            sent += static_cast<size_t>(count);
+        }
+    }
+
+    static void Respond(int fd)
+    {
+        //A client that doesn't send its request within a second is dropped.
+        auto timeout = timeval {1, 0};
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        auto request = std::string();
+        char buffer[1024];
+        while(request.find("\r\n\r\n") == std::string::npos && request.size() < MaxRequestSize)
+        {
+            auto count = ::recv(fd, buffer, sizeof(buffer), 0);
+            if(count <= 0)
+            {
+                break;
+            }
+            request.append(buffer, static_cast<size_t>(count));
+        }
+
+        auto found = (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 14, "GET /metrics\r\n") == 0);
+        auto body = (found ? MetricsRegistry::Instance().Render() : std::string("Not found, try /metrics\n"));
+        auto response = std::string(found ? "HTTP/1.1 200 OK\r\n" : "HTTP/1.1 404 Not Found\r\n");
+        response += (found ? "Content-Type: text/plain; version=0.0.4\r\n" : "Content-Type: text/plain\r\n");
+        response += "Content-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        SendAll(fd, response);
+    }
+
+    void Serve()
+    {
+        while(!m_stopping)
+        {
+            auto fd = ::accept(m_listener, nullptr, nullptr);
+            if(fd < 0)
+            {
+                continue;   //interrupted, or shut down by the destructor
+            }
+            Respond(fd);
+            ::close(fd);
+        }
+    }
+#endif
+
+public:
+    //0 picks a free port, see GetPort().
+    explicit MetricsServer(uint16_t port)
+    {
+#if defined(__linux__) || defined(__APPLE__)
+        m_listener = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        ThrowIfFalse<BaseException>(m_listener >= 0, "MetricsServer::MetricsServer", "Unable to create a socket");
+        auto reuse = 1;
+        ::setsockopt(m_listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        auto address = sockaddr_in();
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        auto length = socklen_t {sizeof(address)};
+        if(::bind(m_listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+           ::listen(m_listener, 8) != 0 ||
+           ::getsockname(m_listener, reinterpret_cast<sockaddr *>(&address), &length) != 0)
+        {
+            ::close(m_listener);
+            throw BaseException("MetricsServer::MetricsServer", "Unable to listen on port " + std::to_string(port));
+        }
+        m_port = ntohs(address.sin_port);
+        m_thread = std::thread([this]() {Serve();});
+#else
+        ThrowIfFalse<BaseException>(false, "MetricsServer::MetricsServer", "The metrics endpoint isn't supported on this platform");
+#endif
+    }
+
+    MetricsServer(const MetricsServer &) = delete;
+    MetricsServer &operator=(const MetricsServer &) = delete;
+
+    //Shutting the listening socket down wakes the thread up from accept().
+    ~MetricsServer()
+    {
+#if defined(__linux__) || defined(__APPLE__)
+        m_stopping = true;
+        ::shutdown(m_listener, SHUT_RDWR);
+        m_thread.join();
+        ::close(m_listener);
+#endif
+    }
+
+    [[nodiscard]] uint16_t GetPort() const {return (m_port);}
+};
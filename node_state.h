@@ -0,0 +1,176 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "project_exceptions.h"
+#include "project_graph.h"
+
+//Where a project is in a conversion or a build:
+//
+//  Pending --(last dependency done)--> Ready --> Running --> Done
+//                                                       \--> Failed
+//  Pending or Ready --> Skipped    (a dependency failed, or the run stopped)
+//  Pending or Ready --> Failed     (without running, e.g. its conversion failed)
+//
+enum class NodeState : uint8_t {Pending, Ready, Running, Done, Failed, Skipped};
+
+//The state of every project of one build, and the number of its dependencies that aren't done
+//yet, indexed by node id: what the builder schedules from. In a streaming run, the project's
+//conversion counts as one more dependency, see ConversionGate. Every transition is a single
+//compare-and-swap, so that of the threads attempting the same transition exactly one succeeds,
+//and a project becomes ready in O(1), when the worker that completes its last dependency
+//decrements its counter to zero. No lock is involved.
+//Whatever a worker writes before a project is Done, e.g. the build fields of its ProjectInfo, is
+//visible to the worker that gets the project's dependents ready.
+class NodeStateTable
+{
+private:
+    std::vector<std::atomic<NodeState>> m_states;
+    std::vector<std::atomic<uint32_t>> m_remaining;
+
+public:
+    explicit NodeStateTable(size_t node_count) : m_states(node_count), m_remaining(node_count)
+    {
+        for(size_t node = 0; node < node_count; ++node)
+        {
+            m_states[node].store(NodeState::Pending, std::memory_order_relaxed);
+            m_remaining[node].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    NodeStateTable(const NodeStateTable &) = delete;
+    NodeStateTable &operator=(const NodeStateTable &) = delete;
+
+    //Before the run starts: the node waits for that many dependencies, and is ready at once
+    //without any.
+    void Reset(NodeId node, uint32_t dependencies)
+    {
+        m_remaining[node].store(dependencies, std::memory_order_relaxed);
+        m_states[node].store(dependencies == 0 ? NodeState::Ready : NodeState::Pending, std::memory_order_relaxed);
+    }
+
+    //Moves the node from one state to the other, if it's still in the first one.
+    bool Transition(NodeId node, NodeState from, NodeState to)
+    {
+        return (m_states[node].compare_exchange_strong(from, to, std::memory_order_acq_rel));
+    }
+
+    //One of the dependencies of the node is done. True for the one call that makes it ready.
+    bool DependencyDone(NodeId node)
+    {
+        if(m_remaining[node].fetch_sub(1, std::memory_order_acq_rel) != 1)
+        {
+            return (false);
+        }
+        return (Transition(node, NodeState::Pending, NodeState::Ready));
+    }
+
+    //False if another worker got to the node first, or it was skipped.
+    bool Start(NodeId node)
+    {
+        return (Transition(node, NodeState::Ready, NodeState::Running));
+    }
+
+    void Finish(NodeId node, bool succeeded)
+    {
+        if(!Transition(node, NodeState::Running, succeeded ? NodeState::Done : NodeState::Failed))
+        {
+            throw BaseException("NodeStateTable::Finish", "Project " + std::to_string(node) + " isn't running");
+        }
+    }
+
+    //False if the node already started.
+    bool Fail(NodeId node)
+    {
+        return (Transition(node, NodeState::Pending, NodeState::Failed) ||
+                Transition(node, NodeState::Ready, NodeState::Failed));
+    }
+
+    //False if the node already started.
+    bool Skip(NodeId node)
+    {
+        return (Transition(node, NodeState::Pending, NodeState::Skipped) ||
+                Transition(node, NodeState::Ready, NodeState::Skipped));
+    }
+
+    [[nodiscard]] NodeState Get(NodeId node) const {return (m_states[node].load(std::memory_order_acquire));}
+    [[nodiscard]] uint32_t Remaining(NodeId node) const {return (m_remaining[node].load(std::memory_order_acquire));}
+    [[nodiscard]] size_t NodeCount() const {return (m_states.size());}
+};
+
+//Streaming runs only, see StreamingPipeline: hands the projects over from the conversions to the
+//build, which starts while conversions still run. Projects are known by path id, since node ids
+//are only given out once the map is complete. Every call takes the lock, so the build either sees
+//that a conversion finished when it starts, or is told by Finished() afterwards, never both.
+class ConversionGate
+{
+public:
+    //Called under the lock, from the thread that finished the conversion, with whether it succeeded.
+    using ListenerType = std::function<void(uint32_t, bool)>;
+
+private:
+    std::mutex m_lock;
+    std::condition_variable m_AllFinished;
+    std::unordered_set<uint32_t> m_converting;
+    std::unordered_set<uint32_t> m_failed;      //the conversions that are over and failed
+    ListenerType m_listener;
+
+public:
+    ConversionGate() = default;
+    ConversionGate(const ConversionGate &) = delete;
+    ConversionGate &operator=(const ConversionGate &) = delete;
+
+    void Started(uint32_t path_id)
+    {
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        m_converting.emplace(path_id);
+    }
+
+    //converted is false if the conversion failed, in which case the project isn't built.
+    void Finished(uint32_t path_id, bool converted)
+    {
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        m_converting.erase(path_id);
+        if(!converted)
+        {
+            m_failed.emplace(path_id);
+        }
+        if(m_listener)
+        {
+            m_listener(path_id, converted);
+        }
+        if(m_converting.empty())
+        {
+            m_AllFinished.notify_all();
+        }
+    }
+
+    //Hands prepare the projects whose conversion isn't over and those whose conversion failed, then
+    //calls listener for each of the first once it is, until Detach(). No conversion finishes while
+    //prepare runs.
+    template<typename Function>
+    void Attach(Function prepare, ListenerType listener)
+    {
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        prepare(static_cast<const std::unordered_set<uint32_t> &>(m_converting),
+                static_cast<const std::unordered_set<uint32_t> &>(m_failed));
+        m_listener = std::move(listener);
+    }
+
+    void Detach()
+    {
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        m_listener = nullptr;
+    }
+
+    void WaitForAll()
+    {
+        auto lock = std::unique_lock<std::mutex>(m_lock);
+        m_AllFinished.wait(lock, [this]() {return (m_converting.empty());});
+    }
+};
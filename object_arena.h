@@ -0,0 +1,83 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+//Monotonic arena for objects of one type, typically the nodes of a graph. Objects are constructed
+//in place in chunks of ChunkSize, so creating a million of them takes a thousand allocations
+//instead of a million, and they sit next to each other in memory. Addresses never change.
+//Objects aren't freed one by one: a released object is kept, and reused by the next Create(). All
+//of them are destroyed with the arena.
+template<typename T, size_t ChunkSize = 1024>
+class ObjectArena
+{
+private:
+    struct Chunk
+    {
+        alignas(T) std::byte m_storage[sizeof(T) * ChunkSize];
+
+        T *At(size_t index) {return (std::launder(reinterpret_cast<T *>(m_storage + sizeof(T) * index)));}
+    };
+
+    std::vector<std::unique_ptr<Chunk>> m_chunks;
+    size_t m_used {ChunkSize};      //objects constructed in the last chunk
+    std::vector<T *> m_released;
+
+public:
+    ObjectArena() = default;
+    ObjectArena(const ObjectArena &) = delete;
+    ObjectArena &operator=(const ObjectArena &) = delete;
+
+    ~ObjectArena()
+    {
+        for(size_t chunk = 0; chunk < m_chunks.size(); ++chunk)
+        {
+            auto count = (chunk + 1 == m_chunks.size() ? m_used : ChunkSize);
+            for(size_t i = 0; i < count; ++i)
+            {
+                m_chunks[chunk]->At(i)->~T();
+            }
+        }
+    }
+
+    template<typename... Args>
+    T *Create(Args &&... args)
+    {
+        if(!m_released.empty())
+        {
+            auto object = m_released.back();
+            m_released.pop_back();
+            if constexpr(std::is_nothrow_constructible_v<T, Args &&...>)
+            {
+                object->~T();   //rebuilt in place, so that T needn't be assignable
+                return (new(object) T(std::forward<Args>(args)...));
+            }
+            else
+            {
+                *object = T(std::forward<Args>(args)...);
+                return (object);
+            }
+        }
+
+        if(m_used == ChunkSize)
+        {
+            m_chunks.emplace_back(new Chunk);     //not make_unique, which would zero the storage
+            m_used = 0;
+        }
+
+        auto object = new(m_chunks.back()->m_storage + sizeof(T) * m_used) T(std::forward<Args>(args)...);
+        ++m_used;
+        return (object);
+    }
+
+    //The object stays valid until it's handed out again by Create().
+    void Release(T *object) {m_released.emplace_back(object);}
+
+    [[nodiscard]] size_t Size() const
+    {
+        return (m_chunks.empty() ? 0 : (m_chunks.size() - 1) * ChunkSize + m_used - m_released.size());
+    }
+};
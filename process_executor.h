@@ -0,0 +1,446 @@
+#pragma once
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+//Outcome of one command. Output is captured in memory, one buffer per stream.
+struct ProcessResult
+{
+    int m_ExitCode {-1};            //the signal number is reported as 128 + signal, like the shell does
+    std::string m_output;           //stdout
+    std::string m_error;            //stderr
+    std::optional<std::string> m_LaunchError;   //set if the command couldn't be started at all
+
+    [[nodiscard]] std::optional<std::string> GetError() const
+    {
+        if(m_LaunchError)
+        {
+            return (m_LaunchError);
+        }
+        if(m_ExitCode != 0)
+        {
+            return ("The command exited with code " + std::to_string(m_ExitCode));
+        }
+        return (std::nullopt);
+    }
+};
+
+//A command to run through /bin/sh -c, with extra environment variables on top of ours.
+struct ProcessRequest
+{
+    std::string m_command;
+    std::filesystem::path m_WorkingFolder;
+    std::map<std::string, std::string> m_environment;
+
+    //A project command runs in the folder of its project file and can find its way around through
+    //PROJECT_FILE, PROJECT_DIR and BUILD_DIR. A build also gets OUTPUT_DIR, the folder of its own
+    //outputs.
+    static ProcessRequest ForProject(const std::string &command,
+                                     const std::string &project_path,
+                                     const std::string &build_folder,
+                                     const std::string &output_folder = "")
+    {
+        auto request = ProcessRequest();
+        auto project_folder = std::filesystem::path(project_path).parent_path();
+        request.m_command = command;
+        request.m_WorkingFolder = project_folder;
+        request.m_environment["PROJECT_FILE"] = project_path;
+        request.m_environment["PROJECT_DIR"] = project_folder.string();
+        request.m_environment["BUILD_DIR"] = build_folder;
+        if(!output_folder.empty())
+        {
+            request.m_environment["OUTPUT_DIR"] = output_folder;
+        }
+        return (request);
+    }
+};
+
+//Runs shell commands asynchronously, at most m_MaxRunning at a time. All children are supervised
+//by a single event-loop thread: the commands are started with posix_spawn, their stdout and stderr
+//are non-blocking pipes and their exit is signalled by a pidfd, all registered with one epoll
+//instance. There is no thread per child, and callers simply wait on the returned future.
+//Commands submitted over the limit wait in a queue and start as running ones finish.
+class ProcessExecutor
+{
+private:
+#if defined(__linux__)
+    struct Child
+    {
+        pid_t m_pid {-1};
+        int m_PidFd {-1};
+        int m_OutFd {-1};
+        int m_ErrFd {-1};
+        bool m_exited {false};
+        ProcessResult m_result;
+        std::promise<ProcessResult> m_promise;
+    };
+
+    struct Pending
+    {
+        ProcessRequest m_request;
+        std::promise<ProcessResult> m_promise;
+    };
+
+    size_t m_MaxRunning;
+    int m_epoll {-1};
+    int m_wakeup {-1};      //eventfd used to tell the loop that work was queued or that we're stopping
+
+    std::mutex m_lock;
+    std::deque<Pending> m_pending;      //protected by m_lock
+    bool m_stopping {false};            //protected by m_lock
+
+    std::map<int, std::shared_ptr<Child>> m_FdOwners;    //only touched by the loop thread
+    size_t m_running {0};                                //only touched by the loop thread
+    std::thread m_loop;
+
+    static int OpenPidFd(pid_t pid)
+    {
+#if defined(SYS_pidfd_open)
+        return (static_cast<int>(::syscall(SYS_pidfd_open, pid, 0)));
+#else
+        return (-1);
+#endif
+    }
+
+    void Watch(int fd, const std::shared_ptr<Child> &child)
+    {
+        auto event = epoll_event();
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        ::epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event);
+        m_FdOwners[fd] = child;
+    }
+
+    void Unwatch(int &fd)
+    {
+        ::epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+        ::close(fd);
+        m_FdOwners.erase(fd);
+        fd = -1;
+    }
+
+    static std::vector<std::string> CreateEnvironment(const std::map<std::string, std::string> &extra)
+    {
+        auto environment = std::vector<std::string>();
+        for(auto env = environ; *env != nullptr; ++env)
+        {
+            auto entry = std::string(*env);
+            auto name = entry.substr(0, entry.find('='));
+            if(extra.find(name) == extra.end())
+            {
+                environment.emplace_back(entry);
+            }
+        }
+
+        for(auto &[name, value] : extra)
+        {
+            environment.emplace_back(name + "=" + value);
+        }
+        return (environment);
+    }
+
+    void Start(Pending &pending)
+    {
+        auto child = std::make_shared<Child>();
+        child->m_promise = std::move(pending.m_promise);
+        auto &request = pending.m_request;
+
+        int out_pipe[2] = {-1, -1};
+        int err_pipe[2] = {-1, -1};
+        if(::pipe2(out_pipe, O_CLOEXEC) != 0 || ::pipe2(err_pipe, O_CLOEXEC) != 0)
+        {
+            for(auto fd : {out_pipe[0], out_pipe[1], err_pipe[0], err_pipe[1]})
+            {
+                if(fd >= 0)
+                {
+                    ::close(fd);
+                }
+            }
+            child->m_result.m_LaunchError = std::string("Unable to create pipes: ") + std::strerror(errno);
+            child->m_promise.set_value(child->m_result);
+            return;
+        }
+
+        auto actions = posix_spawn_file_actions_t();
+        ::posix_spawn_file_actions_init(&actions);
+        ::posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+        ::posix_spawn_file_actions_adddup2(&actions, err_pipe[1], STDERR_FILENO);
+        if(!request.m_WorkingFolder.empty())
+        {
+            ::posix_spawn_file_actions_addchdir_np(&actions, request.m_WorkingFolder.c_str());
+        }
+
+        auto environment = CreateEnvironment(request.m_environment);
+        auto env = std::vector<char *>();
+        for(auto &entry : environment)
+        {
+            env.emplace_back(entry.data());
+        }
+        env.emplace_back(nullptr);
+
+        char shell[] = "/bin/sh";
+        char option[] = "-c";
+        char *argv[] = {shell, option, request.m_command.data(), nullptr};
+
+        auto status = ::posix_spawn(&child->m_pid, shell, &actions, nullptr, argv, env.data());
+        ::posix_spawn_file_actions_destroy(&actions);
+        ::close(out_pipe[1]);
+        ::close(err_pipe[1]);
+
+        if(status != 0)
+        {
+            ::close(out_pipe[0]);
+            ::close(err_pipe[0]);
+            child->m_result.m_LaunchError = std::string("Unable to start the command: ") + std::strerror(status);
+            child->m_promise.set_value(child->m_result);
+            return;
+        }
+
+        child->m_OutFd = out_pipe[0];
+        child->m_ErrFd = err_pipe[0];
+        ::fcntl(child->m_OutFd, F_SETFL, O_NONBLOCK);
+        ::fcntl(child->m_ErrFd, F_SETFL, O_NONBLOCK);
+        Watch(child->m_OutFd, child);
+        Watch(child->m_ErrFd, child);
+
+        //Without pidfd (kernels older than 5.3), the exit is collected once both pipes are closed.
+        child->m_PidFd = OpenPidFd(child->m_pid);
+        if(child->m_PidFd >= 0)
+        {
+            Watch(child->m_PidFd, child);
+        }
+
+        ++m_running;
+    }
+
+    //Drains whatever is available on a pipe. Returns false at end of file.
+    static bool ReadPipe(int fd, std::string &buffer)
+    {
+        char chunk[16 * 1024];
+        while(true)
+        {
+            auto count = ::read(fd, chunk, sizeof(chunk));
+            if(count > 0)
+            {
+                buffer.append(chunk, static_cast<size_t>(count));
+                continue;
+            }
+
+            if(count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                return (true);
+            }
+            if(count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            return (false);
+        }
+    }
+
+    void Reap(Child &child)
+    {
+        auto status = 0;
+        while(::waitpid(child.m_pid, &status, 0) < 0 && errno == EINTR)
+        {
+        }
+
+        if(WIFEXITED(status))
+        {
+            child.m_result.m_ExitCode = WEXITSTATUS(status);
+        }
+        else if(WIFSIGNALED(status))
+        {
+            child.m_result.m_ExitCode = 128 + WTERMSIG(status);
+        }
+        child.m_exited = true;
+    }
+
+    //A child is done once it exited and both of its pipes reached end of file, so that no output
+    //written just before the exit is lost.
+    void CompleteIfDone(const std::shared_ptr<Child> &child)
+    {
+        if(child->m_OutFd >= 0 || child->m_ErrFd >= 0)
+        {
+            return;
+        }
+
+        if(!child->m_exited)
+        {
+            if(child->m_PidFd >= 0)
+            {
+                return;     //the pidfd will tell us
+            }
+            Reap(*child);
+        }
+
+        if(child->m_PidFd >= 0)
+        {
+            Unwatch(child->m_PidFd);
+        }
+
+        --m_running;
+        child->m_promise.set_value(std::move(child->m_result));
+    }
+
+    void StartPending()
+    {
+        auto lock = std::unique_lock<std::mutex>(m_lock);
+        while(!m_pending.empty() && m_running < m_MaxRunning)
+        {
+            auto pending = std::move(m_pending.front());
+            m_pending.pop_front();
+            lock.unlock();
+            Start(pending);
+            lock.lock();
+        }
+    }
+
+    void Loop()
+    {
+        epoll_event events[64];
+        while(true)
+        {
+            StartPending();
+            {
+                auto lock = std::lock_guard<std::mutex>(m_lock);
+                if(m_stopping && m_running == 0 && m_pending.empty())
+                {
+                    return;
+                }
+            }
+
+            auto count = ::epoll_wait(m_epoll, events, 64, -1);
+            for(int i = 0; i < count; ++i)
+            {
+                auto fd = events[i].data.fd;
+                if(fd == m_wakeup)
+                {
+                    auto value = uint64_t {0};
+                    [[maybe_unused]] auto ignored = ::read(m_wakeup, &value, sizeof(value));
+                    continue;
+                }
+
+                auto it = m_FdOwners.find(fd);
+                if(it == m_FdOwners.end())
+                {
+                    continue;
+                }
+
+                auto child = it->second;
+                if(fd == child->m_PidFd)
+                {
+                    Reap(*child);
+                    //Collect whatever the child wrote right before exiting; the pipes may still
+                    //be held open by its own children, in which case they are closed here.
+                    for(auto *pipe_fd : {&child->m_OutFd, &child->m_ErrFd})
+                    {
+                        if(*pipe_fd >= 0)
+                        {
+                            ReadPipe(*pipe_fd, (pipe_fd == &child->m_OutFd ? child->m_result.m_output
+                                                                            : child->m_result.m_error));
+                            Unwatch(*pipe_fd);
+                        }
+                    }
+                }
+                else
+                {
+                    auto &buffer = (fd == child->m_OutFd ? child->m_result.m_output : child->m_result.m_error);
+                    if(!ReadPipe(fd, buffer))
+                    {
+                        Unwatch(fd == child->m_OutFd ? child->m_OutFd : child->m_ErrFd);
+                    }
+                }
+
+                CompleteIfDone(child);
+            }
+        }
+    }
+
+    void Wakeup()
+    {
+        auto value = uint64_t {1};
+        [[maybe_unused]] auto ignored = ::write(m_wakeup, &value, sizeof(value));
+    }
+#endif
+
+public:
+    explicit ProcessExecutor(size_t max_running)
+    {
+#if defined(__linux__)
+        m_MaxRunning = std::max<size_t>(max_running, 1);
+        m_epoll = ::epoll_create1(EPOLL_CLOEXEC);
+        m_wakeup = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+        auto event = epoll_event();
+        event.events = EPOLLIN;
+        event.data.fd = m_wakeup;
+        ::epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeup, &event);
+
+        m_loop = std::thread([this]() {Loop();});
+#endif
+    }
+
+    ProcessExecutor(const ProcessExecutor &) = delete;
+    ProcessExecutor &operator=(const ProcessExecutor &) = delete;
+
+    //Waits for the commands that are still running or queued.
+    ~ProcessExecutor()
+    {
+#if defined(__linux__)
+        {
+            auto lock = std::lock_guard<std::mutex>(m_lock);
+            m_stopping = true;
+        }
+        Wakeup();
+        m_loop.join();
+        ::close(m_wakeup);
+        ::close(m_epoll);
+#endif
+    }
+
+    std::future<ProcessResult> Run(ProcessRequest request)
+    {
+#if defined(__linux__)
+        auto promise = std::promise<ProcessResult>();
+        auto future = promise.get_future();
+        {
+            auto lock = std::lock_guard<std::mutex>(m_lock);
+            m_pending.emplace_back(Pending {std::move(request), std::move(promise)});
+        }
+        Wakeup();
+        return (future);
+#else
+        //No asynchronous backend on this platform: run the command right away, without capturing
+        //its output.
+        auto result = ProcessResult();
+        result.m_ExitCode = std::system(request.m_command.c_str());
+        auto promise = std::promise<ProcessResult>();
+        promise.set_value(result);
+        return (promise.get_future());
+#endif
+    }
+};
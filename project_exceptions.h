@@ -1,6 +1,7 @@
 #pragma once
 #include <exception>
 #include <string>
+#include <vector>
 
 class BaseException : public std::exception
 {
@@ -16,6 +17,9 @@ public:
     }
 
     ~BaseException() override = default;
+
+    [[nodiscard]] const char *what() const noexcept override {return (m_message.c_str());}
+    [[nodiscard]] const std::string &GetSource() const {return (m_source);}
 };
 
 class MapperException : public BaseException
@@ -35,6 +39,36 @@ public:
     ~MapperException() override = default;
 };
 
+//Thrown when the projects reference each other in a loop. The cycle starts and ends with the same
+//project, e.g. {A, B, C, A} for A --> B --> C --> A.
+class CircularReferenceException : public MapperException
+{
+private:
+    std::vector<std::string> m_cycle;
+
+    static std::string FormatMessage(const std::vector<std::string> &cycle)
+    {
+        auto message = std::string("The projects have a circular reference, which is not allowed: ");
+        for(size_t i = 0; i < cycle.size(); ++i)
+        {
+            message += (i == 0 ? "" : " --> ") + cycle[i];
+        }
+        return (message);
+    }
+
+public:
+    CircularReferenceException(const std::string &source, const std::vector<std::string> &cycle) :
+                                                      MapperException(source, FormatMessage(cycle)),
+                                                      m_cycle(cycle)
+    {
+
+    }
+
+    ~CircularReferenceException() override = default;
+
+    [[nodiscard]] const std::vector<std::string> &GetCycle() const {return (m_cycle);}
+};
+
 template <class ExceptionType>
 void ThrowIfFalse(bool condition, const std::string &source, const std::string &message)
 {
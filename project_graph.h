@@ -0,0 +1,250 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using NodeId = uint32_t;
+inline constexpr NodeId InvalidNode {std::numeric_limits<NodeId>::max()};
+
+class ProjectInfo;
+
+//Read-only view of a contiguous run of node ids, such as the dependencies of one node.
+class NodeRange
+{
+private:
+    const NodeId *m_begin {nullptr};
+    const NodeId *m_end {nullptr};
+
+public:
+    NodeRange() = default;
+    NodeRange(const NodeId *begin, const NodeId *end) : m_begin(begin), m_end(end)
+    {
+
+    }
+
+    [[nodiscard]] const NodeId *begin() const {return (m_begin);}
+    [[nodiscard]] const NodeId *end() const {return (m_end);}
+    [[nodiscard]] size_t size() const {return (static_cast<size_t>(m_end - m_begin));}
+    [[nodiscard]] bool empty() const {return (m_begin == m_end);}
+    NodeId operator[](size_t index) const {return (m_begin[index]);}
+};
+
+//Every distinct path is stored once and referred to by a 32-bit id, which stays valid for the
+//lifetime of the table. The strings live in a deque, which never moves its elements, so a
+//reference to one of them can be kept instead of a copy. Lookups go through an open-addressing
+//table of ids with linear probing: one flat array, no node per entry, and the hash of every path
+//is kept so that probing rarely compares strings and growing never hashes them again.
+class PathTable
+{
+private:
+    static constexpr uint32_t EmptySlot {std::numeric_limits<uint32_t>::max()};
+    static constexpr size_t InitialSlots {64};
+
+    std::deque<std::string> m_paths;
+    std::vector<size_t> m_hashes;       //id --> hash of the path
+    std::vector<uint32_t> m_slots;      //ids, or EmptySlot; the size is a power of two
+
+    //The slot that holds the id of the path, or the empty slot where it would go.
+    [[nodiscard]] size_t Probe(std::string_view path, size_t hash) const
+    {
+        auto mask = m_slots.size() - 1;
+        for(auto slot = hash & mask; ; slot = (slot + 1) & mask)
+        {
+            auto id = m_slots[slot];
+            if(id == EmptySlot || (m_hashes[id] == hash && m_paths[id] == path))
+            {
+                return (slot);
+            }
+        }
+    }
+
+    //Keeps the table at most half full, which keeps the probe sequences short.
+    void Grow()
+    {
+        auto slots = std::vector<uint32_t>(std::max(m_slots.size() * 2, InitialSlots), EmptySlot);
+        auto mask = slots.size() - 1;
+        for(uint32_t id = 0; id < m_paths.size(); ++id)
+        {
+            auto slot = m_hashes[id] & mask;
+            while(slots[slot] != EmptySlot)
+            {
+                slot = (slot + 1) & mask;
+            }
+            slots[slot] = id;
+        }
+        m_slots = std::move(slots);
+    }
+
+public:
+    PathTable() = default;
+    PathTable(const PathTable &) = delete;
+    PathTable &operator=(const PathTable &) = delete;
+    PathTable(PathTable &&) = default;
+    PathTable &operator=(PathTable &&) = default;
+    ~PathTable() = default;
+
+    uint32_t Intern(std::string_view path)
+    {
+        if((m_paths.size() + 1) * 2 > m_slots.size())
+        {
+            Grow();
+        }
+
+        auto hash = std::hash<std::string_view>()(path);
+        auto slot = Probe(path, hash);
+        if(m_slots[slot] == EmptySlot)
+        {
+            m_slots[slot] = static_cast<uint32_t>(m_paths.size());
+            m_paths.emplace_back(path);
+            m_hashes.emplace_back(hash);
+        }
+        return (m_slots[slot]);
+    }
+
+    [[nodiscard]] uint32_t Find(std::string_view path) const
+    {
+        if(m_slots.empty())
+        {
+            return (EmptySlot);
+        }
+        return (m_slots[Probe(path, std::hash<std::string_view>()(path))]);
+    }
+
+    [[nodiscard]] const std::string &Get(uint32_t id) const {return (m_paths[id]);}
+    [[nodiscard]] size_t Size() const {return (m_paths.size());}
+
+    void Clear()
+    {
+        m_slots.clear();
+        m_hashes.clear();
+        m_paths.clear();
+    }
+};
+
+//Index-based, immutable view of the project graph. Nodes are numbered 0..NodeCount()-1 and every
+//per-node attribute is its own array (struct of arrays). Edges are stored CSR-style in both
+//directions: the dependencies of node n are m_DependencyTargets[m_DependencyOffsets[n] ..
+//m_DependencyOffsets[n + 1]) and its dependents are laid out the same way in the reverse arrays.
+//Walking the graph therefore touches only contiguous arrays of 32-bit ids: no allocation, no
+//shared_ptr copies and no reference counting.
+//Paths aren't copied into the graph: it refers to them by id in a path table owned by whoever
+//builds the graph, which has to outlive it.
+class ProjectGraph
+{
+private:
+    const PathTable *m_paths;
+    std::vector<uint32_t> m_NodePath;           //node --> id in m_paths
+    std::vector<NodeId> m_PathNode;             //id in m_paths --> node, InvalidNode if it has none
+    std::vector<ProjectInfo *> m_NodeInfo;      //node --> its status, owned by the mapper
+    std::vector<uint32_t> m_DependencyOffsets {0};
+    std::vector<NodeId> m_DependencyTargets;
+    std::vector<uint32_t> m_DependentOffsets {0};
+    std::vector<NodeId> m_DependentTargets;
+    std::vector<NodeId> m_TopologicalOrder;     //dependencies before the projects that use them
+
+public:
+    explicit ProjectGraph(const PathTable &paths) : m_paths(&paths)
+    {
+
+    }
+
+    ProjectGraph(const ProjectGraph &) = delete;
+    ProjectGraph &operator=(const ProjectGraph &) = delete;
+    ProjectGraph(ProjectGraph &&) = default;
+    ProjectGraph &operator=(ProjectGraph &&) = default;
+    ~ProjectGraph() = default;
+
+    //Nodes have to be added in id order, each one with all of its dependencies. A dependency may
+    //refer to a node that hasn't been added yet. Call Finalize() once every node is in.
+    NodeId AddNode(uint32_t path_id, ProjectInfo *info, const std::vector<NodeId> &dependencies)
+    {
+        auto id = static_cast<NodeId>(m_NodePath.size());
+        if(path_id >= m_PathNode.size())
+        {
+            m_PathNode.resize(std::max<size_t>(path_id + 1, m_paths->Size()), InvalidNode);
+        }
+        m_PathNode[path_id] = id;
+        m_NodePath.emplace_back(path_id);
+        m_NodeInfo.emplace_back(info);
+        m_DependencyTargets.insert(m_DependencyTargets.end(), dependencies.begin(), dependencies.end());
+        m_DependencyOffsets.emplace_back(static_cast<uint32_t>(m_DependencyTargets.size()));
+        return (id);
+    }
+
+    //Builds the reverse edges with a counting sort over the forward ones.
+    void Finalize()
+    {
+        auto node_count = NodeCount();
+        m_DependentOffsets.assign(node_count + 1, 0);
+        for(auto target : m_DependencyTargets)
+        {
+            ++m_DependentOffsets[target + 1];
+        }
+
+        for(size_t i = 0; i < node_count; ++i)
+        {
+            m_DependentOffsets[i + 1] += m_DependentOffsets[i];
+        }
+
+        m_DependentTargets.resize(m_DependencyTargets.size());
+        auto next = std::vector<uint32_t>(m_DependentOffsets.begin(), m_DependentOffsets.end() - 1);
+        for(NodeId node = 0; node < node_count; ++node)
+        {
+            for(auto dependency : Dependencies(node))
+            {
+                m_DependentTargets[next[dependency]++] = node;
+            }
+        }
+    }
+
+    void SetTopologicalOrder(std::vector<NodeId> order) {m_TopologicalOrder = std::move(order);}
+
+    [[nodiscard]] size_t NodeCount() const {return (m_NodePath.size());}
+    [[nodiscard]] size_t EdgeCount() const {return (m_DependencyTargets.size());}
+
+    [[nodiscard]] NodeRange Dependencies(NodeId node) const
+    {
+        auto data = m_DependencyTargets.data();
+        return (NodeRange(data + m_DependencyOffsets[node], data + m_DependencyOffsets[node + 1]));
+    }
+
+    [[nodiscard]] NodeRange Dependents(NodeId node) const
+    {
+        auto data = m_DependentTargets.data();
+        return (NodeRange(data + m_DependentOffsets[node], data + m_DependentOffsets[node + 1]));
+    }
+
+    [[nodiscard]] const std::vector<NodeId> &TopologicalOrder() const {return (m_TopologicalOrder);}
+    [[nodiscard]] const std::string &Path(NodeId node) const {return (m_paths->Get(m_NodePath[node]));}
+    [[nodiscard]] ProjectInfo &Info(NodeId node) const {return (*m_NodeInfo[node]);}
+
+    [[nodiscard]] NodeId Find(std::string_view project_path) const
+    {
+        return (NodeOf(m_paths->Find(project_path)));
+    }
+
+    [[nodiscard]] NodeId NodeOf(uint32_t path_id) const
+    {
+        return (path_id < m_PathNode.size() ? m_PathNode[path_id] : InvalidNode);
+    }
+
+    [[nodiscard]] const std::vector<uint32_t> &DependencyOffsets() const {return (m_DependencyOffsets);}
+    [[nodiscard]] const std::vector<NodeId> &DependencyTargets() const {return (m_DependencyTargets);}
+
+    //Removes the nodes and edges. The path table is left alone.
+    void Clear()
+    {
+        m_NodePath.clear();
+        m_PathNode.clear();
+        m_NodeInfo.clear();
+        m_DependencyOffsets.assign(1, 0);
+        m_DependencyTargets.clear();
+        m_DependentOffsets.assign(1, 0);
+        m_DependentTargets.clear();
+        m_TopologicalOrder.clear();
+    }
+};
@@ -0,0 +1,572 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "project_exceptions.h"
+
+//Bump allocator for the strings read from project files. Nothing is freed individually; Reset()
+//makes the whole arena available again while keeping its first block, which is normally all a
+//project file needs, so after the first few files no allocation happens at all.
+class StringArena
+{
+private:
+    static constexpr size_t BlockSize {64 * 1024};
+
+    std::vector<std::unique_ptr<char[]>> m_blocks;
+    size_t m_capacity {0};      //of the last block
+    size_t m_used {0};          //of the last block
+
+public:
+    StringArena() = default;
+    StringArena(const StringArena &) = delete;
+    StringArena &operator=(const StringArena &) = delete;
+    ~StringArena() = default;
+
+    char *Allocate(size_t size)
+    {
+        if(m_blocks.empty() || m_used + size > m_capacity)
+        {
+            m_capacity = std::max(size, BlockSize);
+            m_blocks.emplace_back(std::make_unique<char[]>(m_capacity));
+            m_used = 0;
+        }
+
+        auto data = m_blocks.back().get() + m_used;
+        m_used += size;
+        return (data);
+    }
+
+    std::string_view Store(std::string_view str)
+    {
+        auto data = Allocate(str.size());
+        std::memcpy(data, str.data(), str.size());
+        return (std::string_view(data, str.size()));
+    }
+
+    //Stores first and second joined by a single separator, unless second is absolute.
+    std::string_view Join(std::string_view first, std::string_view second)
+    {
+        if(!second.empty() && second.front() == '/')
+        {
+            return (Store(second));
+        }
+
+        auto separator = (!first.empty() && first.back() != '/');
+        auto size = first.size() + separator + second.size();
+        auto data = Allocate(size);
+        std::memcpy(data, first.data(), first.size());
+        if(separator)
+        {
+            data[first.size()] = '/';
+        }
+        std::memcpy(data + first.size() + separator, second.data(), second.size());
+        return (std::string_view(data, size));
+    }
+
+    void Reset()
+    {
+        if(m_blocks.size() > 1)
+        {
+            m_blocks.resize(1);
+            m_capacity = BlockSize;
+        }
+        m_used = 0;
+    }
+};
+
+//What the mapper reads from a project file. The strings live in the arena of the parser that
+//produced them and are only valid until that parser reads the next file.
+struct ProjectFileData
+{
+    std::vector<std::string_view> m_dependencies;           //absolute paths of the referenced project files
+    std::vector<std::string_view> m_ExternalDependencies;   //same, for projects outside the root folder
+    std::string_view m_BuildCommand;                        //shell command that builds the project, if any
+    std::string_view m_ConvertCommand;                      //shell command that converts the project, if any
+    uint32_t m_CpuSlots {1};                                //cores the build of the project needs
+    uint32_t m_MemoryMB {0};                                //memory it needs, 0 if not declared
+
+    void Clear()
+    {
+        m_dependencies.clear();
+        m_ExternalDependencies.clear();
+        m_BuildCommand = {};
+        m_ConvertCommand = {};
+        m_CpuSlots = 1;
+        m_MemoryMB = 0;
+    }
+};
+
+//Pull parser for project files. Rather than building a json document of the whole file, it walks
+//the text once and keeps only the keys the mapper needs:
+    //- "References": [{"Relative Path": path relative to the root folder}, ...]
+    //- "External References": [{"Path": absolute path, or relative to the folder of the project file}, ...]
+    //- "Build Command" and "Convert Command": strings
+    //- "Resources": {"CPU": cores, "Memory MB": megabytes}, both non-negative integers, at least 1 core
+//Every other value is skipped without being decoded. Skipped values are only checked for balanced
+//brackets and terminated strings, which is all that's needed to find the end of them.
+//A parser reuses its buffers from one file to the next, so it should be kept around, one per
+//thread, rather than created for every file.
+class ProjectFileParser
+{
+private:
+    std::string m_contents;
+    std::string m_scratch;      //decoded string with escape sequences
+    size_t m_position {0};
+    std::string m_file;
+    StringArena m_arena;
+    ProjectFileData m_data;
+
+    [[noreturn]] void Fail(const std::string &message) const
+    {
+        throw(MapperException("ProjectFileParser::Parse",
+                              message + " at offset " + std::to_string(m_position) + " of " + m_file));
+    }
+
+    void SkipWhitespace()
+    {
+        while(m_position < m_contents.size() &&
+              (m_contents[m_position] == ' ' || m_contents[m_position] == '\t' ||
+               m_contents[m_position] == '\n' || m_contents[m_position] == '\r'))
+        {
+            ++m_position;
+        }
+    }
+
+    char Peek()
+    {
+        SkipWhitespace();
+        if(m_position >= m_contents.size())
+        {
+            Fail("Unexpected end of file");
+        }
+        return (m_contents[m_position]);
+    }
+
+    void Expect(char c)
+    {
+        if(Peek() != c)
+        {
+            Fail(std::string("Expected '") + c + "'");
+        }
+        ++m_position;
+    }
+
+    //Consumes the ',' between two elements and returns true, or the closing bracket and returns false.
+    bool NextElement(char closing)
+    {
+        auto c = Peek();
+        ++m_position;
+        if(c == ',')
+        {
+            return (true);
+        }
+        if(c != closing)
+        {
+            Fail(std::string("Expected ',' or '") + closing + "'");
+        }
+        return (false);
+    }
+
+    //Returns true and consumes the closing bracket if the object or array is empty.
+    bool IsEmpty(char closing)
+    {
+        if(Peek() == closing)
+        {
+            ++m_position;
+            return (true);
+        }
+        return (false);
+    }
+
+    void AppendUtf8(uint32_t code_point)
+    {
+        if(code_point < 0x80)
+        {
+            m_scratch += static_cast<char>(code_point);
+        }
+        else if(code_point < 0x800)
+        {
+            m_scratch += static_cast<char>(0xC0 | (code_point >> 6));
+            m_scratch += static_cast<char>(0x80 | (code_point & 0x3F));
+        }
+        else if(code_point < 0x10000)
+        {
+            m_scratch += static_cast<char>(0xE0 | (code_point >> 12));
+            m_scratch += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+            m_scratch += static_cast<char>(0x80 | (code_point & 0x3F));
+        }
+        else
+        {
+            m_scratch += static_cast<char>(0xF0 | (code_point >> 18));
+            m_scratch += static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+            m_scratch += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+            m_scratch += static_cast<char>(0x80 | (code_point & 0x3F));
+        }
+    }
+
+    uint32_t ReadHex4()
+    {
+        if(m_position + 4 > m_contents.size())
+        {
+            Fail("Truncated \\u escape");
+        }
+
+        auto value = uint32_t {0};
+        for(size_t i = 0; i < 4; ++i)
+        {
+            auto c = m_contents[m_position++];
+            value <<= 4;
+            if(c >= '0' && c <= '9')
+            {
+                value |= static_cast<uint32_t>(c - '0');
+            }
+            else if(c >= 'a' && c <= 'f')
+            {
+                value |= static_cast<uint32_t>(c - 'a' + 10);
+            }
+            else if(c >= 'A' && c <= 'F')
+            {
+                value |= static_cast<uint32_t>(c - 'A' + 10);
+            }
+            else
+            {
+                Fail("Invalid \\u escape");
+            }
+        }
+        return (value);
+    }
+
+    //Returns a view of the file contents when the string has no escape sequence, which is almost
+    //always the case, and of the decoded copy in m_scratch otherwise. Either way, the view is only
+    //valid until the next string is read.
+    std::string_view ParseString()
+    {
+        Expect('"');
+        auto start = m_position;
+        auto end = m_contents.find_first_of("\"\\", start);
+        if(end == std::string::npos)
+        {
+            Fail("Unterminated string");
+        }
+
+        if(m_contents[end] == '"')
+        {
+            m_position = end + 1;
+            return (std::string_view(m_contents).substr(start, end - start));
+        }
+
+        m_scratch.assign(m_contents, start, end - start);
+        m_position = end;
+        while(true)
+        {
+            if(m_position >= m_contents.size())
+            {
+                Fail("Unterminated string");
+            }
+
+            auto c = m_contents[m_position++];
+            if(c == '"')
+            {
+                return (m_scratch);
+            }
+            if(c != '\\')
+            {
+                m_scratch += c;
+                continue;
+            }
+
+            if(m_position >= m_contents.size())
+            {
+                Fail("Unterminated string");
+            }
+
+            auto escape = m_contents[m_position++];
+            switch(escape)
+            {
+                case '"': m_scratch += '"'; break;
+                case '\\': m_scratch += '\\'; break;
+                case '/': m_scratch += '/'; break;
+                case 'b': m_scratch += '\b'; break;
+                case 'f': m_scratch += '\f'; break;
+                case 'n': m_scratch += '\n'; break;
+                case 'r': m_scratch += '\r'; break;
+                case 't': m_scratch += '\t'; break;
+                case 'u':
+                {
+                    auto code_point = ReadHex4();
+                    if(code_point >= 0xD800 && code_point <= 0xDBFF &&
+                       m_contents.compare(m_position, 2, "\\u") == 0)
+                    {
+                        m_position += 2;
+                        auto low = ReadHex4();
+                        code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    AppendUtf8(code_point);
+                    break;
+                }
+                default:
+                    Fail("Invalid escape sequence");
+            }
+        }
+    }
+
+    void SkipString()
+    {
+        ++m_position;   //opening quote
+        while(m_position < m_contents.size())
+        {
+            auto c = m_contents[m_position++];
+            if(c == '\\')
+            {
+                ++m_position;
+            }
+            else if(c == '"')
+            {
+                return;
+            }
+        }
+        Fail("Unterminated string");
+    }
+
+    void SkipValue()
+    {
+        auto c = Peek();
+        if(c == '"')
+        {
+            SkipString();
+            return;
+        }
+
+        if(c != '{' && c != '[')
+        {
+            auto end = m_contents.find_first_of(",}] \t\r\n", m_position);
+            m_position = (end == std::string::npos ? m_contents.size() : end);
+            return;
+        }
+
+        auto depth = size_t {0};
+        while(m_position < m_contents.size())
+        {
+            c = m_contents[m_position];
+            if(c == '"')
+            {
+                SkipString();
+                continue;
+            }
+
+            ++m_position;
+            if(c == '{' || c == '[')
+            {
+                ++depth;
+            }
+            else if((c == '}' || c == ']') && --depth == 0)
+            {
+                return;
+            }
+        }
+        Fail("Unbalanced brackets");
+    }
+
+    std::string_view ParseStringValue(std::string_view key)
+    {
+        if(Peek() != '"')
+        {
+            Fail("\"" + std::string(key) + "\" must be a string");
+        }
+        return (m_arena.Store(ParseString()));
+    }
+
+    uint32_t ParseCount(std::string_view key)
+    {
+        auto c = Peek();
+        if(c < '0' || c > '9')
+        {
+            Fail("\"" + std::string(key) + "\" must be a non-negative integer");
+        }
+
+        auto value = uint64_t {0};
+        while(m_position < m_contents.size() && m_contents[m_position] >= '0' && m_contents[m_position] <= '9')
+        {
+            value = value * 10 + static_cast<uint64_t>(m_contents[m_position++] - '0');
+            if(value > std::numeric_limits<uint32_t>::max())
+            {
+                Fail("\"" + std::string(key) + "\" is too large");
+            }
+        }
+
+        if(m_position < m_contents.size() &&
+           (m_contents[m_position] == '.' || m_contents[m_position] == 'e' || m_contents[m_position] == 'E'))
+        {
+            Fail("\"" + std::string(key) + "\" must be a non-negative integer");
+        }
+        return (static_cast<uint32_t>(value));
+    }
+
+    void ParseResources()
+    {
+        Expect('{');
+        if(IsEmpty('}'))
+        {
+            return;
+        }
+
+        do
+        {
+            auto key = ParseString();
+            Expect(':');
+            if(key == "CPU")
+            {
+                m_data.m_CpuSlots = ParseCount("CPU");
+                if(m_data.m_CpuSlots == 0)
+                {
+                    Fail("\"CPU\" must be at least 1");   //a project that takes no slot would never be held back
+                }
+            }
+            else if(key == "Memory MB")
+            {
+                m_data.m_MemoryMB = ParseCount("Memory MB");
+            }
+            else
+            {
+                SkipValue();
+            }
+        } while(NextElement('}'));
+    }
+
+    //Reads the path of every reference in the array. A reference to a project in the root folder
+    //must have a "Relative Path". An empty external reference is a placeholder and is skipped.
+    void ParseReferences(bool external, std::string_view root_folder)
+    {
+        Expect('[');
+        if(IsEmpty(']'))
+        {
+            return;
+        }
+
+        do
+        {
+            Expect('{');
+            auto path = std::optional<std::string_view>();
+            if(!IsEmpty('}'))
+            {
+                do
+                {
+                    auto key = ParseString();
+                    Expect(':');
+                    if(key == "Relative Path" || (external && key == "Path"))
+                    {
+                        if(Peek() != '"')
+                        {
+                            Fail("\"" + std::string(key) + "\" must be a string");
+                        }
+
+                        //Resolved right away, while the view of the value is still valid.
+                        auto value = ParseString();
+                        path = (external ? ResolveExternal(value) : m_arena.Join(root_folder, value));
+                    }
+                    else
+                    {
+                        SkipValue();
+                    }
+                } while(NextElement('}'));
+            }
+
+            if(!external)
+            {
+                if(!path)
+                {
+                    Fail("Reference without a \"Relative Path\"");
+                }
+                m_data.m_dependencies.emplace_back(*path);
+            }
+            else if(path)
+            {
+                m_data.m_ExternalDependencies.emplace_back(*path);
+            }
+        } while(NextElement(']'));
+    }
+
+    //External paths are normalized so that different spellings of the same project end up as one
+    //node. There are few of them, so the allocations of std::filesystem don't matter.
+    std::string_view ResolveExternal(std::string_view path)
+    {
+        auto project_folder = std::filesystem::path(m_file).parent_path();
+        auto resolved = (project_folder / std::filesystem::path(path)).lexically_normal();
+        return (m_arena.Store(resolved.string()));
+    }
+
+    void ReadFile(const std::string &proj_file)
+    {
+        auto s = std::ifstream(proj_file, std::ios::in | std::ios::binary | std::ios::ate);
+        if(!s)
+        {
+            throw(MapperException("ProjectFileParser::Parse", "Unable to read project file: " + proj_file));
+        }
+
+        auto size = static_cast<size_t>(s.tellg());
+        m_contents.resize(size);
+        s.seekg(0);
+        s.read(m_contents.data(), static_cast<std::streamsize>(size));
+    }
+
+public:
+    ProjectFileParser() = default;
+    ProjectFileParser(const ProjectFileParser &) = delete;
+    ProjectFileParser &operator=(const ProjectFileParser &) = delete;
+    ~ProjectFileParser() = default;
+
+    //References are resolved against root_folder. The result is valid until the next call.
+    const ProjectFileData &Parse(const std::string &proj_file, std::string_view root_folder)
+    {
+        m_file = proj_file;
+        m_position = 0;
+        m_arena.Reset();
+        m_data.Clear();
+        ReadFile(proj_file);
+
+        Expect('{');
+        if(IsEmpty('}'))
+        {
+            return (m_data);
+        }
+
+        do
+        {
+            auto key = ParseString();
+            Expect(':');
+            if(key == "References")
+            {
+                ParseReferences(false, root_folder);
+            }
+            else if(key == "External References")
+            {
+                ParseReferences(true, root_folder);
+            }
+            else if(key == "Build Command")
+            {
+                m_data.m_BuildCommand = ParseStringValue(key);
+            }
+            else if(key == "Convert Command")
+            {
+                m_data.m_ConvertCommand = ParseStringValue(key);
+            }
+            else if(key == "Resources")
+            {
+                ParseResources();
+            }
+            else
+            {
+                SkipValue();
+            }
+        } while(NextElement('}'));
+
+        return (m_data);
+    }
+};
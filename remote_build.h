@@ -0,0 +1,957 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "json.hpp"
+#include "log_writer.h"
+#include "process_executor.h"
+#include "project_exceptions.h"
+#include "thread_pool.h"
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+//Remote execution of build commands: a coordinator, the ProjectBuilder of a regular run, hands the
+//commands of ready projects to build workers, `project_builder --worker PORT` processes, over TCP.
+//The workers may be on other hosts, or be local processes standing in for them. They're expected
+//to see the source tree at the same paths as the coordinator, e.g. through a shared checkout, but
+//not its outputs: a worker builds into a scratch folder of its own and sends the outputs back.
+//A worker runs whatever command it's sent, so it only serves coordinators that know its token, a
+//secret shared out of band, and only listens on the loopback interface unless told otherwise. The
+//token is the first thing a coordinator sends; the worker closes any connection that doesn't start
+//with it within AuthTimeout, without running anything. Until then, a message can't carry a payload
+//nor be longer than a few KB. The token is sent in the clear: on a network
+//that isn't trusted, the connection has to go through a tunnel, e.g. ssh or a VPN.
+//Every message is a line of json, followed by a binary payload if its "Payload Size" says so:
+    //coordinator -> worker     {"Type": "Auth", "Token"}               once, as soon as it connects
+    //worker -> coordinator     {"Type": "Rejected"}                    instead of Hello, for a wrong token
+    //worker -> coordinator     {"Type": "Hello", "Slots": n}           once, when the coordinator connects
+    //worker -> coordinator     {"Type": "Heartbeat"}                   every second
+    //coordinator -> worker     {"Type": "Build", "Id", "Command", "Working Folder", "Environment"}
+    //worker -> coordinator     {"Type": "Result", "Id", "Exit Code", "Output", "Error Output",
+    //                           "Launch Error", "Artifacts": [{"Path", "Size", "Mode"}]} + the files, back to back
+
+//One end of a connection. Sends may come from any thread; only one thread receives.
+class MessageChannel
+{
+public:
+    static constexpr size_t DefaultMaxHeaderSize {16 * 1024 * 1024};      //a header carries the output of a command
+    static constexpr size_t DefaultMaxPayloadSize {size_t {1024} * 1024 * 1024};
+
+private:
+    int m_fd {-1};
+    std::mutex m_SendLock;
+    std::string m_buffer;   //received but not consumed yet
+    std::atomic<size_t> m_MaxHeaderSize {DefaultMaxHeaderSize};
+    std::atomic<size_t> m_MaxPayloadSize {DefaultMaxPayloadSize};
+    std::optional<std::chrono::steady_clock::time_point> m_deadline;
+
+    bool Fill()
+    {
+#if defined(__linux__) || defined(__APPLE__)
+        char data[64 * 1024];
+        while(true)
+        {
+            if(m_deadline)
+            {
+                auto left = std::chrono::duration_cast<std::chrono::milliseconds>(*m_deadline - std::chrono::steady_clock::now());
+                auto pending = pollfd {m_fd, POLLIN, 0};
+                auto ready = (left.count() > 0 ? ::poll(&pending, 1, static_cast<int>(left.count())) : 0);
+                if(ready < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if(ready <= 0)
+                {
+                    return (false);
+                }
+            }
+
+            auto count = ::recv(m_fd, data, sizeof(data), 0);
+            if(count > 0)
+            {
+                m_buffer.append(data, static_cast<size_t>(count));
+                return (true);
+            }
+            if(count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            return (false);
+        }
+#else
+        return (false);
+#endif
+    }
+
+public:
+    explicit MessageChannel(int fd) : m_fd(fd)
+    {
+
+    }
+
+    MessageChannel(const MessageChannel &) = delete;
+    MessageChannel &operator=(const MessageChannel &) = delete;
+
+    ~MessageChannel()
+    {
+#if defined(__linux__) || defined(__APPLE__)
+        ::close(m_fd);
+#endif
+    }
+
+    //endpoint is host:port.
+    static std::unique_ptr<MessageChannel> Connect(const std::string &endpoint)
+    {
+#if defined(__linux__) || defined(__APPLE__)
+        auto separator = endpoint.rfind(':');
+        ThrowIfFalse<BaseException>(separator != std::string::npos, "MessageChannel::Connect", "Expected host:port, got " + endpoint);
+        auto host = endpoint.substr(0, separator);
+        auto port = endpoint.substr(separator + 1);
+
+        auto hints = addrinfo();
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo *addresses = nullptr;
+        ThrowIfFalse<BaseException>(::getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) == 0,
+                                    "MessageChannel::Connect", "Unable to resolve " + endpoint);
+
+        auto fd = -1;
+        for(auto address = addresses; address != nullptr && fd < 0; address = address->ai_next)
+        {
+            fd = ::socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+            if(fd >= 0 && ::connect(fd, address->ai_addr, address->ai_addrlen) != 0)
+            {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+        ::freeaddrinfo(addresses);
+        ThrowIfFalse<BaseException>(fd >= 0, "MessageChannel::Connect", "Unable to connect to " + endpoint);
+
+        auto no_delay = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+        return (std::make_unique<MessageChannel>(fd));
+#else
+        ThrowIfFalse<BaseException>(false, "MessageChannel::Connect", "Remote builds aren't supported on this platform");
+        return (nullptr);
+#endif
+    }
+
+    bool Send(nlohmann::json header, const std::string &payload = std::string())
+    {
+#if defined(__linux__) || defined(__APPLE__)
+        if(!payload.empty())
+        {
+            header["Payload Size"] = payload.size();
+        }
+        auto message = header.dump() + "\n";
+        message += payload;
+
+        auto lock = std::lock_guard<std::mutex>(m_SendLock);
+        auto sent = size_t {0};
+        while(sent < message.size())
+        {
+            auto count = ::send(m_fd, message.data() + sent, message.size() - sent, MSG_NOSIGNAL);
+            if(count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if(count <= 0)
+            {
+                return (false);
+            }
+            sent += static_cast<size_t>(count);
+        }
+        return (true);
+#else
+        return (false);
+#endif
+    }
+
+    //Blocks until a whole message is in. Returns false once the connection is closed or broken, or
+    //the message is over the limits, see SetLimits(); the connection is then of no further use.
+    bool Receive(nlohmann::json &header, std::string &payload)
+    {
+        auto end_of_line = m_buffer.find('\n');
+        while(end_of_line == std::string::npos)
+        {
+            if(m_buffer.size() > m_MaxHeaderSize || !Fill())
+            {
+                return (false);
+            }
+            end_of_line = m_buffer.find('\n');
+        }
+
+        if(end_of_line > m_MaxHeaderSize)
+        {
+            return (false);
+        }
+        header = nlohmann::json::parse(m_buffer.begin(), m_buffer.begin() + end_of_line, nullptr, false);
+        if(header.is_discarded() || !header.is_object())
+        {
+            return (false);
+        }
+
+        auto payload_size = size_t {0};
+        if(header.contains("Payload Size"))
+        {
+            auto &size_json = header["Payload Size"];
+            if(!size_json.is_number_unsigned() || size_json.get<size_t>() > m_MaxPayloadSize)
+            {
+                return (false);
+            }
+            payload_size = size_json.get<size_t>();
+        }
+        while(m_buffer.size() < end_of_line + 1 + payload_size)
+        {
+            if(!Fill())
+            {
+                return (false);
+            }
+        }
+        payload = m_buffer.substr(end_of_line + 1, payload_size);
+        m_buffer.erase(0, end_of_line + 1 + payload_size);
+        return (true);
+    }
+
+    //The longest header line and the largest payload Receive() accepts. Can be called while another
+    //thread receives.
+    void SetLimits(size_t max_header_size, size_t max_payload_size)
+    {
+        m_MaxHeaderSize = max_header_size;
+        m_MaxPayloadSize = max_payload_size;
+    }
+
+    //Receive() returns false if the whole message isn't in by then, however slowly data comes in.
+    //Called from the thread that receives.
+    void SetDeadline(std::optional<std::chrono::steady_clock::time_point> deadline) {m_deadline = deadline;}
+
+    //Receive() returns false if no data comes for that long; zero waits forever.
+    void SetReceiveTimeout(std::chrono::milliseconds timeout)
+    {
+#if defined(__linux__) || defined(__APPLE__)
+        auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+        auto value = timeval {static_cast<time_t>(seconds.count()),
+                              static_cast<suseconds_t>(std::chrono::duration_cast<std::chrono::microseconds>(timeout - seconds).count())};
+        ::setsockopt(m_fd, SOL_SOCKET, SO_RCVTIMEO, &value, sizeof(value));
+#endif
+    }
+
+    //Makes a blocked Receive() on another thread return false.
+    void Shutdown()
+    {
+#if defined(__linux__) || defined(__APPLE__)
+        ::shutdown(m_fd, SHUT_RDWR);
+#endif
+    }
+};
+
+//The outputs of a build, as they travel with its result.
+class ArtifactBundle
+{
+public:
+    static nlohmann::json Pack(const std::filesystem::path &folder, std::string &payload)
+    {
+        auto artifacts = nlohmann::json::array();
+        for(auto &entry : std::filesystem::recursive_directory_iterator(folder))
+        {
+            if(!entry.is_regular_file())
+            {
+                continue;
+            }
+
+            auto s = std::ifstream(entry.path(), std::ios::in | std::ios::binary);
+            auto content = std::string(std::istreambuf_iterator<char>(s), std::istreambuf_iterator<char>());
+            artifacts.push_back({{"Path", std::filesystem::relative(entry.path(), folder).generic_string()},
+                                 {"Size", content.size()},
+                                 {"Mode", static_cast<uint32_t>(entry.status().permissions())}});
+            payload += content;
+        }
+        return (artifacts);
+    }
+
+    //A path from the wire names a file inside the folder: it isn't empty, has no root and never
+    //goes up.
+    static bool IsSafePath(const std::filesystem::path &relative_path)
+    {
+        if(relative_path.empty() || relative_path.has_root_path())
+        {
+            return (false);
+        }
+        for(auto &component : relative_path)
+        {
+            if(component == "..")
+            {
+                return (false);
+            }
+        }
+        auto normal_path = relative_path.lexically_normal();
+        return (!normal_path.empty() && normal_path != "." && normal_path.has_filename());
+    }
+
+    //Replaces the contents of folder with the artifacts. Every artifact is checked before any file
+    //is written.
+    static void Unpack(const nlohmann::json &artifacts, const std::string &payload, const std::filesystem::path &folder)
+    {
+        auto total_size = size_t {0};
+        for(auto &artifact : artifacts)
+        {
+            auto relative_path = std::filesystem::path(artifact.at("Path").get<std::string>());
+            auto size = artifact.at("Size").get<size_t>();
+            ThrowIfFalse<BaseException>(IsSafePath(relative_path) && size <= payload.size() - total_size,
+                                        "ArtifactBundle::Unpack", "Invalid artifact " + relative_path.string());
+            total_size += size;
+        }
+
+        std::filesystem::remove_all(folder);
+        std::filesystem::create_directories(folder);
+
+        auto offset = size_t {0};
+        for(auto &artifact : artifacts)
+        {
+            auto relative_path = std::filesystem::path(artifact.at("Path").get<std::string>()).lexically_normal();
+            auto size = artifact.at("Size").get<size_t>();
+
+            auto file_path = folder / relative_path;
+            std::filesystem::create_directories(file_path.parent_path());
+            {
+                auto out_file = std::ofstream(file_path, std::ios::out | std::ios::binary | std::ios::trunc);
+                out_file.write(payload.data() + offset, static_cast<std::streamsize>(size));
+            }
+            std::filesystem::permissions(file_path, static_cast<std::filesystem::perms>(artifact.value("Mode", 0644U)) & std::filesystem::perms::all);
+            offset += size;
+        }
+    }
+};
+
+//The secret that coordinators and build workers share, see the protocol above.
+class WorkerToken
+{
+public:
+    static constexpr const char *EnvironmentVariable {"PROJECT_BUILDER_WORKER_TOKEN"};
+
+    //From the first line of the file if there is one, from EnvironmentVariable otherwise. Empty if
+    //neither has one.
+    static std::string Load(const std::optional<std::string> &token_file)
+    {
+        auto token = std::string();
+        if(token_file)
+        {
+            auto s = std::ifstream(*token_file);
+            ThrowIfFalse<BaseException>(s.is_open(), "WorkerToken::Load", "Unable to open " + *token_file);
+            std::getline(s, token);
+        }
+        else if(auto value = std::getenv(EnvironmentVariable))
+        {
+            token = value;
+        }
+
+        while(!token.empty() && (token.back() == '\r' || token.back() == ' '))
+        {
+            token.pop_back();
+        }
+        return (token);
+    }
+
+    //In the same time whichever character differs, so that the time taken says nothing about it.
+    static bool Matches(const std::string &expected, const std::string &token)
+    {
+        auto difference = static_cast<unsigned char>(expected.size() != token.size());
+        for(size_t i = 0; i < expected.size(); ++i)
+        {
+            difference |= static_cast<unsigned char>(expected[i] ^ (i < token.size() ? token[i] : 0));
+        }
+        return (difference == 0);
+    }
+};
+
+//A build worker: serves one coordinator at a time and runs up to m_slots of its commands at once.
+//Between two coordinators, it waits for the next one to connect.
+class BuildWorker
+{
+private:
+    static constexpr std::chrono::milliseconds AuthTimeout {5000};
+    static constexpr size_t MaxAuthSize {4096};     //of the header of the Auth message
+
+    size_t m_slots;
+    std::filesystem::path m_ScratchFolder;
+    std::string m_token;
+    int m_listener {-1};
+    uint16_t m_port {0};
+    std::chrono::milliseconds m_HeartbeatInterval {1000};
+    size_t m_MaxPayloadSize {MessageChannel::DefaultMaxPayloadSize};
+
+    //The first message has to carry the token, be short, without a payload, and be in within
+    //AuthTimeout of the connection, however slowly it trickles in. Nothing else is read from a
+    //connection until then.
+    bool Authenticate(MessageChannel &channel)
+    {
+        auto header = nlohmann::json();
+        auto payload = std::string();
+        channel.SetLimits(MaxAuthSize, 0);
+        channel.SetDeadline(std::chrono::steady_clock::now() + AuthTimeout);
+        auto authenticated = (channel.Receive(header, payload) && header.value("Type", "") == "Auth" &&
+                              header.contains("Token") && header["Token"].is_string() &&
+                              WorkerToken::Matches(m_token, header["Token"].get<std::string>()));
+        channel.SetDeadline(std::nullopt);
+        channel.SetLimits(MessageChannel::DefaultMaxHeaderSize, m_MaxPayloadSize);
+        if(!authenticated)
+        {
+            channel.Send({{"Type", "Rejected"}});
+        }
+        return (authenticated);
+    }
+
+    void RunBuild(MessageChannel &channel, ProcessExecutor &executor, const nlohmann::json &message)
+    {
+        auto id = message.at("Id").get<uint64_t>();
+        auto reply = nlohmann::json {{"Type", "Result"}, {"Id", id}};
+        auto payload = std::string();
+        auto output_folder = m_ScratchFolder / ("job_" + std::to_string(id));
+        try
+        {
+            std::filesystem::remove_all(output_folder);
+            std::filesystem::create_directories(output_folder);
+
+            auto request = ProcessRequest();
+            request.m_command = message.at("Command").get<std::string>();
+            request.m_WorkingFolder = message.at("Working Folder").get<std::string>();
+            request.m_environment = message.at("Environment").get<std::map<std::string, std::string>>();
+            request.m_environment["OUTPUT_DIR"] = output_folder.string();
+
+            auto result = executor.Run(request).get();
+            reply["Exit Code"] = result.m_ExitCode;
+            reply["Output"] = result.m_output;
+            reply["Error Output"] = result.m_error;
+            if(result.m_LaunchError)
+            {
+                reply["Launch Error"] = *result.m_LaunchError;
+            }
+            if(!result.GetError())
+            {
+                reply["Artifacts"] = ArtifactBundle::Pack(output_folder, payload);
+            }
+        }
+        catch(const std::exception &e)
+        {
+            reply["Launch Error"] = std::string("The worker failed: ") + e.what();
+            payload.clear();
+        }
+
+        channel.Send(reply, payload);
+        auto error = std::error_code();
+        std::filesystem::remove_all(output_folder, error);
+    }
+
+    void Serve(MessageChannel &channel)
+    {
+        channel.Send({{"Type", "Hello"}, {"Slots", m_slots}});
+
+        auto heartbeat_lock = std::mutex();
+        auto disconnected = std::condition_variable();
+        auto connected = true;
+        auto heartbeat = std::thread([&]()
+        {
+            auto lock = std::unique_lock<std::mutex>(heartbeat_lock);
+            while(!disconnected.wait_for(lock, m_HeartbeatInterval, [&]() {return (!connected);}))
+            {
+                channel.Send({{"Type", "Heartbeat"}});
+            }
+        });
+
+        {
+            auto executor = ProcessExecutor(m_slots);
+            auto pool = ThreadPool(m_slots);
+            auto header = nlohmann::json();
+            auto payload = std::string();
+            while(channel.Receive(header, payload))
+            {
+                if(header.value("Type", "") == "Build" && header.contains("Id"))
+                {
+                    pool.Submit([this, &channel, &executor, header]() {RunBuild(channel, executor, header);});
+                }
+            }
+            pool.Wait();    //the results of the running builds go nowhere, but they're not left behind
+        }
+
+        {
+            auto lock = std::lock_guard<std::mutex>(heartbeat_lock);
+            connected = false;
+        }
+        disconnected.notify_all();
+        heartbeat.join();
+    }
+
+public:
+    //Listens on port of the IPv4 address, the loopback interface by default, "0.0.0.0" for every
+    //interface; 0 picks a free port, see GetPort(). Only coordinators that send the token are served.
+    BuildWorker(uint16_t port,
+                size_t slots,
+                const std::filesystem::path &scratch_folder,
+                const std::string &token,
+                const std::string &bind_address = "127.0.0.1") : m_slots(std::max<size_t>(slots, 1)),
+                                                                 m_ScratchFolder(scratch_folder),
+                                                                 m_token(token)
+    {
+#if defined(__linux__) || defined(__APPLE__)
+        ThrowIfFalse<BaseException>(!m_token.empty(), "BuildWorker::BuildWorker", "A build worker requires a token");
+        auto address = sockaddr_in();
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        ThrowIfFalse<BaseException>(::inet_pton(AF_INET, bind_address.c_str(), &address.sin_addr) == 1,
+                                    "BuildWorker::BuildWorker", "Invalid IPv4 address " + bind_address);
+        std::filesystem::create_directories(m_ScratchFolder);
+
+        m_listener = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        ThrowIfFalse<BaseException>(m_listener >= 0, "BuildWorker::BuildWorker", "Unable to create a socket");
+        auto reuse = 1;
+        ::setsockopt(m_listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        auto length = socklen_t {sizeof(address)};
+        ThrowIfFalse<BaseException>(::bind(m_listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0 &&
+                                    ::listen(m_listener, 8) == 0 &&
+                                    ::getsockname(m_listener, reinterpret_cast<sockaddr *>(&address), &length) == 0,
+                                    "BuildWorker::BuildWorker", "Unable to listen on " + bind_address + ":" + std::to_string(port));
+        m_port = ntohs(address.sin_port);
+#else
+        ThrowIfFalse<BaseException>(false, "BuildWorker::BuildWorker", "Remote builds aren't supported on this platform");
+#endif
+    }
+
+    BuildWorker(const BuildWorker &) = delete;
+    BuildWorker &operator=(const BuildWorker &) = delete;
+
+    ~BuildWorker()
+    {
+#if defined(__linux__) || defined(__APPLE__)
+        if(m_listener >= 0)
+        {
+            ::close(m_listener);
+        }
+#endif
+    }
+
+    //Serves coordinators, one after the other, until the process is stopped.
+    void Run()
+    {
+#if defined(__linux__) || defined(__APPLE__)
+        while(true)
+        {
+            auto fd = ::accept(m_listener, nullptr, nullptr);
+            if(fd < 0)
+            {
+                continue;
+            }
+
+            auto no_delay = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+            auto channel = MessageChannel(fd);
+            if(!Authenticate(channel))
+            {
+                std::cout << "Rejected a connection without the worker token" << std::endl;
+                continue;
+            }
+            std::cout << "Coordinator connected" << std::endl;
+            Serve(channel);
+            std::cout << "Coordinator disconnected" << std::endl;
+        }
+#endif
+    }
+
+    //The largest payload an authenticated coordinator may send with a message, in bytes.
+    void SetMaxPayloadSize(size_t bytes) {m_MaxPayloadSize = bytes;}
+
+    [[nodiscard]] uint16_t GetPort() const {return (m_port);}
+    [[nodiscard]] size_t GetSlots() const {return (m_slots);}
+};
+
+//The coordinator's side: runs commands on the build workers instead of locally, one per free slot.
+//Commands wait in a queue, highest priority first, until a worker has a free slot. A command goes
+//preferably to the worker that built the most of its inputs, i.e. the projects it depends on,
+//where they're likely to still be warm; since the queue is in priority order, the projects on the
+//critical path get the first pick. A worker that closes its connection, or misses its heartbeats
+//for m_HeartbeatTimeout, is dropped and the commands it was running are queued again, up to
+//MaxAttempts times each. The outputs a worker sends back replace the OUTPUT_DIR of the command.
+class RemoteExecutor
+{
+private:
+    struct Job
+    {
+        uint64_t m_id {0};
+        ProcessRequest m_request;
+        std::vector<std::string> m_inputs;
+        double m_priority {0.0};
+        size_t m_attempts {0};
+        std::promise<ProcessResult> m_promise;
+    };
+
+    struct Worker
+    {
+        std::string m_endpoint;
+        std::unique_ptr<MessageChannel> m_channel;
+        size_t m_slots {0};
+        bool m_alive {true};
+        std::chrono::steady_clock::time_point m_LastSeen;
+        std::map<uint64_t, std::shared_ptr<Job>> m_running;
+        std::thread m_reader;
+    };
+
+    static constexpr size_t MaxAttempts {3};
+
+    std::chrono::milliseconds m_HeartbeatTimeout;
+    std::mutex m_lock;
+    std::vector<std::unique_ptr<Worker>> m_workers;         //the vector itself is never resized
+    std::deque<std::shared_ptr<Job>> m_pending;             //highest priority first, protected by m_lock
+    std::unordered_map<std::string, size_t> m_BuiltOn;      //project file -> worker, protected by m_lock
+    uint64_t m_NextId {0};
+    bool m_stopping {false};
+    std::condition_variable m_StopRequested;
+    std::thread m_monitor;
+    std::atomic<size_t> m_rescheduled {0};
+
+    static ProcessResult Failure(const std::string &error)
+    {
+        auto result = ProcessResult();
+        result.m_LaunchError = error;
+        return (result);
+    }
+
+    //Must be called with the lock held.
+    void Enqueue(const std::shared_ptr<Job> &job)
+    {
+        auto it = std::find_if(m_pending.begin(), m_pending.end(), [&](auto &queued)
+        {
+            return (queued->m_priority < job->m_priority);
+        });
+        m_pending.insert(it, job);
+    }
+
+    //The live worker with a free slot that built the most inputs of the job, the least busy one on
+    //a tie. Must be called with the lock held.
+    std::optional<size_t> PickWorker(const Job &job) const
+    {
+        auto best = std::optional<size_t>();
+        auto best_score = std::pair<size_t, size_t> {0, 0};
+        for(size_t i = 0; i < m_workers.size(); ++i)
+        {
+            auto &worker = *m_workers[i];
+            if(!worker.m_alive || worker.m_running.size() >= worker.m_slots)
+            {
+                continue;
+            }
+
+            auto local_inputs = static_cast<size_t>(std::count_if(job.m_inputs.begin(), job.m_inputs.end(), [&](auto &input)
+            {
+                auto built_on = m_BuiltOn.find(input);
+                return (built_on != m_BuiltOn.end() && built_on->second == i);
+            }));
+            auto score = std::pair<size_t, size_t> {local_inputs, worker.m_slots - worker.m_running.size()};
+            if(!best || score > best_score)
+            {
+                best = i;
+                best_score = score;
+            }
+        }
+        return (best);
+    }
+
+    //Hands queued jobs to the workers that have free slots. A send that fails drops the worker:
+    //the job stays in its running list and is queued again along with the rest, by Read(). Must be
+    //called with the lock held.
+    void Assign()
+    {
+        while(!m_pending.empty())
+        {
+            if(std::none_of(m_workers.begin(), m_workers.end(), [](auto &worker) {return (worker->m_alive);}))
+            {
+                for(auto &job : m_pending)
+                {
+                    job->m_promise.set_value(Failure("No build worker is left"));
+                }
+                m_pending.clear();
+                return;
+            }
+
+            auto worker_index = PickWorker(*m_pending.front());
+            if(!worker_index)
+            {
+                return;     //every slot is taken
+            }
+
+            auto job = m_pending.front();
+            m_pending.pop_front();
+            auto &worker = *m_workers[*worker_index];
+            worker.m_running[job->m_id] = job;
+
+            auto environment = job->m_request.m_environment;
+            environment.erase("OUTPUT_DIR");    //the worker has its own
+            auto message = nlohmann::json {{"Type", "Build"},
+                                            {"Id", job->m_id},
+                                            {"Command", job->m_request.m_command},
+                                            {"Working Folder", job->m_request.m_WorkingFolder.string()},
+                                            {"Environment", environment}};
+            if(!worker.m_channel->Send(message))
+            {
+                worker.m_alive = false;
+                worker.m_channel->Shutdown();
+            }
+        }
+    }
+
+    void Complete(size_t worker_index, const std::shared_ptr<Job> &job, const nlohmann::json &header, const std::string &payload)
+    {
+        auto result = ProcessResult();
+        result.m_ExitCode = header.value("Exit Code", -1);
+        result.m_output = header.value("Output", "");
+        result.m_error = header.value("Error Output", "");
+        if(header.contains("Launch Error"))
+        {
+            result.m_LaunchError = header["Launch Error"].get<std::string>();
+        }
+
+        auto output_folder = job->m_request.m_environment.find("OUTPUT_DIR");
+        if(!result.GetError() && output_folder != job->m_request.m_environment.end())
+        {
+            try
+            {
+                ArtifactBundle::Unpack(header.value("Artifacts", nlohmann::json::array()), payload, output_folder->second);
+            }
+            catch(const std::exception &e)
+            {
+                result.m_LaunchError = std::string("Unable to unpack the outputs: ") + e.what();
+            }
+        }
+
+        {
+            auto lock = std::lock_guard<std::mutex>(m_lock);
+            auto project_file = job->m_request.m_environment.find("PROJECT_FILE");
+            if(project_file != job->m_request.m_environment.end())
+            {
+                m_BuiltOn[project_file->second] = worker_index;
+            }
+        }
+        job->m_promise.set_value(std::move(result));
+    }
+
+    //One thread per worker, for as long as its connection lasts.
+    void Read(size_t worker_index)
+    {
+        auto &worker = *m_workers[worker_index];
+        auto header = nlohmann::json();
+        auto payload = std::string();
+        while(worker.m_channel->Receive(header, payload))
+        {
+            auto job = std::shared_ptr<Job>();
+            {
+                auto lock = std::lock_guard<std::mutex>(m_lock);
+                worker.m_LastSeen = std::chrono::steady_clock::now();
+                if(header.value("Type", "") != "Result")
+                {
+                    continue;
+                }
+
+                auto running = worker.m_running.find(header.value("Id", uint64_t {0}));
+                if(running == worker.m_running.end())
+                {
+                    continue;
+                }
+                job = running->second;
+                worker.m_running.erase(running);
+            }
+
+            Complete(worker_index, job, header, payload);
+
+            auto lock = std::lock_guard<std::mutex>(m_lock);
+            Assign();
+        }
+
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        worker.m_alive = false;
+        if(m_stopping)
+        {
+            return;
+        }
+
+        LogWriter::Instance().Console("Lost build worker " + worker.m_endpoint + ", rescheduling " +
+                                      std::to_string(worker.m_running.size()) + " project(s)\n");
+        for(auto &[id, job] : worker.m_running)
+        {
+            if(++job->m_attempts >= MaxAttempts)
+            {
+                job->m_promise.set_value(Failure("Lost " + std::to_string(MaxAttempts) + " build workers while building"));
+                continue;
+            }
+            ++m_rescheduled;
+            Enqueue(job);
+        }
+        worker.m_running.clear();
+        Assign();
+    }
+
+    //Drops the workers that went quiet. The reader thread of the worker then finds the connection
+    //closed and reschedules its work.
+    void Monitor()
+    {
+        auto lock = std::unique_lock<std::mutex>(m_lock);
+        while(!m_StopRequested.wait_for(lock, m_HeartbeatTimeout / 4, [this]() {return (m_stopping);}))
+        {
+            auto now = std::chrono::steady_clock::now();
+            for(auto &worker : m_workers)
+            {
+                if(worker->m_alive && now - worker->m_LastSeen > m_HeartbeatTimeout)
+                {
+                    LogWriter::Instance().Console("Build worker " + worker->m_endpoint + " missed its heartbeats\n");
+                    worker->m_alive = false;
+                    worker->m_channel->Shutdown();
+                }
+            }
+        }
+    }
+
+public:
+    //endpoints are host:port, and token the one the workers were given. The workers that can't be
+    //reached, or that reject the token, are reported and left out, but at least one has to be left.
+    RemoteExecutor(const std::vector<std::string> &endpoints,
+                   const std::string &token,
+                   std::chrono::milliseconds heartbeat_timeout = std::chrono::milliseconds(5000)) :
+                                                                            m_HeartbeatTimeout(heartbeat_timeout)
+    {
+        for(auto &endpoint : endpoints)
+        {
+            try
+            {
+                auto channel = MessageChannel::Connect(endpoint);
+                auto header = nlohmann::json();
+                auto payload = std::string();
+                channel->Send({{"Type", "Auth"}, {"Token", token}});
+
+                //A worker that serves another coordinator still accepts the connection, in its
+                //listen backlog, but doesn't greet it.
+                channel->SetReceiveTimeout(m_HeartbeatTimeout);
+                auto greeted = channel->Receive(header, payload);
+                channel->SetReceiveTimeout(std::chrono::milliseconds(0));
+                ThrowIfFalse<BaseException>(!greeted || header.value("Type", "") != "Rejected",
+                                            "RemoteExecutor::RemoteExecutor", endpoint + " rejected the worker token");
+                ThrowIfFalse<BaseException>(greeted, "RemoteExecutor::RemoteExecutor",
+                                            "No greeting from " + endpoint + ", it may be busy with another coordinator");
+                ThrowIfFalse<BaseException>(header.value("Type", "") == "Hello",
+                                            "RemoteExecutor::RemoteExecutor", "No greeting from " + endpoint);
+
+                auto worker = std::make_unique<Worker>();
+                worker->m_endpoint = endpoint;
+                worker->m_channel = std::move(channel);
+                worker->m_slots = std::max<size_t>(header.value("Slots", size_t {1}), 1);
+                worker->m_LastSeen = std::chrono::steady_clock::now();
+                m_workers.emplace_back(std::move(worker));
+            }
+            catch(const std::exception &e)
+            {
+                std::cout << "Unable to use build worker " << endpoint << ": " << e.what() << std::endl;
+            }
+        }
+        ThrowIfFalse<BaseException>(!m_workers.empty(), "RemoteExecutor::RemoteExecutor", "No build worker is available");
+
+        for(size_t i = 0; i < m_workers.size(); ++i)
+        {
+            m_workers[i]->m_reader = std::thread([this, i]() {Read(i);});
+        }
+        m_monitor = std::thread([this]() {Monitor();});
+    }
+
+    RemoteExecutor(const RemoteExecutor &) = delete;
+    RemoteExecutor &operator=(const RemoteExecutor &) = delete;
+
+    //Commands still queued or running fail.
+    ~RemoteExecutor()
+    {
+        {
+            auto lock = std::lock_guard<std::mutex>(m_lock);
+            m_stopping = true;
+            for(auto &worker : m_workers)
+            {
+                worker->m_channel->Shutdown();
+            }
+        }
+        m_StopRequested.notify_all();
+        m_monitor.join();
+
+        for(auto &worker : m_workers)
+        {
+            worker->m_reader.join();
+            for(auto &[id, job] : worker->m_running)
+            {
+                job->m_promise.set_value(Failure("The build was stopped"));
+            }
+        }
+        for(auto &job : m_pending)
+        {
+            job->m_promise.set_value(Failure("The build was stopped"));
+        }
+    }
+
+    //inputs are the project files of the projects the command's project depends on; the higher
+    //the priority, the sooner the command gets a slot.
+    std::future<ProcessResult> Run(ProcessRequest request, const std::vector<std::string> &inputs, double priority)
+    {
+        auto job = std::make_shared<Job>();
+        job->m_request = std::move(request);
+        job->m_inputs = inputs;
+        job->m_priority = priority;
+        auto future = job->m_promise.get_future();
+
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        job->m_id = m_NextId++;
+        Enqueue(job);
+        Assign();
+        return (future);
+    }
+
+    //The largest outputs a worker may send back for one command, in bytes. A worker that sends more
+    //is dropped, as if it had disconnected.
+    void SetMaxPayloadSize(size_t bytes)
+    {
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        for(auto &worker : m_workers)
+        {
+            worker->m_channel->SetLimits(MessageChannel::DefaultMaxHeaderSize, bytes);
+        }
+    }
+
+    //Of the workers that answered when the executor was created.
+    [[nodiscard]] size_t GetSlots() const
+    {
+        auto slots = size_t {0};
+        for(auto &worker : m_workers)
+        {
+            slots += worker->m_slots;
+        }
+        return (slots);
+    }
+
+    [[nodiscard]] size_t GetWorkerCount() const {return (m_workers.size());}
+    [[nodiscard]] size_t GetRescheduledCount() const {return (m_rescheduled);}
+};
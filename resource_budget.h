@@ -0,0 +1,162 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+//What the machine can give to the builds running at the same time: CPU slots, i.e. cores, and
+//memory. Inside a container, the limits of its cgroup are what counts, not the hardware.
+struct ResourceBudget
+{
+    uint32_t m_CpuSlots {1};
+    uint64_t m_MemoryMB {0};    //0: not limited
+};
+
+//Finds the budget of the machine the process runs on.
+class ResourceDetector
+{
+private:
+    static std::optional<std::string> ReadFirstLine(const std::filesystem::path &file)
+    {
+        auto s = std::ifstream(file);
+        auto line = std::string();
+        if(!s || !std::getline(s, line))
+        {
+            return (std::nullopt);
+        }
+        return (line);
+    }
+
+    static std::optional<uint64_t> ToNumber(const std::string &text)
+    {
+        auto s = std::istringstream(text);
+        auto value = uint64_t {0};
+        if(!(s >> value))
+        {
+            return (std::nullopt);
+        }
+        return (value);
+    }
+
+    //The folder of the cgroup v2 of this process, e.g. /sys/fs/cgroup/user.slice/..., from the
+    //"0::<path>" line of /proc/self/cgroup.
+    static std::optional<std::filesystem::path> CgroupV2Folder()
+    {
+        auto s = std::ifstream("/proc/self/cgroup");
+        auto line = std::string();
+        while(std::getline(s, line))
+        {
+            if(line.compare(0, 3, "0::") == 0)
+            {
+                return (std::filesystem::path("/sys/fs/cgroup") / std::filesystem::path(line.substr(3)).relative_path());
+            }
+        }
+        return (std::nullopt);
+    }
+
+    //cpu.max is "<quota> <period>", or "max <period>" without a limit.
+    static std::optional<uint32_t> CgroupCpuLimit()
+    {
+        auto quota = std::optional<uint64_t>();
+        auto period = std::optional<uint64_t>();
+
+        auto folder = CgroupV2Folder();
+        auto cpu_max = (folder ? ReadFirstLine(*folder / "cpu.max") : std::nullopt);
+        if(cpu_max)
+        {
+            auto s = std::istringstream(*cpu_max);
+            auto quota_text = std::string();
+            auto period_text = std::string();
+            s >> quota_text >> period_text;
+            quota = ToNumber(quota_text);
+            period = ToNumber(period_text);
+        }
+        else
+        {
+            auto quota_text = ReadFirstLine("/sys/fs/cgroup/cpu/cpu.cfs_quota_us");    //-1 without a limit
+            auto period_text = ReadFirstLine("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+            if(quota_text && period_text && quota_text->front() != '-')
+            {
+                quota = ToNumber(*quota_text);
+                period = ToNumber(*period_text);
+            }
+        }
+
+        if(!quota || !period || *period == 0)
+        {
+            return (std::nullopt);
+        }
+        return (static_cast<uint32_t>(std::max<uint64_t>((*quota + *period - 1) / *period, 1)));
+    }
+
+    //In bytes. memory.max is "max" without a limit; v1 reports a huge number instead.
+    static std::optional<uint64_t> CgroupMemoryLimit()
+    {
+        auto folder = CgroupV2Folder();
+        auto memory_max = (folder ? ReadFirstLine(*folder / "memory.max") : std::nullopt);
+        if(!memory_max)
+        {
+            memory_max = ReadFirstLine("/sys/fs/cgroup/memory/memory.limit_in_bytes");
+        }
+
+        auto limit = (memory_max ? ToNumber(*memory_max) : std::nullopt);
+        if(!limit || *limit >= (uint64_t {1} << 60))
+        {
+            return (std::nullopt);
+        }
+        return (limit);
+    }
+
+    //In KB, as /proc/meminfo reports it.
+    static std::optional<uint64_t> ReadMemInfo(const std::string &field)
+    {
+        auto s = std::ifstream("/proc/meminfo");
+        auto line = std::string();
+        while(std::getline(s, line))
+        {
+            if(line.compare(0, field.size() + 1, field + ":") == 0)
+            {
+                return (ToNumber(line.substr(field.size() + 1)));
+            }
+        }
+        return (std::nullopt);
+    }
+
+public:
+    //The smallest of the hardware, the CPU affinity of the process and the limits of its cgroup,
+    //v2 or v1. Memory is the total of the machine, capped by the cgroup limit.
+    static ResourceBudget Detect()
+    {
+        auto budget = ResourceBudget();
+        budget.m_CpuSlots = std::max(std::thread::hardware_concurrency(), 1U);
+#if defined(__linux__)
+        auto cpu_set = cpu_set_t();
+        if(sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0)
+        {
+            budget.m_CpuSlots = std::min(budget.m_CpuSlots, static_cast<uint32_t>(std::max(CPU_COUNT(&cpu_set), 1)));
+        }
+
+        auto cpu_quota = CgroupCpuLimit();
+        if(cpu_quota)
+        {
+            budget.m_CpuSlots = std::min(budget.m_CpuSlots, *cpu_quota);
+        }
+
+        budget.m_MemoryMB = ReadMemInfo("MemTotal").value_or(0) / 1024;
+        auto memory_limit = CgroupMemoryLimit();
+        if(memory_limit && (budget.m_MemoryMB == 0 || *memory_limit / (1024 * 1024) < budget.m_MemoryMB))
+        {
+            budget.m_MemoryMB = *memory_limit / (1024 * 1024);
+        }
+#endif
+        return (budget);
+    }
+};
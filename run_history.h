@@ -0,0 +1,235 @@
+#pragma once
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "json.hpp"
+#include "metrics.h"
+#include "project_exceptions.h"
+#include "HatsDateTime.h"
+#include "ExecutionMeter.h"
+
+using namespace Hats::Tools;
+
+//Appends a line of json per run to a history file, e.g. build/history.jsonl: when the run started,
+//how long it took, how its projects came out, and what it added to every counter and latency
+//histogram of the MetricsRegistry. Histograms are saved as their non-empty buckets only, so a line
+//stays small however many projects were built, and the histograms of any number of runs add up
+//to exact percentiles. Summarize() is what `project_builder stats` prints.
+class RunHistory
+{
+private:
+    //The histograms Summarize() reports on, and what it calls them.
+    static constexpr std::array<std::pair<const char *, const char *>, 4> Histograms {{
+        {"project_builder_build_run_seconds", "build"},
+        {"project_builder_build_wait_seconds", "build wait"},
+        {"project_builder_conversion_run_seconds", "conversion"},
+        {"project_builder_conversion_wait_seconds", "conversion wait"}}};
+
+    std::filesystem::path m_file;
+    int64_t m_start {0};
+    Meter<std::ratio<1, 1>> m_meter;
+    std::vector<std::pair<std::string, uint64_t>> m_counters;               //when the run started
+    std::vector<std::pair<std::string, HistogramSnapshot>> m_histograms;
+
+    static HistogramSnapshot RunHistogram(const nlohmann::ordered_json &run_json, const std::string &name)
+    {
+        auto histograms_json = run_json.value("Histograms", nlohmann::ordered_json::object());
+        return (histograms_json.contains(name) ? HistogramSnapshot::FromJson(histograms_json[name]) : HistogramSnapshot());
+    }
+
+    //Of the artifact cache, or nothing if the run didn't use one.
+    static std::optional<double> HitRate(const nlohmann::ordered_json &run_json)
+    {
+        auto counters_json = run_json.value("Counters", nlohmann::ordered_json::object());
+        auto hits = counters_json.value("project_builder_artifact_cache_requests_total{result=\"hit\"}", uint64_t {0});
+        auto misses = counters_json.value("project_builder_artifact_cache_requests_total{result=\"miss\"}", uint64_t {0});
+        if(hits + misses == 0)
+        {
+            return (std::nullopt);
+        }
+        return (static_cast<double>(hits) / static_cast<double>(hits + misses));
+    }
+
+    static double Mean(const std::vector<double> &values, size_t begin, size_t end)
+    {
+        auto sum = 0.0;
+        for(auto i = begin; i < end; ++i)
+        {
+            sum += values[i];
+        }
+        return (end > begin ? sum / static_cast<double>(end - begin) : 0.0);
+    }
+
+    //The mean of the second half of the values against the first, oldest first.
+    static void PrintTrend(std::ostream &os, const std::string &title, const std::vector<double> &values)
+    {
+        auto half = values.size() / 2;
+        auto before = Mean(values, 0, half);
+        auto after = Mean(values, values.size() - half, values.size());
+        os << "  " << std::left << std::setw(16) << title << std::right << std::fixed << std::setprecision(3)
+           << before << " s -> " << after << " s";
+        if(before > 0.0)
+        {
+            os << " (" << std::showpos << std::setprecision(1) << (after - before) / before * 100.0 << std::noshowpos << "%)";
+        }
+        os << std::endl;
+    }
+
+public:
+    explicit RunHistory(std::filesystem::path file) : m_file(std::move(file))
+    {
+
+    }
+
+    [[nodiscard]] const std::filesystem::path &GetFile() const {return (m_file);}
+
+    //Marks the start of a run: what the metrics hold now isn't part of it.
+    void Begin()
+    {
+        m_start = HatsDateTime().GetTimeStamp();
+        m_meter = Meter<std::ratio<1, 1>>();
+        m_counters = MetricsRegistry::Instance().CounterValues();
+        m_histograms = MetricsRegistry::Instance().HistogramSnapshots();
+    }
+
+    //run holds whatever describes the run, e.g. its root folders. The history is an aid: failing
+    //to write it doesn't fail the run.
+    void Append(const nlohmann::ordered_json &run, const nlohmann::ordered_json &build_report)
+    {
+        auto record = nlohmann::ordered_json();
+        record["Timestamp"] = m_start;
+        record.update(run);
+        record["Seconds"] = m_meter.ElapsedTime();
+        record["Status"] = build_report.value("Status", "");
+        record["Projects"] = build_report.value("Summary", nlohmann::ordered_json::object());
+
+        auto &counters_json = record["Counters"] = nlohmann::ordered_json::object();
+        for(auto &[name, value] : MetricsRegistry::Instance().CounterValues())
+        {
+            auto before = std::find_if(m_counters.begin(), m_counters.end(), [&](auto &counter) {return (counter.first == name);});
+            auto delta = value - (before != m_counters.end() ? before->second : 0);
+            if(delta > 0)
+            {
+                counters_json[name] = delta;
+            }
+        }
+
+        auto &histograms_json = record["Histograms"] = nlohmann::ordered_json::object();
+        for(auto &[name, snapshot] : MetricsRegistry::Instance().HistogramSnapshots())
+        {
+            auto delta = snapshot;
+            auto before = std::find_if(m_histograms.begin(), m_histograms.end(), [&](auto &histogram) {return (histogram.first == name);});
+            if(before != m_histograms.end())
+            {
+                delta -= before->second;
+            }
+            if(delta.Count() > 0)
+            {
+                histograms_json[name] = delta.ToJson();
+            }
+        }
+
+        try
+        {
+            std::filesystem::create_directories(m_file.parent_path());
+            auto out_file = std::ofstream(m_file, std::ios::out | std::ios::app);
+            ThrowIfFalse<BaseException>(out_file.is_open(), "RunHistory::Append", "Unable to open the file");
+            out_file << record.dump() << "\n";
+        }
+        catch(const std::exception &e)
+        {
+            std::cout << "Unable to append the run to " << m_file << ": " << e.what() << std::endl;
+        }
+    }
+
+    //The last runs of the history, one per line, then the project durations and wait times over
+    //all of them, and how the run time and the median build time moved from the older half of the
+    //runs to the newer one.
+    static void Summarize(const std::filesystem::path &file, size_t last, std::ostream &os)
+    {
+        auto in_file = std::ifstream(file);
+        ThrowIfFalse<BaseException>(in_file.is_open(), "RunHistory::Summarize", "No run history in " + file.string());
+
+        auto runs = std::vector<nlohmann::ordered_json>();
+        auto line = std::string();
+        while(std::getline(in_file, line))
+        {
+            auto run_json = nlohmann::ordered_json::parse(line, nullptr, false);
+            if(!run_json.is_discarded() && run_json.is_object())
+            {
+                runs.emplace_back(std::move(run_json));    //a line cut short by a crash is skipped
+            }
+        }
+        ThrowIfFalse<BaseException>(!runs.empty(), "RunHistory::Summarize", "No run history in " + file.string());
+        if(last > 0 && runs.size() > last)
+        {
+            runs.erase(runs.begin(), runs.end() - static_cast<std::ptrdiff_t>(last));
+        }
+
+        os << runs.size() << " run(s) from " << file.string() << std::endl;
+        os << std::left << std::setw(21) << "started" << std::right << std::setw(10) << "seconds" << std::setw(9) << "status"
+           << std::setw(8) << "built" << std::setw(8) << "failed" << std::setw(10) << "hit rate"
+           << std::setw(11) << "build p50" << std::setw(11) << "build p99" << std::setw(10) << "wait p99" << std::endl;
+
+        auto seconds = std::vector<double>();
+        auto medians = std::vector<double>();
+        auto totals = std::vector<HistogramSnapshot>(Histograms.size());
+        for(auto &run_json : runs)
+        {
+            auto build = RunHistogram(run_json, Histograms[0].first);
+            auto wait = RunHistogram(run_json, Histograms[1].first);
+            for(size_t i = 0; i < Histograms.size(); ++i)
+            {
+                totals[i] += RunHistogram(run_json, Histograms[i].first);
+            }
+            seconds.emplace_back(run_json.value("Seconds", 0.0));
+            if(build.Count() > 0)
+            {
+                medians.emplace_back(build.Percentile(50));     //a run that built nothing says nothing about it
+            }
+
+            auto projects_json = run_json.value("Projects", nlohmann::ordered_json::object());
+            auto hit_rate = HitRate(run_json);
+            auto hit_rate_str = (hit_rate ? std::to_string(static_cast<int>(*hit_rate * 100.0 + 0.5)) + "%" : std::string("-"));
+            auto percentile_str = [](const HistogramSnapshot &histogram, double p) {
+                auto str = std::ostringstream();
+                str << std::fixed << std::setprecision(3) << histogram.Percentile(p);
+                return (histogram.Count() > 0 ? str.str() : std::string("-"));
+            };
+            os << std::left << std::setw(21) << HatsDateTime(run_json.value("Timestamp", int64_t {0})).FormatDateTime("%Y-%m-%d %H:%M:%S")
+               << std::right << std::fixed << std::setprecision(1) << std::setw(10) << seconds.back()
+               << std::setw(9) << run_json.value("Status", "-")
+               << std::setw(8) << projects_json.value("Built", size_t {0}) << std::setw(8) << projects_json.value("Failed", size_t {0})
+               << std::setw(10) << hit_rate_str
+               << std::setw(11) << percentile_str(build, 50) << std::setw(11) << percentile_str(build, 99)
+               << std::setw(10) << percentile_str(wait, 99) << std::endl;
+        }
+
+        os << std::endl << "Per project, over these runs, in seconds:" << std::endl;
+        os << "  " << std::left << std::setw(16) << "" << std::right << std::setw(10) << "projects" << std::setw(10) << "p50"
+           << std::setw(10) << "p90" << std::setw(10) << "p99" << std::setw(10) << "max" << std::endl;
+        for(size_t i = 0; i < Histograms.size(); ++i)
+        {
+            os << "  " << std::left << std::setw(16) << Histograms[i].second << std::right << std::setw(10) << totals[i].Count()
+               << std::fixed << std::setprecision(3) << std::setw(10) << totals[i].Percentile(50)
+               << std::setw(10) << totals[i].Percentile(90) << std::setw(10) << totals[i].Percentile(99)
+               << std::setw(10) << totals[i].Percentile(100) << std::endl;
+        }
+
+        if(runs.size() >= 2)
+        {
+            os << std::endl << "Trend, older half of the runs -> newer half:" << std::endl;
+            PrintTrend(os, "run time", seconds);
+            if(medians.size() >= 2)
+            {
+                PrintTrend(os, "build p50", medians);
+            }
+        }
+    }
+};
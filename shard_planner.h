@@ -0,0 +1,469 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <queue>
+#include <string>
+#include <vector>
+#include "build_state.h"
+#include "json.hpp"
+#include "project_exceptions.h"
+#include "project_graph.h"
+
+//Splits a graph into shards, for as many machines to build one each, e.g. the agents of a CI run.
+//Every project is built by exactly one shard, which imports the outputs of the dependencies that
+//other shards build, see Imports(). The shards are balanced by weight, i.e. by how long their
+//projects took to build last time, and few dependencies cross from one shard to another, so that
+//each one imports little.
+//A shard never depends on a shard after it: every project is in the same shard as its
+//dependencies or in a later one, so the shards can always be built in order. Stage() tells which
+//shards can build at the same time, once the shards they import from are done.
+//- The projects are laid out in a line, dependencies first, and the line is cut into pieces of
+//  equal weight. Three layouts are tried, and the one that ends with the fewest edges between
+//  shards is kept: by path as far as the dependencies allow, forwards and backwards, which keeps
+//  the projects of a folder together, and depth first from the roots, which keeps a project and
+//  what it depends on together.
+//- Then, a pass at a time, a project at the boundary of its shard moves to the neighbouring shard
+//  that most of its dependencies and dependents are in, if that leaves fewer edges between shards
+//  and the shard it moves to no more than MaxImbalance above the average weight, or to a lighter
+//  neighbouring shard, if that leaves as many edges and a better balance. A project never moves
+//  before the shard of one of its dependencies or after the shard of one of its dependents. Every
+//  move lowers either the number of edges between shards or the spread of the weights, so the
+//  passes end.
+//Nothing depends on the order in which the tree was crawled or on the machine: the same graph and
+//weights always give the same plan, so every shard of a CI run computes the same one on its own.
+//GetHash() identifies the plan, to check that they did.
+class ShardPlanner
+{
+private:
+    static constexpr double MaxImbalance {0.05};
+    static constexpr size_t MaxPasses {16};
+    static constexpr double MinWeight {0.001};  //a project that built in no time still costs something
+
+    const ProjectGraph &m_graph;
+    uint32_t m_count;
+    std::vector<double> m_weights;          //by node, in seconds
+    std::vector<uint32_t> m_shards;         //by node
+    std::vector<double> m_ShardWeights;
+    std::vector<uint32_t> m_stages;         //by shard, from 0
+    size_t m_moves {0};
+    std::string m_hash;
+
+    //Dependencies first, otherwise in id order, i.e. by path: of the projects whose dependencies
+    //are laid out, the lowest id goes next, or the highest one if reversed. Which one keeps the
+    //order of the paths better depends on whether folders tend to depend on the folders after them
+    //or before them.
+    [[nodiscard]] std::vector<NodeId> PathLayout(bool reversed) const
+    {
+        auto key = [this, reversed](NodeId node) {return (reversed ? static_cast<NodeId>(m_graph.NodeCount() - 1 - node) : node);};
+        auto layout = std::vector<NodeId>();
+        layout.reserve(m_graph.NodeCount());
+        auto remaining = std::vector<size_t>(m_graph.NodeCount());
+        auto ready = std::priority_queue<NodeId, std::vector<NodeId>, std::greater<>>();
+        for(NodeId node = 0; node < m_graph.NodeCount(); ++node)
+        {
+            remaining[node] = m_graph.Dependencies(node).size();
+            if(remaining[node] == 0)
+            {
+                ready.push(key(node));
+            }
+        }
+        while(!ready.empty())
+        {
+            auto node = key(ready.top());     //the key of a key is the node
+            ready.pop();
+            layout.emplace_back(node);
+            for(auto parent_node : m_graph.Dependents(node))
+            {
+                if(--remaining[parent_node] == 0)
+                {
+                    ready.push(key(parent_node));
+                }
+            }
+        }
+        for(NodeId node = 0; node < m_graph.NodeCount(); ++node)
+        {
+            if(remaining[node] > 0)
+            {
+                layout.emplace_back(node);  //only in a graph with cycles, which the mapper rejects
+            }
+        }
+        return (layout);
+    }
+
+    //Dependencies first, depth first from the roots in id order, each dependency where the first
+    //project that needs it is.
+    [[nodiscard]] std::vector<NodeId> DependencyLayout() const
+    {
+        auto layout = std::vector<NodeId>();
+        auto visited = std::vector<uint8_t>(m_graph.NodeCount(), 0);
+        auto s = std::vector<std::pair<NodeId, uint32_t>>();    //node, index of the next dependency
+        auto walk = [&](NodeId start)
+        {
+            visited[start] = 1;
+            s.emplace_back(start, 0);
+            while(!s.empty())
+            {
+                auto &[node, next] = s.back();
+                auto dependencies = m_graph.Dependencies(node);
+                if(next < dependencies.size())
+                {
+                    auto child_node = dependencies[next++];
+                    if(!visited[child_node])
+                    {
+                        visited[child_node] = 1;
+                        s.emplace_back(child_node, 0);
+                    }
+                    continue;
+                }
+                layout.emplace_back(node);
+                s.pop_back();
+            }
+        };
+
+        for(NodeId node = 0; node < m_graph.NodeCount(); ++node)
+        {
+            if(m_graph.Dependents(node).empty())
+            {
+                walk(node);
+            }
+        }
+        for(NodeId node = 0; node < m_graph.NodeCount(); ++node)
+        {
+            if(!visited[node])
+            {
+                walk(node);     //only in a graph with cycles, which the mapper rejects
+            }
+        }
+        return (layout);
+    }
+
+    //A project goes to the piece its middle falls into. Along a layout where dependencies come
+    //first, no project lands in a piece before the pieces of its dependencies.
+    void Partition(const std::vector<NodeId> &layout, double total_weight)
+    {
+        std::fill(m_ShardWeights.begin(), m_ShardWeights.end(), 0.0);
+        auto before = 0.0;
+        for(auto node : layout)
+        {
+            auto middle = before + m_weights[node] / 2.0;
+            auto shard = static_cast<uint32_t>(middle / total_weight * m_count);
+            m_shards[node] = std::min(shard, m_count - 1);
+            m_ShardWeights[m_shards[node]] += m_weights[node];
+            before += m_weights[node];
+        }
+    }
+
+    void Refine(const std::vector<NodeId> &layout, double total_weight)
+    {
+        auto cap = total_weight / m_count * (1.0 + MaxImbalance);
+        auto edges = std::vector<int64_t>(m_count, 0);      //of the project, by shard
+        auto neighbours = std::vector<uint32_t>();          //the shards with edges
+        for(size_t pass = 0; pass < MaxPasses; ++pass)
+        {
+            auto moves = size_t {0};
+            for(auto node : layout)
+            {
+                auto add_edge = [&](NodeId other_node)
+                {
+                    if(edges[m_shards[other_node]]++ == 0)
+                    {
+                        neighbours.emplace_back(m_shards[other_node]);
+                    }
+                };
+                //The shards the project can move to without a shard depending on a later one.
+                auto first = uint32_t {0};
+                auto last = m_count - 1;
+                for(auto child_node : m_graph.Dependencies(node))
+                {
+                    add_edge(child_node);
+                    first = std::max(first, m_shards[child_node]);
+                }
+                for(auto parent_node : m_graph.Dependents(node))
+                {
+                    add_edge(parent_node);
+                    last = std::min(last, m_shards[parent_node]);
+                }
+
+                auto source = m_shards[node];
+                auto weight = m_weights[node];
+                auto best = source;
+                auto best_gain = int64_t {0};
+                for(auto target : neighbours)
+                {
+                    auto gain = edges[target] - edges[source];
+                    auto allowed = (target != source && target >= first && target <= last &&
+                                    ((gain > 0 && m_ShardWeights[target] + weight <= std::max(cap, m_ShardWeights[source])) ||
+                                     (gain == 0 && m_ShardWeights[target] + weight < m_ShardWeights[source])));
+                    //The most edges saved, then the lightest shard, then the lowest index.
+                    if(allowed && (best == source || gain > best_gain ||
+                                   (gain == best_gain && (m_ShardWeights[target] < m_ShardWeights[best] ||
+                                                          (m_ShardWeights[target] == m_ShardWeights[best] && target < best)))))
+                    {
+                        best = target;
+                        best_gain = gain;
+                    }
+                }
+                for(auto shard : neighbours)
+                {
+                    edges[shard] = 0;
+                }
+                neighbours.clear();
+
+                if(best != source)
+                {
+                    m_shards[node] = best;
+                    m_ShardWeights[source] -= weight;
+                    m_ShardWeights[best] += weight;
+                    ++moves;
+                }
+            }
+
+            m_moves += moves;
+            if(moves == 0)
+            {
+                break;
+            }
+        }
+    }
+
+    //A shard that imports nothing is in the first stage, any other one in the stage after the
+    //last of the shards it imports from. Shards only import from the shards before them.
+    void ComputeStages()
+    {
+        auto imports_from = std::vector<uint8_t>(static_cast<size_t>(m_count) * m_count, 0);
+        for(NodeId node = 0; node < m_graph.NodeCount(); ++node)
+        {
+            for(auto child_node : m_graph.Dependencies(node))
+            {
+                imports_from[static_cast<size_t>(m_shards[node]) * m_count + m_shards[child_node]] = 1;
+            }
+        }
+
+        m_stages.assign(m_count, 0);
+        for(uint32_t shard = 0; shard < m_count; ++shard)
+        {
+            for(uint32_t other = 0; other < shard; ++other)
+            {
+                if(imports_from[static_cast<size_t>(shard) * m_count + other])
+                {
+                    m_stages[shard] = std::max(m_stages[shard], m_stages[other] + 1);
+                }
+            }
+        }
+    }
+
+public:
+    //weights holds how long each project takes to build, by node, see EstimateWeights().
+    ShardPlanner(const ProjectGraph &graph, std::vector<double> weights, uint32_t count) : m_graph(graph),
+                                                                                           m_count(std::max<uint32_t>(count, 1)),
+                                                                                           m_weights(std::move(weights)),
+                                                                                           m_shards(graph.NodeCount(), 0),
+                                                                                           m_ShardWeights(m_count, 0.0)
+    {
+        ThrowIfFalse<BaseException>(m_weights.size() == graph.NodeCount(), "ShardPlanner::ShardPlanner", "A weight is needed for every project");
+
+        auto total_weight = 0.0;
+        for(auto &weight : m_weights)
+        {
+            weight = std::max(weight, MinWeight);
+            total_weight += weight;
+        }
+
+        //The first layout that ends with the fewest edges between shards, then the lightest
+        //heaviest shard, wins.
+        auto best_shards = std::vector<uint32_t>();
+        auto best_weights = std::vector<double>();
+        auto best = std::make_pair(std::numeric_limits<size_t>::max(), 0.0);
+        for(auto &layout : {PathLayout(false), PathLayout(true), DependencyLayout()})
+        {
+            Partition(layout, total_weight);
+            Refine(layout, total_weight);
+            auto result = std::make_pair(CutEdges(), *std::max_element(m_ShardWeights.begin(), m_ShardWeights.end()));
+            if(result < best)
+            {
+                best = result;
+                best_shards = m_shards;
+                best_weights = m_ShardWeights;
+            }
+        }
+        m_shards = std::move(best_shards);
+        m_ShardWeights = std::move(best_weights);
+        ComputeStages();
+
+        auto hash = ContentHash();
+        hash.Update(std::to_string(m_count));
+        for(NodeId node = 0; node < graph.NodeCount(); ++node)
+        {
+            hash.Update(graph.Path(node));
+            hash.Update(std::to_string(m_shards[node]));
+        }
+        m_hash = hash.ToString();
+    }
+
+    ShardPlanner(const ShardPlanner &) = delete;
+    ShardPlanner &operator=(const ShardPlanner &) = delete;
+
+    //How long the last build of every project took, by node. Projects that were never built, or
+    //without a state store, weigh the average of the others, or a second each if none was built.
+    //The state store has to be the same for every shard, e.g. restored with the workspace, or none.
+    static std::vector<double> EstimateWeights(const ProjectGraph &graph, BuildStateStore *state_store)
+    {
+        auto durations = std::vector<std::optional<double>>(graph.NodeCount());
+        auto known_total = 0.0;
+        auto known_count = size_t {0};
+        for(NodeId node = 0; node < graph.NodeCount() && state_store; ++node)
+        {
+            durations[node] = state_store->FindDuration(graph.Path(node));
+            if(durations[node])
+            {
+                known_total += *durations[node];
+                ++known_count;
+            }
+        }
+
+        auto estimate = (known_count > 0 ? known_total / static_cast<double>(known_count) : 1.0);
+        auto weights = std::vector<double>(graph.NodeCount());
+        for(NodeId node = 0; node < graph.NodeCount(); ++node)
+        {
+            weights[node] = durations[node].value_or(estimate);
+        }
+        return (weights);
+    }
+
+    [[nodiscard]] uint32_t GetCount() const {return (m_count);}
+    [[nodiscard]] uint32_t ShardOf(NodeId node) const {return (m_shards[node]);}
+    [[nodiscard]] double Weight(uint32_t shard) const {return (m_ShardWeights[shard]);}
+    //From 0. A shard can start once the shards of the stages before its own are built.
+    [[nodiscard]] uint32_t Stage(uint32_t shard) const {return (m_stages[shard]);}
+    [[nodiscard]] uint32_t StageCount() const {return (*std::max_element(m_stages.begin(), m_stages.end()) + 1);}
+    //How many times the refinement moved a project, over all the layouts.
+    [[nodiscard]] size_t GetMoves() const {return (m_moves);}
+    [[nodiscard]] const std::string &GetHash() const {return (m_hash);}
+
+    //1 for the projects of the shard, by node.
+    [[nodiscard]] std::vector<uint8_t> InShard(uint32_t shard) const
+    {
+        auto in_shard = std::vector<uint8_t>(m_graph.NodeCount(), 0);
+        for(NodeId node = 0; node < m_graph.NodeCount(); ++node)
+        {
+            in_shard[node] = (m_shards[node] == shard);
+        }
+        return (in_shard);
+    }
+
+    [[nodiscard]] size_t ProjectCount(uint32_t shard) const
+    {
+        return (static_cast<size_t>(std::count(m_shards.begin(), m_shards.end(), shard)));
+    }
+
+    //Dependencies from a project of one shard to a project of another.
+    [[nodiscard]] size_t CutEdges() const
+    {
+        auto cut = size_t {0};
+        for(NodeId node = 0; node < m_graph.NodeCount(); ++node)
+        {
+            for(auto child_node : m_graph.Dependencies(node))
+            {
+                cut += (m_shards[child_node] != m_shards[node]);
+            }
+        }
+        return (cut);
+    }
+
+    //The projects of other shards that projects of this one depend on, in id order.
+    [[nodiscard]] std::vector<NodeId> Imports(uint32_t shard) const
+    {
+        auto imports = std::vector<NodeId>();
+        for(NodeId node = 0; node < m_graph.NodeCount(); ++node)
+        {
+            if(m_shards[node] == shard)
+            {
+                continue;
+            }
+            auto dependents = m_graph.Dependents(node);
+            if(std::any_of(dependents.begin(), dependents.end(), [&](NodeId parent_node) {return (m_shards[parent_node] == shard);}))
+            {
+                imports.emplace_back(node);
+            }
+        }
+        return (imports);
+    }
+
+    //The longest chain of dependencies within the shard, in seconds, imports being already built:
+    //how long the shard takes with as many workers as it can use.
+    [[nodiscard]] double CriticalPath(uint32_t shard) const
+    {
+        auto finish = std::vector<double>(m_graph.NodeCount(), 0.0);
+        auto critical_path = 0.0;
+        for(auto node : m_graph.TopologicalOrder())
+        {
+            if(m_shards[node] != shard)
+            {
+                continue;
+            }
+            auto start = 0.0;
+            for(auto child_node : m_graph.Dependencies(node))
+            {
+                start = std::max(start, finish[child_node]);
+            }
+            finish[node] = start + m_weights[node];
+            critical_path = std::max(critical_path, finish[node]);
+        }
+        return (critical_path);
+    }
+
+    //What the shard builds and what it has to import before it does, with the folder each import
+    //is expected in, if output_folder gives one, and the shard that builds it. Shards and stages
+    //are numbered from 1, as on the command line.
+    [[nodiscard]] nlohmann::ordered_json Manifest(uint32_t shard,
+                                                  const std::function<std::optional<std::string>(NodeId)> &output_folder) const
+    {
+        auto manifest = nlohmann::ordered_json();
+        manifest["Shard"] = shard + 1;
+        manifest["Shards"] = m_count;
+        manifest["Plan"] = m_hash;
+        manifest["Stage"] = m_stages[shard] + 1;
+        manifest["Stages"] = StageCount();
+        manifest["Weight"] = m_ShardWeights[shard];
+        manifest["Critical Path"] = CriticalPath(shard);
+        manifest["Cut Edges"] = CutEdges();
+
+        auto &build_json = manifest["Build"] = nlohmann::ordered_json::array();
+        for(NodeId node = 0; node < m_graph.NodeCount(); ++node)
+        {
+            if(m_shards[node] == shard)
+            {
+                build_json.emplace_back(m_graph.Path(node));
+            }
+        }
+
+        auto imported_from = std::vector<uint8_t>(m_count, 0);
+        auto &imports_json = manifest["Imports"] = nlohmann::ordered_json::array();
+        for(auto node : Imports(shard))
+        {
+            auto import_json = nlohmann::ordered_json();
+            import_json["Project"] = m_graph.Path(node);
+            auto folder = output_folder(node);
+            if(folder)
+            {
+                import_json["Output"] = *folder;
+            }
+            import_json["Built By"] = m_shards[node] + 1;
+            imports_json.emplace_back(std::move(import_json));
+            imported_from[m_shards[node]] = 1;
+        }
+
+        auto &from_json = manifest["Imports From"] = nlohmann::ordered_json::array();
+        for(uint32_t other = 0; other < m_count; ++other)
+        {
+            if(imported_from[other])
+            {
+                from_json.emplace_back(other + 1);
+            }
+        }
+        return (manifest);
+    }
+};
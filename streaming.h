@@ -0,0 +1,87 @@
+#pragma once
+#include <mutex>
+#include <unordered_set>
+#include "builder.h"
+#include "converter.h"
+#include "mapper.h"
+#include "node_state.h"
+#include "trace.h"
+
+//Runs the mapping, the conversions and the build of one run overlapped rather than one after the
+//other. A project is converted as soon as the crawl has parsed its file, while the rest of the tree
+//is still being mapped, and built as soon as its conversion is over and its dependencies are built,
+//while other projects are still converting. The build itself starts once the map is complete: the
+//cycle check, the scheduling priorities and the up-to-date checks need the whole graph. A run then
+//takes about as long as the longest of the three, rather than their sum.
+//Projects are handed over from one phase to the next by a ConversionGate, through the builder's
+//NodeStateTable: the conversion of a project is one more thing its build waits for. A project
+//whose conversion fails fails the build as if it had failed to build: the build stops, or, with
+//SetKeepGoing(), the projects that depend on it are skipped.
+class StreamingPipeline
+{
+private:
+    ProjectConverter &m_converter;
+    ConversionGate m_gate;
+    std::mutex m_lock;
+    std::unordered_set<uint32_t> m_submitted;   //path ids of the projects handed to the converter, protected by m_lock
+
+    //Every project is converted once, whether the crawl or Build() gets to it first.
+    void Submit(ProjectInfo &project)
+    {
+        auto path_id = project.GetPathId();
+        {
+            auto lock = std::lock_guard<std::mutex>(m_lock);
+            if(!m_submitted.emplace(path_id).second)
+            {
+                return;
+            }
+        }
+
+        m_gate.Started(path_id);
+        m_converter.Submit(project, [this, path_id](bool converted) {m_gate.Finished(path_id, converted);});
+    }
+
+public:
+    explicit StreamingPipeline(ProjectConverter &converter) : m_converter(converter)
+    {
+
+    }
+
+    StreamingPipeline(const StreamingPipeline &) = delete;
+    StreamingPipeline &operator=(const StreamingPipeline &) = delete;
+
+    //The conversions that already started run to completion, e.g. when the mapping failed.
+    ~StreamingPipeline()
+    {
+        m_gate.WaitForAll();
+    }
+
+    //Starts converting. The listener goes to the ProjectMapper, which calls it with every project
+    //it parses.
+    ProjectMapper::ProjectListener Start()
+    {
+        m_converter.Begin();
+        return ([this](ProjectInfo &project) {Submit(project);});
+    }
+
+    //Once the map is complete: converts the projects the crawl didn't hand over, e.g. all of them
+    //when the map came from the graph cache, and builds. Returns once every project is converted
+    //and the build is over, with the conversion report in the converter's GetLastReport() and the
+    //build report in the builder's.
+    bool Build(ProjectMapper &project_map, ProjectBuilder &builder)
+    {
+        TRACE_SCOPE("Stream");
+        auto &graph = project_map.GetGraph();
+        for(NodeId node = 0; node < graph.NodeCount(); ++node)
+        {
+            if(graph.Info(node).Status() == ConversionStatus::NotConverted)
+            {
+                Submit(graph.Info(node));
+            }
+        }
+
+        auto succeeded = builder.Build(project_map, &m_gate);
+        m_converter.End();
+        return (succeeded);
+    }
+};
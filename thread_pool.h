@@ -0,0 +1,214 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//A fixed-size work-stealing pool. Every worker owns a deque of tasks:
+    //- A task submitted from a worker thread goes to the back of that worker's own deque. Since the
+    //  worker pops from the back as well, the most recently released work (usually the parent of
+    //  the project just built) runs next on the same thread.
+    //- A task submitted from outside the pool is spread across the deques round-robin.
+    //- A worker whose deque is empty steals from the front of the other deques, i.e. the oldest work.
+class ThreadPool
+{
+public:
+    using TaskType = std::function<void()>;
+
+private:
+    struct WorkQueue
+    {
+        std::mutex m_lock;
+        std::deque<TaskType> m_tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_lock;
+    std::condition_variable m_WorkAvailable;
+    std::condition_variable m_Idle;
+    size_t m_queued {0};         //tasks sitting in a deque, protected by m_lock
+    size_t m_outstanding {0};    //queued + running tasks, protected by m_lock
+    bool m_stopping {false};
+    std::exception_ptr m_error {nullptr};
+
+    std::atomic<size_t> m_NextQueue {0};
+
+    static inline thread_local ThreadPool *t_pool {nullptr};
+    static inline thread_local size_t t_index {0};
+
+    bool TryPop(size_t index, TaskType &task)
+    {
+        {
+            auto &own = *m_queues[index];
+            auto lock = std::lock_guard<std::mutex>(own.m_lock);
+            if(!own.m_tasks.empty())
+            {
+                task = std::move(own.m_tasks.back());
+                own.m_tasks.pop_back();
+                return (true);
+            }
+        }
+
+        for(size_t i = 1; i < m_queues.size(); ++i)
+        {
+            auto &victim = *m_queues[(index + i) % m_queues.size()];
+            auto lock = std::lock_guard<std::mutex>(victim.m_lock);
+            if(!victim.m_tasks.empty())
+            {
+                task = std::move(victim.m_tasks.front());
+                victim.m_tasks.pop_front();
+                return (true);
+            }
+        }
+
+        return (false);
+    }
+
+    void Run(TaskType &task)
+    {
+        try
+        {
+            task();
+        }
+        catch(...)
+        {
+            //Keep the first error only and drop the rest of the queued work; Wait() rethrows it.
+            {
+                auto lock = std::lock_guard<std::mutex>(m_lock);
+                if(!m_error)
+                {
+                    m_error = std::current_exception();
+                }
+            }
+            Cancel();
+        }
+
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        if(--m_outstanding == 0)
+        {
+            m_Idle.notify_all();
+        }
+    }
+
+    void WorkerLoop(size_t index)
+    {
+        t_pool = this;
+        t_index = index;
+
+        while(true)
+        {
+            auto task = TaskType();
+            if(TryPop(index, task))
+            {
+                {
+                    auto lock = std::lock_guard<std::mutex>(m_lock);
+                    --m_queued;
+                }
+                Run(task);
+                continue;
+            }
+
+            auto lock = std::unique_lock<std::mutex>(m_lock);
+            m_WorkAvailable.wait(lock, [this]() {return (m_stopping || m_queued > 0);});
+            if(m_stopping && m_queued == 0)
+            {
+                return;
+            }
+        }
+    }
+
+public:
+    explicit ThreadPool(size_t thread_count)
+    {
+        thread_count = std::max<size_t>(thread_count, 1);
+        for(size_t i = 0; i < thread_count; ++i)
+        {
+            m_queues.emplace_back(std::make_unique<WorkQueue>());
+        }
+
+        for(size_t i = 0; i < thread_count; ++i)
+        {
+            m_workers.emplace_back([this, i]() {WorkerLoop(i);});
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            auto lock = std::lock_guard<std::mutex>(m_lock);
+            m_stopping = true;
+        }
+        m_WorkAvailable.notify_all();
+
+        for(auto &worker : m_workers)
+        {
+            worker.join();
+        }
+    }
+
+    void Submit(TaskType task)
+    {
+        {
+            //Count the task before it becomes visible so a fast worker can never drive the
+            //counters below zero.
+            auto lock = std::lock_guard<std::mutex>(m_lock);
+            ++m_queued;
+            ++m_outstanding;
+        }
+
+        auto index = (t_pool == this ? t_index : m_NextQueue++ % m_queues.size());
+        {
+            auto &queue = *m_queues[index];
+            auto lock = std::lock_guard<std::mutex>(queue.m_lock);
+            queue.m_tasks.emplace_back(std::move(task));
+        }
+        m_WorkAvailable.notify_one();
+    }
+
+    //Drops every task that hasn't started yet. Running tasks are left to finish.
+    void Cancel()
+    {
+        size_t dropped = 0;
+        for(auto &queue : m_queues)
+        {
+            auto lock = std::lock_guard<std::mutex>(queue->m_lock);
+            dropped += queue->m_tasks.size();
+            queue->m_tasks.clear();
+        }
+
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        m_queued -= dropped;
+        m_outstanding -= dropped;
+        if(m_outstanding == 0)
+        {
+            m_Idle.notify_all();
+        }
+    }
+
+    //Blocks until every submitted task, including the ones submitted by other tasks, has run or
+    //been cancelled. Rethrows the first exception a task leaked. Must not be called from a worker.
+    void Wait()
+    {
+        auto lock = std::unique_lock<std::mutex>(m_lock);
+        m_Idle.wait(lock, [this]() {return (m_outstanding == 0);});
+
+        if(m_error)
+        {
+            auto error = m_error;
+            m_error = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    [[nodiscard]] size_t Size() const {return (m_workers.size());}
+};
@@ -0,0 +1,306 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+#include "json.hpp"
+
+//One completed scope. The name has to be a string literal. The detail, typically a path, is
+//copied, keeping its last characters, which are the ones that tell paths apart.
+struct TraceEvent
+{
+    static constexpr size_t DetailSize {64};
+
+    const char *m_name {nullptr};
+    int64_t m_start {0};        //nanoseconds since the tracer was created
+    int64_t m_duration {0};     //nanoseconds
+    char m_detail[DetailSize] {};
+};
+
+//Fixed-size ring owned by one thread at a time. Only that thread writes, so recording an event is a plain
+//store followed by a release increment of the head: no lock and no allocation. Once the ring is
+//full, the oldest events are overwritten.
+class TraceBuffer
+{
+private:
+    std::vector<TraceEvent> m_events;
+    std::atomic<uint64_t> m_head {0};     //number of events ever recorded
+    size_t m_thread;                      //sequence number of the owning thread
+
+public:
+    TraceBuffer(size_t capacity, size_t thread) : m_events(capacity), m_thread(thread)
+    {
+
+    }
+
+    void Record(const char *name, int64_t start, int64_t duration, std::string_view detail)
+    {
+        auto head = m_head.load(std::memory_order_relaxed);
+        auto &event = m_events[head % m_events.size()];
+        event.m_name = name;
+        event.m_start = start;
+        event.m_duration = duration;
+
+        auto length = std::min(detail.size(), TraceEvent::DetailSize - 1);
+        std::memcpy(event.m_detail, detail.data() + detail.size() - length, length);
+        event.m_detail[length] = '\0';
+
+        m_head.store(head + 1, std::memory_order_release);
+    }
+
+    //The events still in the ring, oldest first. Meant to be called once the traced work is done.
+    [[nodiscard]] std::vector<TraceEvent> Events() const
+    {
+        auto head = m_head.load(std::memory_order_acquire);
+        auto count = std::min<uint64_t>(head, m_events.size());
+        auto events = std::vector<TraceEvent>();
+        events.reserve(count);
+        for(auto i = head - count; i < head; ++i)
+        {
+            events.emplace_back(m_events[i % m_events.size()]);
+        }
+        return (events);
+    }
+
+    [[nodiscard]] uint64_t Dropped() const
+    {
+        auto head = m_head.load(std::memory_order_acquire);
+        return (head > m_events.size() ? head - m_events.size() : 0);
+    }
+
+    [[nodiscard]] size_t GetThread() const {return (m_thread);}
+};
+
+//Process-wide tracer. It's off until Enable() is called; while off, a trace scope costs a single
+//relaxed load. While on, it costs two clock reads and one write to the thread's own ring, cheap
+//enough to leave on in production runs.
+class Tracer
+{
+private:
+    static constexpr size_t DefaultCapacity {1 << 14};     //events per thread, about 1.4 MB
+
+    std::atomic<bool> m_enabled {false};
+    size_t m_capacity {DefaultCapacity};
+    std::chrono::steady_clock::time_point m_origin {std::chrono::steady_clock::now()};
+    std::mutex m_lock;      //guards m_buffers and m_free, taken once per thread, on its first event and on its exit
+    std::vector<std::unique_ptr<TraceBuffer>> m_buffers;
+    std::vector<TraceBuffer *> m_free;  //of the threads that exited
+
+    //Hands the thread's buffer back to the tracer when the thread exits.
+    struct ThreadBufferHolder
+    {
+        TraceBuffer *m_buffer;     //null until the first event: thread_local, so zero-initialized
+
+        ~ThreadBufferHolder()
+        {
+            if(m_buffer)
+            {
+                auto &tracer = Tracer::Instance();
+                auto lock = std::lock_guard<std::mutex>(tracer.m_lock);
+                tracer.m_free.emplace_back(m_buffer);
+            }
+        }
+    };
+
+    static inline thread_local ThreadBufferHolder t_holder;
+
+    Tracer() = default;
+
+    //Buffers are owned by the tracer rather than by the threads, so the events of pool workers that
+    //are long gone can still be exported. A new thread carries on in the buffer of one that exited,
+    //if there is one, after its events: there are never more buffers than threads alive at once,
+    //however many thread pools come and go, e.g. a few per rebuild with --watch.
+    TraceBuffer &ThreadBuffer()
+    {
+        if(!t_holder.m_buffer)
+        {
+            auto lock = std::lock_guard<std::mutex>(m_lock);
+            if(!m_free.empty())
+            {
+                t_holder.m_buffer = m_free.back();
+                m_free.pop_back();
+            }
+            else
+            {
+                m_buffers.emplace_back(std::make_unique<TraceBuffer>(m_capacity, m_buffers.size()));
+                t_holder.m_buffer = m_buffers.back().get();
+            }
+        }
+        return (*t_holder.m_buffer);
+    }
+
+    //Busy time of one thread: the union of its scopes, so that nested scopes count once.
+    static int64_t BusyTime(std::vector<TraceEvent> events)
+    {
+        std::sort(events.begin(), events.end(), [](auto &a, auto &b) {return (a.m_start < b.m_start);});
+        auto busy = int64_t {0};
+        auto covered_until = std::numeric_limits<int64_t>::min();
+        for(auto &event : events)
+        {
+            auto end = event.m_start + event.m_duration;
+            if(end <= covered_until)
+            {
+                continue;
+            }
+            busy += end - std::max(event.m_start, covered_until);
+            covered_until = end;
+        }
+        return (busy);
+    }
+
+public:
+    Tracer(const Tracer &) = delete;
+    Tracer &operator=(const Tracer &) = delete;
+    ~Tracer() = default;
+
+    static Tracer &Instance()
+    {
+        static auto tracer = Tracer();
+        return (tracer);
+    }
+
+    //capacity is the number of events kept per thread. It only affects threads that haven't
+    //recorded anything yet.
+    void Enable(size_t capacity = DefaultCapacity)
+    {
+        m_capacity = std::max<size_t>(capacity, 1);
+        m_enabled.store(true, std::memory_order_relaxed);
+    }
+
+    void Disable() {m_enabled.store(false, std::memory_order_relaxed);}
+    [[nodiscard]] bool IsEnabled() const {return (m_enabled.load(std::memory_order_relaxed));}
+
+    [[nodiscard]] int64_t Now() const
+    {
+        return (std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_origin).count());
+    }
+
+    void Record(const char *name, int64_t start, std::string_view detail)
+    {
+        ThreadBuffer().Record(name, start, Now() - start, detail);
+    }
+
+    //Chrome trace_event format, as loaded by chrome://tracing and Perfetto: one complete ("X")
+    //event per scope, timestamps in microseconds, one track per buffer, i.e. per thread, or per
+    //threads one after the other.
+    void WriteChromeTrace(const std::filesystem::path &trace_file)
+    {
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        auto trace_json = nlohmann::ordered_json();
+        trace_json["displayTimeUnit"] = "ms";
+        auto &events_json = trace_json["traceEvents"];
+        events_json = nlohmann::ordered_json::array();
+
+        for(auto &buffer : m_buffers)
+        {
+            auto thread = buffer->GetThread();
+            events_json.push_back({{"name", "thread_name"}, {"ph", "M"}, {"pid", 1}, {"tid", thread},
+                                   {"args", {{"name", "thread " + std::to_string(thread)}}}});
+
+            for(auto &event : buffer->Events())
+            {
+                auto event_json = nlohmann::ordered_json();
+                event_json["name"] = event.m_name;
+                event_json["cat"] = "project_builder";
+                event_json["ph"] = "X";
+                event_json["ts"] = static_cast<double>(event.m_start) / 1000.0;
+                event_json["dur"] = static_cast<double>(event.m_duration) / 1000.0;
+                event_json["pid"] = 1;
+                event_json["tid"] = thread;
+                if(event.m_detail[0] != '\0')
+                {
+                    event_json["args"] = {{"detail", event.m_detail}};
+                }
+                events_json.push_back(event_json);
+            }
+        }
+
+        auto out_file = std::ofstream(trace_file, std::ios::out | std::ios::trunc);
+        //A detail cut in the middle of a multi-byte character mustn't fail the export.
+        out_file << trace_json.dump(-1, ' ', false, nlohmann::ordered_json::error_handler_t::replace);
+    }
+
+    //For every thread that recorded anything: its number of events and the share of the traced
+    //wall-clock time it spent inside a scope.
+    void PrintUtilization(std::ostream &os)
+    {
+        auto lock = std::lock_guard<std::mutex>(m_lock);
+        auto first = std::numeric_limits<int64_t>::max();
+        auto last = std::numeric_limits<int64_t>::min();
+        auto per_thread = std::vector<std::vector<TraceEvent>>();
+        for(auto &buffer : m_buffers)
+        {
+            per_thread.emplace_back(buffer->Events());
+            for(auto &event : per_thread.back())
+            {
+                first = std::min(first, event.m_start);
+                last = std::max(last, event.m_start + event.m_duration);
+            }
+        }
+
+        if(first >= last)
+        {
+            return;
+        }
+
+        auto wall = static_cast<double>(last - first);
+        os << "Traced " << wall / 1e6 << " ms on " << m_buffers.size() << " thread(s)" << std::endl;
+        for(size_t i = 0; i < m_buffers.size(); ++i)
+        {
+            auto busy = static_cast<double>(BusyTime(per_thread[i]));
+            os << "  thread " << m_buffers[i]->GetThread() << ": " << per_thread[i].size() << " event(s), busy "
+               << busy / 1e6 << " ms (" << 100.0 * busy / wall << "%)";
+            if(m_buffers[i]->Dropped() > 0)
+            {
+                os << ", " << m_buffers[i]->Dropped() << " oldest event(s) dropped";
+            }
+            os << std::endl;
+        }
+    }
+};
+
+//Records the time between its construction and its destruction. Whether the tracer is on is
+//decided at construction, so a scope never records half an event.
+class TraceScope
+{
+private:
+    const char *m_name;
+    std::string_view m_detail;
+    int64_t m_start {-1};
+
+public:
+    explicit TraceScope(const char *name, std::string_view detail = {}) : m_name(name), m_detail(detail)
+    {
+        auto &tracer = Tracer::Instance();
+        if(tracer.IsEnabled())
+        {
+            m_start = tracer.Now();
+        }
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+    ~TraceScope()
+    {
+        if(m_start >= 0)
+        {
+            Tracer::Instance().Record(m_name, m_start, m_detail);
+        }
+    }
+};
+
+#define TRACE_CONCATENATE_DETAIL(a, b) a##b
+#define TRACE_CONCATENATE(a, b) TRACE_CONCATENATE_DETAIL(a, b)
+
+//TRACE_SCOPE("Name") or TRACE_SCOPE("Name", detail) traces the rest of the enclosing block. The
+//detail must outlive the block.
+#define TRACE_SCOPE(...) TraceScope TRACE_CONCATENATE(trace_scope_, __LINE__)(__VA_ARGS__)